@@ -0,0 +1,237 @@
+/*
+	@file Atlas.cpp
+
+	@brief Texture atlas pages for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include <stdlib.h>
+#include "Atlas.h"
+#include "GLState.h"
+
+extern void gllog(const char *fmt, ...);
+
+static void Atlas_ResetPage(Atlas *pAtlas, AtlasPage *pPage)
+{
+	pPage->Nodes[0].x = 0;
+	pPage->Nodes[0].y = 0;
+	pPage->Nodes[0].Width = pAtlas->PageSize;
+	pPage->NumNodes = 1;
+	pPage->NumRects = 0;
+}
+
+static AtlasPage *Atlas_AddPage(Atlas *pAtlas)
+{
+	AtlasPage *pPage;
+	if (pAtlas->NumPages >= pAtlas->MaxPages)
+		return NULL;
+
+	pPage = &pAtlas->Pages[pAtlas->NumPages];
+
+	// Every span is at least one texel wide, so PageSize nodes always suffice
+	pPage->Nodes = (AtlasNode*)malloc(pAtlas->PageSize * sizeof(AtlasNode));
+
+	if (!pPage->Nodes)
+		return NULL;
+
+	Atlas_ResetPage(pAtlas, pPage);
+
+	glGenTextures(1, &pPage->TextureID);
+	GLState_BindTexture(GL_TEXTURE_2D, pPage->TextureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, pAtlas->InternalFormat, pAtlas->PageSize, pAtlas->PageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	pAtlas->NumPages++;
+	return pPage;
+}
+
+// Height the rect would sit at if its left edge went on node Index, or -1 if it does not fit
+static int32 Atlas_Fit(const Atlas *pAtlas, const AtlasPage *pPage, int32 Index, int32 Width, int32 Height)
+{
+	const AtlasNode *pNode = &pPage->Nodes[Index];
+	int32 x = pNode->x, y = 0, Left = Width;
+
+	if (x + Width > pAtlas->PageSize)
+		return -1;
+
+	while (Left > 0)
+	{
+		if (pNode->y > y)
+			y = pNode->y;
+
+		if (y + Height > pAtlas->PageSize)
+			return -1;
+
+		Left -= pNode->Width;
+		pNode++;
+	}
+
+	return y;
+}
+
+// Raise the skyline over the new rect, trimming the spans it covers and merging
+// neighbours left at the same height
+static void Atlas_AddSkyline(AtlasPage *pPage, int32 Index, int32 x, int32 y, int32 Width, int32 Height)
+{
+	AtlasNode *pNodes = pPage->Nodes;
+	int32 i, Shrink;
+
+	memmove(&pNodes[Index + 1], &pNodes[Index], (pPage->NumNodes - Index) * sizeof(AtlasNode));
+	pPage->NumNodes++;
+
+	pNodes[Index].x = x;
+	pNodes[Index].y = y + Height;
+	pNodes[Index].Width = Width;
+
+	for (i = Index + 1; i < pPage->NumNodes; i++)
+	{
+		if (pNodes[i].x >= pNodes[i - 1].x + pNodes[i - 1].Width)
+			break;
+
+		Shrink = pNodes[i - 1].x + pNodes[i - 1].Width - pNodes[i].x;
+
+		if (pNodes[i].Width > Shrink)
+		{
+			pNodes[i].x += Shrink;
+			pNodes[i].Width -= Shrink;
+			break;
+		}
+
+		memmove(&pNodes[i], &pNodes[i + 1], (pPage->NumNodes - i - 1) * sizeof(AtlasNode));
+		pPage->NumNodes--;
+		i--;
+	}
+
+	for (i = 0; i < pPage->NumNodes - 1; i++)
+	{
+		if (pNodes[i].y == pNodes[i + 1].y)
+		{
+			pNodes[i].Width += pNodes[i + 1].Width;
+			memmove(&pNodes[i + 1], &pNodes[i + 2], (pPage->NumNodes - i - 2) * sizeof(AtlasNode));
+			pPage->NumNodes--;
+			i--;
+		}
+	}
+}
+
+static geBoolean Atlas_AllocInPage(Atlas *pAtlas, AtlasPage *pPage, int32 Width, int32 Height, int32 *px, int32 *py)
+{
+	int32 i, y, Best = -1, BestY = pAtlas->PageSize, BestWidth = pAtlas->PageSize + 1;
+
+	for (i = 0; i < pPage->NumNodes; i++)
+	{
+		y = Atlas_Fit(pAtlas, pPage, i, Width, Height);
+
+		if (y < 0)
+			continue;
+
+		// Lowest top edge, then the narrowest span to waste the least
+		if (y + Height < BestY || (y + Height == BestY && pPage->Nodes[i].Width < BestWidth))
+		{
+			Best = i;
+			BestY = y + Height;
+			BestWidth = pPage->Nodes[i].Width;
+		}
+	}
+
+	if (Best < 0)
+		return GE_FALSE;
+
+	*px = pPage->Nodes[Best].x;
+	*py = BestY - Height;
+
+	Atlas_AddSkyline(pPage, Best, *px, *py, Width, Height);
+	pPage->NumRects++;
+	return GE_TRUE;
+}
+
+geBoolean Atlas_Create(Atlas *pAtlas, int32 PageSize, int32 MaxPages, GLenum InternalFormat)
+{
+	memset(pAtlas, 0, sizeof(Atlas));
+
+	if (PageSize <= 0 || MaxPages <= 0)
+		return GE_FALSE;
+
+	pAtlas->PageSize = PageSize;
+	pAtlas->MaxPages = min(MaxPages, ATLAS_MAX_PAGES);
+	pAtlas->InternalFormat = InternalFormat;
+	return GE_TRUE;
+}
+
+void Atlas_Destroy(Atlas *pAtlas)
+{
+	for (int32 i = 0; i < pAtlas->NumPages; i++)
+	{
+		glDeleteTextures(1, &pAtlas->Pages[i].TextureID);
+		GLState_TextureDeleted(pAtlas->Pages[i].TextureID);
+		free(pAtlas->Pages[i].Nodes);
+	}
+
+	memset(pAtlas, 0, sizeof(Atlas));
+}
+
+geBoolean Atlas_Alloc(Atlas *pAtlas, int32 Width, int32 Height, GLuint *pTextureID, int32 *px, int32 *py)
+{
+	AtlasPage *pPage;
+
+	if (Width <= 0 || Height <= 0 || Width > pAtlas->PageSize || Height > pAtlas->PageSize)
+		return GE_FALSE;
+
+	for (int32 i = 0; i < pAtlas->NumPages; i++)
+	{
+		pPage = &pAtlas->Pages[i];
+
+		if (Atlas_AllocInPage(pAtlas, pPage, Width, Height, px, py))
+		{
+			*pTextureID = pPage->TextureID;
+			pAtlas->NumRects++;
+			return GE_TRUE;
+		}
+	}
+
+	pPage = Atlas_AddPage(pAtlas);
+
+	if (!pPage || !Atlas_AllocInPage(pAtlas, pPage, Width, Height, px, py))
+	{
+		pAtlas->Failed++;
+		return GE_FALSE;
+	}
+
+	*pTextureID = pPage->TextureID;
+	pAtlas->NumRects++;
+	return GE_TRUE;
+}
+
+void Atlas_Free(Atlas *pAtlas, GLuint TextureID)
+{
+	for (int32 i = 0; i < pAtlas->NumPages; i++)
+	{
+		AtlasPage *pPage = &pAtlas->Pages[i];
+
+		if (pPage->TextureID != TextureID)
+			continue;
+
+		pAtlas->NumRects--;
+
+		// Skylines cannot give space back, so an emptied page just starts over
+		if (--pPage->NumRects == 0)
+			Atlas_ResetPage(pAtlas, pPage);
+
+		return;
+	}
+}
@@ -0,0 +1,63 @@
+/*
+	@file Atlas.h
+
+	@brief Texture atlas pages for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __ATLAS_H__
+#define __ATLAS_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+#define ATLAS_MAX_PAGES				32
+
+// One span of the skyline: the free area above y, from x to x + Width
+typedef struct AtlasNode
+{
+	int32		x, y, Width;
+} AtlasNode;
+
+typedef struct AtlasPage
+{
+	GLuint		TextureID;
+	AtlasNode	*Nodes;							// Skyline, left to right
+	int32		NumNodes;
+	int32		NumRects;						// Live allocations.  The page is reset when this drops to zero.
+} AtlasPage;
+
+typedef struct Atlas
+{
+	int32		PageSize;						// Pages are square
+	int32		MaxPages;
+	GLenum		InternalFormat;
+	int32		NumPages;
+	AtlasPage	Pages[ATLAS_MAX_PAGES];
+	uint32		NumRects;
+	uint32		Failed;							// Allocations that did not fit anywhere
+} Atlas;
+
+// Pages are created as they are needed, up to MaxPages
+geBoolean Atlas_Create(Atlas *pAtlas, int32 PageSize, int32 MaxPages, GLenum InternalFormat);
+void Atlas_Destroy(Atlas *pAtlas);
+
+// Find room for a Width x Height rect (skyline, bottom left).  Returns the page texture
+// and the rect's top left texel.  May bind a new page to the active unit.
+geBoolean Atlas_Alloc(Atlas *pAtlas, int32 Width, int32 Height, GLuint *pTextureID, int32 *px, int32 *py);
+
+// Release one rect on the page holding TextureID
+void Atlas_Free(Atlas *pAtlas, GLuint TextureID);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+	@file CpuInfo.cpp
+
+	@brief CPU feature detection for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#include "CpuInfo.h"
+
+static geBoolean	gAsked = GE_FALSE;
+static uint32		gFeatures = 0;
+
+static uint32 CpuInfo_Ask(void)
+{
+	uint32 Features = 0;
+#ifdef _MSC_VER
+	int Info[4];
+	int MaxLeaf;
+	geBoolean Avx;
+
+	__cpuid(Info, 0);
+	MaxLeaf = Info[0];
+
+	__cpuid(Info, 1);
+
+	if (Info[3] & (1 << 26))
+		Features |= CPUINFO_SSE2;
+
+	if (Info[2] & (1 << 9))
+		Features |= CPUINFO_SSSE3;
+
+	// AVX needs the OS to save the ymm registers (OSXSAVE, then XCR0 bits 1 and 2)
+	Avx = (Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+
+	if (Avx && MaxLeaf >= 7)
+	{
+		__cpuidex(Info, 7, 0);
+
+		if (Info[1] & (1 << 5))
+			Features |= CPUINFO_AVX2;
+	}
+#else
+	if (__builtin_cpu_supports("sse2"))
+		Features |= CPUINFO_SSE2;
+
+	if (__builtin_cpu_supports("ssse3"))
+		Features |= CPUINFO_SSSE3;
+
+	if (__builtin_cpu_supports("avx2"))
+		Features |= CPUINFO_AVX2;
+#endif
+
+	return Features;
+}
+
+uint32 CpuInfo_Features(void)
+{
+	if (!gAsked)
+	{
+		gFeatures = CpuInfo_Ask();
+		gAsked = GE_TRUE;
+	}
+
+	return gFeatures;
+}
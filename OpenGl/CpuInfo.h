@@ -0,0 +1,31 @@
+/*
+	@file CpuInfo.h
+
+	@brief CPU feature detection for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __CPUINFO_H__
+#define __CPUINFO_H__
+
+#include "dcommon.h"
+
+// Instruction sets the SIMD kernels are written for
+#define CPUINFO_SSE2				(1<<0)
+#define CPUINFO_SSSE3				(1<<1)
+#define CPUINFO_AVX2				(1<<2)		// Only if the OS saves the ymm registers too
+
+// CPUINFO_* bits for what this CPU (and OS) can run.  Asked once, then remembered.
+uint32 CpuInfo_Features(void);
+
+#endif
@@ -0,0 +1,287 @@
+/*
+	@file FrameStats.cpp
+
+	@brief Per frame render statistics for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include "FrameStats.h"
+#include "OglDrv.h"
+#include "GLState.h"
+
+extern void gllog(const char *fmt, ...);
+
+// Phase timings of one frame, kept until its timer queries come back
+typedef struct FrameTimings
+{
+	uint32		Frame;
+	geBoolean	Pending;								// Has scopes waiting to be read
+	uint32		NumScopes;
+	int32		ScopePhase[FRAMESTATS_MAX_SCOPES];
+	GLuint		Queries[FRAMESTATS_MAX_SCOPES][2];		// Begin and end timestamps
+	LONGLONG	CpuTicks[FRAMESTATS_NUM_PHASES];
+} FrameTimings;
+
+DRV_FrameStats			FrameStats;
+
+static DRV_FrameStats	gLastFrame;				// What DriverGetFrameStats hands out
+static GLStateStats		gStateAtBegin;			// GLState keeps running totals, frames take the difference
+static LONGLONG			gSetupLightmapTicks;
+static uint32			gFrame = 0;
+
+static FrameTimings		gTimings[FRAMESTATS_TIMED_FRAMES];
+static uint32			gTiming = 0;								// Slot the current frame records into
+static geBoolean		gGpuTimers = GE_FALSE;
+static int32			gOpenScope[FRAMESTATS_NUM_PHASES];			// -1, or the GPU scope a phase is in
+static LONGLONG			gPhaseStart[FRAMESTATS_NUM_PHASES];			// 0 while a phase is closed
+
+// The latest timings read back, and running totals for the shutdown log
+static uint32			gTimedFrame = 0;
+static float			gCpuMs[FRAMESTATS_NUM_PHASES];
+static float			gGpuMs[FRAMESTATS_NUM_PHASES];
+static double			gTotalCpuMs[FRAMESTATS_NUM_PHASES];
+static double			gTotalGpuMs[FRAMESTATS_NUM_PHASES];
+static uint32			gTimedFrames = 0;
+static uint32			gDroppedFrames = 0;
+
+static const char *gPhaseNames[FRAMESTATS_NUM_PHASES] =
+{
+	"world", "meshes", "models", "world flush", "misc flush", "decals"
+};
+
+void FrameStats_Initialize(void)
+{
+	memset(gTimings, 0, sizeof(gTimings));
+	memset(gCpuMs, 0, sizeof(gCpuMs));
+	memset(gGpuMs, 0, sizeof(gGpuMs));
+	memset(gTotalCpuMs, 0, sizeof(gTotalCpuMs));
+	memset(gTotalGpuMs, 0, sizeof(gTotalGpuMs));
+	memset(gPhaseStart, 0, sizeof(gPhaseStart));
+
+	for (int32 i = 0; i < FRAMESTATS_NUM_PHASES; i++)
+		gOpenScope[i] = -1;
+
+	gTiming = 0;
+	gTimedFrame = 0;
+	gTimedFrames = 0;
+	gDroppedFrames = 0;
+
+	gGpuTimers = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) ? GE_TRUE : GE_FALSE;
+
+	if (gGpuTimers)
+	{
+		for (int32 i = 0; i < FRAMESTATS_TIMED_FRAMES; i++)
+			glGenQueries(FRAMESTATS_MAX_SCOPES * 2, &gTimings[i].Queries[0][0]);
+
+		gllog("Timing render phases with GL timestamp queries...");
+	}
+}
+
+void FrameStats_Shutdown(void)
+{
+	if (gTimedFrames)
+	{
+		gllog("Phase timings over %u frames (%u dropped), ms per frame CPU / GPU:", gTimedFrames, gDroppedFrames);
+
+		for (int32 i = 0; i < FRAMESTATS_NUM_PHASES; i++)
+		{
+			if (FRAMESTATS_GPU_PHASE(i))
+			{
+				gllog("  %s: %.3f / %.3f", gPhaseNames[i], gTotalCpuMs[i] / (double)gTimedFrames,
+					gTotalGpuMs[i] / (double)gTimedFrames);
+			}
+			else
+				gllog("  %s: %.3f / -", gPhaseNames[i], gTotalCpuMs[i] / (double)gTimedFrames);
+		}
+	}
+
+	if (gGpuTimers)
+	{
+		for (int32 i = 0; i < FRAMESTATS_TIMED_FRAMES; i++)
+			glDeleteQueries(FRAMESTATS_MAX_SCOPES * 2, &gTimings[i].Queries[0][0]);
+
+		gGpuTimers = GE_FALSE;
+	}
+}
+
+// Read back a frame's timings if the GPU has finished with all of them.  GE_FALSE if it has not.
+static geBoolean FrameStats_ReadTimings(FrameTimings *pTimings)
+{
+	GLuint Available = GL_TRUE;
+	GLuint64 Begin, End;
+	LARGE_INTEGER Freq;
+
+	// Timestamps land in order, so the last one being in means they all are
+	if (pTimings->NumScopes)
+		glGetQueryObjectuiv(pTimings->Queries[pTimings->NumScopes - 1][1], GL_QUERY_RESULT_AVAILABLE, &Available);
+
+	if (!Available)
+		return GE_FALSE;
+
+	QueryPerformanceFrequency(&Freq);
+
+	for (int32 i = 0; i < FRAMESTATS_NUM_PHASES; i++)
+	{
+		gCpuMs[i] = (float)(pTimings->CpuTicks[i] * 1000.0 / (double)Freq.QuadPart);
+		gGpuMs[i] = 0.0f;
+	}
+
+	for (uint32 i = 0; i < pTimings->NumScopes; i++)
+	{
+		glGetQueryObjectui64v(pTimings->Queries[i][0], GL_QUERY_RESULT, &Begin);
+		glGetQueryObjectui64v(pTimings->Queries[i][1], GL_QUERY_RESULT, &End);
+
+		gGpuMs[pTimings->ScopePhase[i]] += (float)((End - Begin) / 1000000.0);
+	}
+
+	for (int32 i = 0; i < FRAMESTATS_NUM_PHASES; i++)
+	{
+		gTotalCpuMs[i] += gCpuMs[i];
+		gTotalGpuMs[i] += gGpuMs[i];
+	}
+
+	gTimedFrame = pTimings->Frame;
+	gTimedFrames++;
+
+	return GE_TRUE;
+}
+
+void FrameStats_BeginFrame(void)
+{
+	FrameTimings *pTimings;
+
+	memset(&FrameStats, 0, sizeof(FrameStats));
+	gSetupLightmapTicks = 0;
+
+	GLState_GetStats(&gStateAtBegin);
+
+	// EndFrame read back or dropped this slot's last frame already
+	gTiming = (gTiming + 1) % FRAMESTATS_TIMED_FRAMES;
+	pTimings = &gTimings[gTiming];
+
+	pTimings->Frame = gFrame + 1;
+	pTimings->Pending = GE_TRUE;
+	pTimings->NumScopes = 0;
+	memset(pTimings->CpuTicks, 0, sizeof(pTimings->CpuTicks));
+}
+
+void FrameStats_BeginPhase(int32 Phase)
+{
+	FrameTimings *pTimings = &gTimings[gTiming];
+	LARGE_INTEGER Now;
+
+	if (gPhaseStart[Phase])
+		return;
+
+	QueryPerformanceCounter(&Now);
+	gPhaseStart[Phase] = Now.QuadPart;
+
+	if (gGpuTimers && FRAMESTATS_GPU_PHASE(Phase) && pTimings->NumScopes < FRAMESTATS_MAX_SCOPES)
+	{
+		gOpenScope[Phase] = pTimings->NumScopes++;
+		pTimings->ScopePhase[gOpenScope[Phase]] = Phase;
+		glQueryCounter(pTimings->Queries[gOpenScope[Phase]][0], GL_TIMESTAMP);
+	}
+}
+
+void FrameStats_EndPhase(int32 Phase)
+{
+	FrameTimings *pTimings = &gTimings[gTiming];
+	LARGE_INTEGER Now;
+
+	if (!gPhaseStart[Phase])
+		return;
+
+	if (gOpenScope[Phase] >= 0)
+	{
+		glQueryCounter(pTimings->Queries[gOpenScope[Phase]][1], GL_TIMESTAMP);
+		gOpenScope[Phase] = -1;
+	}
+
+	QueryPerformanceCounter(&Now);
+	pTimings->CpuTicks[Phase] += Now.QuadPart - gPhaseStart[Phase];
+	gPhaseStart[Phase] = 0;
+}
+
+void FrameStats_EndFrame(DRV_CacheInfo *pCacheInfo)
+{
+	GLStateStats State;
+	FrameTimings *pTimings;
+	LARGE_INTEGER Freq;
+
+	GLState_GetStats(&State);
+	QueryPerformanceFrequency(&Freq);
+
+	FrameStats.Size = sizeof(DRV_FrameStats);
+	FrameStats.Frame = ++gFrame;
+	FrameStats.Polys = OGLDRV.NumRenderedPolys;
+	FrameStats.StateChanges = State.Calls - gStateAtBegin.Calls;
+	FrameStats.StateChangesElided = State.Elided - gStateAtBegin.Elided;
+
+	for (int32 i = 0; i < FRAMESTATS_UNITS && i < GLSTATE_MAX_UNITS; i++)
+		FrameStats.Binds[i] = State.Binds[i] - gStateAtBegin.Binds[i];
+
+	FrameStats.SetupLightmapMs = (float)(gSetupLightmapTicks * 1000.0 / (double)Freq.QuadPart);
+
+	// The oldest frame in flight is the slot BeginFrame reuses next.  Whatever has not
+	// come back by now is dropped rather than waited for.
+	pTimings = &gTimings[(gTiming + 1) % FRAMESTATS_TIMED_FRAMES];
+
+	if (pTimings->Pending)
+	{
+		if (!FrameStats_ReadTimings(pTimings))
+			gDroppedFrames++;
+
+		pTimings->Pending = GE_FALSE;
+	}
+
+	FrameStats.TimedFrame = gTimedFrame;
+	memcpy(FrameStats.CpuMs, gCpuMs, sizeof(gCpuMs));
+	memcpy(FrameStats.GpuMs, gGpuMs, sizeof(gGpuMs));
+
+	gLastFrame = FrameStats;
+
+	// GL manages residency itself, so nothing is ever evicted by the driver
+	pCacheInfo->CacheFull = FrameStats.OverflowFlushes;
+	pCacheInfo->CacheRemoved = 0;
+	pCacheInfo->CacheFlushes = FrameStats.CacheFlushes;
+	pCacheInfo->TexMisses = FrameStats.TextureUpdates;
+	pCacheInfo->LMapMisses = FrameStats.LightmapDownloads;
+}
+
+void FrameStats_SetupLightmap(DRV_LInfo *LInfo, geBoolean *pDynamic)
+{
+	LARGE_INTEGER Start, End;
+
+	QueryPerformanceCounter(&Start);
+	OGLDRV.SetupLightmap(LInfo, pDynamic);
+	QueryPerformanceCounter(&End);
+
+	gSetupLightmapTicks += End.QuadPart - Start.QuadPart;
+}
+
+DllExport geBoolean DriverGetFrameStats(DRV_FrameStats *pStats)
+{
+	uint32 Size;
+
+	if (!pStats || pStats->Size < sizeof(uint32))
+		return GE_FALSE;
+
+	// Older callers get the fields they know about, newer ones learn how many we filled
+	Size = min(pStats->Size, (uint32)sizeof(DRV_FrameStats));
+	memcpy(pStats, &gLastFrame, Size);
+	pStats->Size = Size;
+
+	return GE_TRUE;
+}
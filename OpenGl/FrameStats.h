@@ -0,0 +1,91 @@
+/*
+	@file FrameStats.h
+
+	@brief Per frame render statistics for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __FRAMESTATS_H__
+#define __FRAMESTATS_H__
+
+#include "dcommon.h"
+
+#define FRAMESTATS_UNITS			4			// Texture units binds are counted for
+
+// Timed phases: the engine's world, mesh and model scopes, and the poly cache flushes.
+// Everything the engine submits is only drawn by the flushes at EndScene, so its scopes
+// hold no GL work and are timed on the CPU alone.  GPU time is per flush; meshes and
+// models both land in the misc flush.
+#define FRAMESTATS_PHASE_WORLD			0
+#define FRAMESTATS_PHASE_MESHES			1
+#define FRAMESTATS_PHASE_MODELS			2
+#define FRAMESTATS_PHASE_WORLD_FLUSH	3
+#define FRAMESTATS_PHASE_MISC_FLUSH		4
+#define FRAMESTATS_PHASE_DECALS			5
+#define FRAMESTATS_NUM_PHASES			6
+
+#define FRAMESTATS_GPU_PHASE(Phase)		((Phase) >= FRAMESTATS_PHASE_WORLD_FLUSH)
+
+#define FRAMESTATS_TIMED_FRAMES			3			// Frames of timer queries in flight
+#define FRAMESTATS_MAX_SCOPES			64			// GPU timed scopes per frame, later ones are CPU only
+
+// Counters for one frame, BeginScene to EndScene.  Engines read them through
+// DriverGetFrameStats; new fields only ever go on the end.
+typedef struct DRV_FrameStats
+{
+	uint32		Size;							// sizeof(DRV_FrameStats), set by the caller
+	uint32		Frame;							// Frames ended since the driver was loaded
+	uint32		Polys;							// OGLDRV.NumRenderedPolys
+	uint32		DrawCalls;
+	uint32		Batches;						// Poly cache batches
+	uint32		Binds[FRAMESTATS_UNITS];		// Texture binds that reached GL, per unit
+	uint32		StateChanges;					// Shadowed GL state changes that reached GL
+	uint32		StateChangesElided;				// Redundant ones the state cache dropped
+	uint32		VertexBytes;					// Vertex, index and parameter table data
+	uint32		TextureBytes;					// Texture uploads, mips included
+	uint32		LightmapBytes;
+	uint32		TextureUpdates;					// THandle_Update calls
+	uint32		LightmapDownloads;				// Lightmaps copied out of the engine
+	uint32		CacheFlushes;					// World and misc poly cache flushes
+	uint32		OverflowFlushes;				// Of those, mid-frame ones because a cache was full
+	float		SetupLightmapMs;				// Time in the engine's SetupLightmap callback
+	uint32		TimedFrame;						// Frame the phase timings are for, a few behind Frame
+	float		CpuMs[FRAMESTATS_NUM_PHASES];	// Per phase, summed over every time it ran that frame
+	float		GpuMs[FRAMESTATS_NUM_PHASES];	// The flush scopes on the GPU.  0 for the engine's scopes,
+												// and without GL_ARB_timer_query.
+} DRV_FrameStats;
+
+// The frame being counted.  Drawing code adds to it directly.
+extern DRV_FrameStats FrameStats;
+
+// Timer queries need the context
+void FrameStats_Initialize(void);
+void FrameStats_Shutdown(void);
+
+// BeginScene zeroes the counters, EndScene publishes them and fills in CacheInfo
+void FrameStats_BeginFrame(void);
+void FrameStats_EndFrame(DRV_CacheInfo *pCacheInfo);
+
+// Time a FRAMESTATS_PHASE_* scope on the CPU, and flush scopes with timestamp queries on
+// the GPU too.  Different phases may nest.  GPU results are read FRAMESTATS_TIMED_FRAMES - 1 frames
+// later, and only if they are in by then, so timing never stalls the pipe.
+void FrameStats_BeginPhase(int32 Phase);
+void FrameStats_EndPhase(int32 Phase);
+
+// Call the engine's SetupLightmap, timing it
+void FrameStats_SetupLightmap(DRV_LInfo *LInfo, geBoolean *pDynamic);
+
+// Copy out the last complete frame's counters, as much of them as pStats->Size asks for
+DllExport geBoolean DriverGetFrameStats(DRV_FrameStats *pStats);
+
+#endif
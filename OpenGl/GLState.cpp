@@ -0,0 +1,286 @@
+/*
+	@file GLState.cpp
+
+	@brief Shadowed GL state for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include "GLState.h"
+#include "OglDrv.h"
+
+// Shadowed enables.  GL_TEXTURE_2D is per unit and kept in TextureEnable instead.
+#define GLSTATE_CAP_DEPTH_TEST		0
+#define GLSTATE_CAP_BLEND			1
+#define GLSTATE_CAP_MULTISAMPLE		2
+#define GLSTATE_CAP_FOG				3
+#define GLSTATE_CAP_ALPHA_TEST		4
+#define GLSTATE_NUM_CAPS			5
+
+// Shadowed texture targets
+#define GLSTATE_TARGET_2D			0
+#define GLSTATE_TARGET_2D_ARRAY		1
+#define GLSTATE_TARGET_BUFFER		2
+#define GLSTATE_NUM_TARGETS			3
+
+typedef struct GLStateCache
+{
+	GLuint		Caps[GLSTATE_NUM_CAPS];
+	GLuint		DepthMask;
+	GLuint		DepthFunc;
+	GLuint		BlendSrc, BlendDst;
+	GLuint		ActiveUnit;
+	GLuint		Textures[GLSTATE_MAX_UNITS][GLSTATE_NUM_TARGETS];
+	GLuint		TextureEnable[GLSTATE_MAX_UNITS];
+	GLuint		Samplers[GLSTATE_MAX_UNITS];
+	GLuint		Program;
+} GLStateCache;
+
+static GLStateCache	gState;
+static GLStateStats	gStats;
+static GLuint		gSamplers[GLSTATE_NUM_SAMPLERS];
+
+static int32 GLState_CapIndex(GLenum Cap)
+{
+	switch (Cap)
+	{
+		case GL_DEPTH_TEST:		return GLSTATE_CAP_DEPTH_TEST;
+		case GL_BLEND:			return GLSTATE_CAP_BLEND;
+		case GL_MULTISAMPLE:	return GLSTATE_CAP_MULTISAMPLE;
+		case GL_FOG:			return GLSTATE_CAP_FOG;
+		case GL_ALPHA_TEST:		return GLSTATE_CAP_ALPHA_TEST;
+	}
+
+	return -1;
+}
+
+static int32 GLState_TargetIndex(GLenum Target)
+{
+	switch (Target)
+	{
+		case GL_TEXTURE_2D:			return GLSTATE_TARGET_2D;
+		case GL_TEXTURE_2D_ARRAY:	return GLSTATE_TARGET_2D_ARRAY;
+		case GL_TEXTURE_BUFFER:		return GLSTATE_TARGET_BUFFER;
+	}
+
+	return -1;
+}
+
+// GE_TRUE if *pShadow already holds Value.  Otherwise it does from now on and the caller
+// makes the GL call.
+static geBoolean GLState_Same(GLuint *pShadow, GLuint Value)
+{
+	if (*pShadow == Value)
+	{
+		gStats.Elided++;
+		return GE_TRUE;
+	}
+
+	*pShadow = Value;
+	gStats.Calls++;
+	return GE_FALSE;
+}
+
+void GLState_MipFilters(GLint *pMin, GLint *pMag)
+{
+#ifdef USE_LINEAR_INTERPOLATION
+	*pMin = GL_LINEAR_MIPMAP_LINEAR;
+	*pMag = GL_LINEAR;
+#else
+ #ifdef TRILINEAR_INTERPOLATION
+	*pMin = GL_NEAREST_MIPMAP_LINEAR;
+ #else
+	*pMin = GL_NEAREST_MIPMAP_NEAREST;
+ #endif
+	*pMag = GL_NEAREST;
+#endif
+}
+
+static GLuint GLState_CreateSampler(GLint Wrap)
+{
+	GLuint Sampler;
+	GLint Min, Mag;
+
+	glGenSamplers(1, &Sampler);
+
+	GLState_MipFilters(&Min, &Mag);
+	glSamplerParameteri(Sampler, GL_TEXTURE_MIN_FILTER, Min);
+	glSamplerParameteri(Sampler, GL_TEXTURE_MAG_FILTER, Mag);
+
+	glSamplerParameteri(Sampler, GL_TEXTURE_WRAP_S, Wrap);
+	glSamplerParameteri(Sampler, GL_TEXTURE_WRAP_T, Wrap);
+
+	if (bUseAnisotropicFiltering)
+		glSamplerParameterf(Sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
+
+	return Sampler;
+}
+
+void GLState_Initialize(void)
+{
+	memset(&gStats, 0, sizeof(gStats));
+	memset(gSamplers, 0, sizeof(gSamplers));
+
+	GLState_Invalidate();
+
+	if (GLEW_VERSION_3_3 || GLEW_ARB_sampler_objects)
+	{
+		gSamplers[GLSTATE_SAMPLER_REPEAT] = GLState_CreateSampler(GL_REPEAT);
+		gSamplers[GLSTATE_SAMPLER_CLAMP] = GLState_CreateSampler(GL_CLAMP_TO_EDGE);
+		gllog("Using sampler objects for texture wrap and filtering...");
+	}
+}
+
+void GLState_Shutdown(void)
+{
+	if (gStats.Calls + gStats.Elided)
+		gllog("GL state: %u calls made, %u redundant calls elided", gStats.Calls, gStats.Elided);
+
+	if (gSamplers[0])
+	{
+		for (int32 i = 0; i < GLSTATE_MAX_UNITS; i++)
+			glBindSampler(i, 0);
+
+		glDeleteSamplers(GLSTATE_NUM_SAMPLERS, gSamplers);
+		memset(gSamplers, 0, sizeof(gSamplers));
+	}
+
+	GLState_Invalidate();
+}
+
+void GLState_Invalidate(void)
+{
+	// All ones is never a valid value for anything shadowed
+	memset(&gState, 0xFF, sizeof(gState));
+}
+
+static void GLState_Set(GLenum Cap, GLuint Enable)
+{
+	int32 Index = GLState_CapIndex(Cap);
+	GLuint *pShadow = NULL;
+
+	if (Index >= 0)
+		pShadow = &gState.Caps[Index];
+	else if (Cap == GL_TEXTURE_2D && gState.ActiveUnit < GLSTATE_MAX_UNITS)
+		pShadow = &gState.TextureEnable[gState.ActiveUnit];
+
+	if (pShadow && GLState_Same(pShadow, Enable))
+		return;
+
+	if (!pShadow)
+		gStats.Calls++;
+
+	if (Enable)
+		glEnable(Cap);
+	else
+		glDisable(Cap);
+}
+
+void GLState_Enable(GLenum Cap)
+{
+	GLState_Set(Cap, GL_TRUE);
+}
+
+void GLState_Disable(GLenum Cap)
+{
+	GLState_Set(Cap, GL_FALSE);
+}
+
+void GLState_DepthMask(GLboolean Mask)
+{
+	if (!GLState_Same(&gState.DepthMask, Mask))
+		glDepthMask(Mask);
+}
+
+void GLState_DepthFunc(GLenum Func)
+{
+	if (!GLState_Same(&gState.DepthFunc, Func))
+		glDepthFunc(Func);
+}
+
+void GLState_BlendFunc(GLenum Src, GLenum Dst)
+{
+	if (gState.BlendSrc == Src && gState.BlendDst == Dst)
+	{
+		gStats.Elided++;
+		return;
+	}
+
+	gState.BlendSrc = Src;
+	gState.BlendDst = Dst;
+	gStats.Calls++;
+	glBlendFunc(Src, Dst);
+}
+
+void GLState_ActiveTexture(GLenum Texture)
+{
+	if (!GLState_Same(&gState.ActiveUnit, Texture - GL_TEXTURE0))
+		glActiveTexture(Texture);
+}
+
+void GLState_BindTexture(GLenum Target, GLuint TextureID)
+{
+	int32 Index = GLState_TargetIndex(Target);
+
+	if (Index >= 0 && gState.ActiveUnit < GLSTATE_MAX_UNITS)
+	{
+		if (GLState_Same(&gState.Textures[gState.ActiveUnit][Index], TextureID))
+			return;
+	}
+	else
+		gStats.Calls++;
+
+	if (gState.ActiveUnit < GLSTATE_MAX_UNITS)
+		gStats.Binds[gState.ActiveUnit]++;
+
+	glBindTexture(Target, TextureID);
+}
+
+void GLState_UseProgram(GLuint Program)
+{
+	if (!GLState_Same(&gState.Program, Program))
+		glUseProgram(Program);
+}
+
+void GLState_BindSampler(GLuint Unit, GLuint Sampler)
+{
+	if (!gSamplers[0])
+		return;
+
+	if (Unit < GLSTATE_MAX_UNITS && GLState_Same(&gState.Samplers[Unit], Sampler))
+		return;
+
+	glBindSampler(Unit, Sampler);
+}
+
+void GLState_TextureDeleted(GLuint TextureID)
+{
+	for (int32 i = 0; i < GLSTATE_MAX_UNITS; i++)
+	{
+		for (int32 j = 0; j < GLSTATE_NUM_TARGETS; j++)
+		{
+			if (gState.Textures[i][j] == TextureID)
+				gState.Textures[i][j] = 0;
+		}
+	}
+}
+
+GLuint GLState_Sampler(int32 Which)
+{
+	return gSamplers[Which];
+}
+
+void GLState_GetStats(GLStateStats *pStats)
+{
+	*pStats = gStats;
+}
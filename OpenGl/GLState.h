@@ -0,0 +1,71 @@
+/*
+	@file GLState.h
+
+	@brief Shadowed GL state for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+// Texture units whose bindings and enables are shadowed.  Higher units go straight to GL.
+#define GLSTATE_MAX_UNITS			4
+
+// Prebuilt samplers for mipmapped base textures, with the configured anisotropy
+#define GLSTATE_SAMPLER_REPEAT		0
+#define GLSTATE_SAMPLER_CLAMP		1
+#define GLSTATE_NUM_SAMPLERS		2
+
+typedef struct GLStateStats
+{
+	uint32		Calls;							// State changes passed on to GL
+	uint32		Elided;							// Redundant ones skipped
+	uint32		Binds[GLSTATE_MAX_UNITS];		// Texture binds passed on, per unit
+} GLStateStats;
+
+// Everything starts out unknown, so the first call for each piece of state always goes through
+void GLState_Initialize(void);
+void GLState_Shutdown(void);
+
+// Forget the shadowed state, for after code that changed GL behind our back
+void GLState_Invalidate(void);
+
+// Drop-in replacements for the GL calls of the same name.  Only state the driver changes
+// often is shadowed; anything else is passed through.
+void GLState_Enable(GLenum Cap);
+void GLState_Disable(GLenum Cap);
+void GLState_DepthMask(GLboolean Mask);
+void GLState_DepthFunc(GLenum Func);
+void GLState_BlendFunc(GLenum Src, GLenum Dst);
+void GLState_ActiveTexture(GLenum Texture);
+void GLState_BindTexture(GLenum Target, GLuint TextureID);
+void GLState_UseProgram(GLuint Program);
+void GLState_BindSampler(GLuint Unit, GLuint Sampler);
+
+// GL reverts every binding of a deleted texture to 0
+void GLState_TextureDeleted(GLuint TextureID);
+
+// Min and mag filters for mipped textures, as the build's USE_LINEAR_INTERPOLATION and
+// TRILINEAR_INTERPOLATION options pick them
+void GLState_MipFilters(GLint *pMin, GLint *pMag);
+
+// GLSTATE_SAMPLER_*, or 0 when the context has no sampler objects
+GLuint GLState_Sampler(int32 Which);
+
+void GLState_GetStats(GLStateStats *pStats);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+	@file MipGen.cpp
+
+	@brief Mipmap generation for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include <stdlib.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "MipGen.h"
+#include "OglDrv.h"
+#include "TexUpload.h"
+
+#define MIPGEN_LINEAR_BITS			12			// Linear light precision of the sRGB tables
+
+static geBoolean	gCanDoStorage = GE_FALSE;
+static geBoolean	gGpuMips = GE_FALSE;
+
+static uint16		gToLinear[256];									// sRGB byte to 16 bit linear
+static GLubyte		gToSRGB[1 << MIPGEN_LINEAR_BITS];				// Top bits of linear to sRGB byte
+
+void MipGen_Initialize(void)
+{
+	double c;
+
+	gCanDoStorage = (GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) ? GE_TRUE : GE_FALSE;
+	gGpuMips = (!bUseSRGBMips && gCanDoStorage && (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object)) ? GE_TRUE : GE_FALSE;
+
+	for (int32 i = 0; i < 256; i++)
+	{
+		c = i / 255.0;
+		c = (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+		gToLinear[i] = (uint16)(c * 65535.0 + 0.5);
+	}
+
+	for (int32 i = 0; i < (1 << MIPGEN_LINEAR_BITS); i++)
+	{
+		// Centre of the bucket
+		c = (i + 0.5) / (double)(1 << MIPGEN_LINEAR_BITS);
+		c = (c <= 0.0031308) ? c * 12.92 : 1.055 * pow(c, 1.0 / 2.4) - 0.055;
+		gToSRGB[i] = (GLubyte)(c * 255.0 + 0.5);
+	}
+
+	if (gGpuMips)
+		gllog("Generating mipmaps on the GPU...");
+	else
+		gllog("Generating mipmaps on the CPU%s...", bUseSRGBMips ? " in linear light" : "");
+}
+
+int32 MipGen_Levels(int32 Width, int32 Height)
+{
+	int32 Levels = 1;
+
+	for (int32 Size = max(Width, Height); Size > 1; Size >>= 1)
+		Levels++;
+
+	return Levels;
+}
+
+// Sum four texels in linear light and take the result back to sRGB
+static __inline GLubyte MipGen_AverageSRGB(GLubyte a, GLubyte b, GLubyte c, GLubyte d)
+{
+	uint32 Sum = gToLinear[a] + gToLinear[b] + gToLinear[c] + gToLinear[d];
+
+	return gToSRGB[(Sum + 2) >> (2 + 16 - MIPGEN_LINEAR_BITS)];
+}
+
+// Two RGBA output texels at a time from two rows of four.  Exact (a + b + c + d + 2) >> 2,
+// the same as the scalar loop.
+static int32 MipGen_DownsampleRowSSE2(const GLubyte *pRow0, const GLubyte *pRow1, int32 w, GLubyte *pDst)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Two = _mm_set1_epi16(2);
+	__m128i r0, r1, Lo, Hi, Sum;
+	int32 x;
+
+	for (x = 0; x + 2 <= w; x += 2, pRow0 += 16, pRow1 += 16, pDst += 8)
+	{
+		r0 = _mm_loadu_si128((const __m128i*)pRow0);
+		r1 = _mm_loadu_si128((const __m128i*)pRow1);
+
+		// Columns summed: texels 0,1 in Lo and 2,3 in Hi
+		Lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, Zero), _mm_unpacklo_epi8(r1, Zero));
+		Hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, Zero), _mm_unpackhi_epi8(r1, Zero));
+
+		// Pairs summed: 0+1 and 2+3
+		Sum = _mm_add_epi16(_mm_unpacklo_epi64(Lo, Hi), _mm_unpackhi_epi64(Lo, Hi));
+		Sum = _mm_srli_epi16(_mm_add_epi16(Sum, Two), 2);
+
+		_mm_storel_epi64((__m128i*)pDst, _mm_packus_epi16(Sum, Zero));
+	}
+
+	return x;
+}
+
+void MipGen_Downsample(const GLubyte *pSrc, int32 Width, int32 Height, int32 Bpp, GLubyte *pDst)
+{
+	int32 w = max(1, Width >> 1), h = max(1, Height >> 1);
+	int32 dx = (Width > 1) ? Bpp : 0, dy = (Height > 1) ? Width * Bpp : 0;
+	int32 x, y, c;
+	const GLubyte *p;
+
+	for (y = 0; y < h; y++)
+	{
+		p = pSrc + (y * 2 * Width) * Bpp;
+
+		if (Height == 1)
+			p = pSrc;
+
+		x = 0;
+
+		if (!bUseSRGBMips && Bpp == 4 && dx && dy)
+		{
+			x = MipGen_DownsampleRowSSE2(p, p + dy, w, pDst);
+			p += x * 8;
+			pDst += x * 4;
+		}
+
+		for (; x < w; x++, p += dx * 2, pDst += Bpp)
+		{
+			if (bUseSRGBMips)
+			{
+				for (c = 0; c < 3; c++)
+					pDst[c] = MipGen_AverageSRGB(p[c], p[c + dx], p[c + dy], p[c + dx + dy]);
+
+				if (Bpp == 4)
+					pDst[3] = (GLubyte)((p[3] + p[3 + dx] + p[3 + dy] + p[3 + dx + dy] + 2) >> 2);
+			}
+			else
+			{
+				for (c = 0; c < Bpp; c++)
+					pDst[c] = (GLubyte)((p[c] + p[c + dx] + p[c + dy] + p[c + dx + dy] + 2) >> 2);
+			}
+		}
+	}
+}
+
+// Create storage for Levels levels of the bound texture, immutable where the context can.
+// Plain RGB(A)8 even with SRGBMips: GL_SRGB8 storage would hand the shaders linear colour,
+// and the lightmaps, fog and framebuffer all still work on sRGB values.
+static void MipGen_Allocate(int32 Width, int32 Height, GLenum Format, int32 Levels)
+{
+	GLenum InternalFormat = (Format == GL_RGBA) ? GL_RGBA8 : GL_RGB8;
+
+	if (gCanDoStorage)
+	{
+		glTexStorage2D(GL_TEXTURE_2D, Levels, InternalFormat, Width, Height);
+		return;
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, Levels - 1);
+
+	for (int32 i = 0; i < Levels; i++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, i, InternalFormat, Width, Height, 0, Format, GL_UNSIGNED_BYTE, NULL);
+		Width = max(1, Width >> 1);
+		Height = max(1, Height >> 1);
+	}
+}
+
+// One level from system memory, through the staging ring
+static uint32 MipGen_UploadLevel(int32 Level, const GLubyte *pData, int32 Width, int32 Height, GLenum Format)
+{
+	uint32 Size = Width * Height * ((Format == GL_RGBA) ? 4 : 3);
+
+	glTexSubImage2D(GL_TEXTURE_2D, Level, 0, 0, Width, Height, Format, GL_UNSIGNED_BYTE, TexUpload_Copy(pData, Size));
+	TexUpload_Done();
+
+	return Size;
+}
+
+uint32 MipGen_Upload(const GLubyte * const *ppLevels, int32 NumLevels, int32 Width, int32 Height, GLenum Format,
+	geBoolean Allocate)
+{
+	int32 Bpp = (Format == GL_RGBA) ? 4 : 3;
+	int32 Levels = MipGen_Levels(Width, Height);
+	int32 w = Width, h = Height, Level;
+	GLubyte *pMips, *pDst;
+	const GLubyte *pSrc;
+	geBoolean EngineMips = GE_FALSE;
+	uint32 Bytes;
+
+	for (Level = 1; Level < NumLevels && Level < Levels; Level++)
+	{
+		if (ppLevels[Level])
+			EngineMips = GE_TRUE;
+	}
+
+	if (Allocate)
+		MipGen_Allocate(Width, Height, Format, Levels);
+
+	Bytes = MipGen_UploadLevel(0, ppLevels[0], Width, Height, Format);
+
+	// glGenerateMipmap would replace the engine's levels, so it is only for textures without
+	if (gGpuMips && !EngineMips)
+	{
+		glGenerateMipmap(GL_TEXTURE_2D);
+		return Bytes;
+	}
+
+	// Each level is at most half the one above, so the chain fits in the top's size
+	pMips = (GLubyte*)malloc(Width * Height * Bpp);
+
+	if (!pMips)
+		return Bytes;
+
+	for (Level = 1, pSrc = ppLevels[0], pDst = pMips; Level < Levels; Level++)
+	{
+		if (Level < NumLevels && ppLevels[Level])
+		{
+			pSrc = ppLevels[Level];
+			w = max(1, w >> 1);
+			h = max(1, h >> 1);
+		}
+		else
+		{
+			MipGen_Downsample(pSrc, w, h, Bpp, pDst);
+
+			w = max(1, w >> 1);
+			h = max(1, h >> 1);
+			pSrc = pDst;
+			pDst += w * h * Bpp;
+		}
+
+		Bytes += MipGen_UploadLevel(Level, pSrc, w, h, Format);
+	}
+
+	free(pMips);
+	return Bytes;
+}
+
+uint32 MipGen_UploadBase(const GLubyte *pData, int32 Width, int32 Height, GLenum Format, geBoolean Allocate)
+{
+	if (Allocate)
+		MipGen_Allocate(Width, Height, Format, 1);
+
+	return MipGen_UploadLevel(0, pData, Width, Height, Format);
+}
@@ -0,0 +1,48 @@
+/*
+	@file MipGen.h
+
+	@brief Mipmap generation for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __MIPGEN_H__
+#define __MIPGEN_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+// Picks GPU generation (glGenerateMipmap on glTexStorage2D storage) when the context has
+// it and SRGBMips is off, otherwise the CPU box filter
+void MipGen_Initialize(void);
+
+// Levels in a full chain down to 1x1
+int32 MipGen_Levels(int32 Width, int32 Height);
+
+// 2x2 box filter of Bpp (3 or 4) byte texels down to the next level.  Either side may
+// already be 1.  Colour is averaged in linear light when SRGBMips is set, alpha never is.
+// Only this filter is gamma correct: the levels go back to sRGB bytes in GL_RGB(A)8
+// storage, so GL still filters between texels and levels on the sRGB values.
+void MipGen_Downsample(const GLubyte *pSrc, int32 Width, int32 Height, int32 Bpp, GLubyte *pDst);
+
+// Upload a texture with its full mip chain to the bound GL_TEXTURE_2D.  Format is GL_RGBA
+// or GL_RGB.  ppLevels[0] is the top level; later ones the engine built, or NULL (or past
+// NumLevels) to have them generated from the level above.  Allocate creates the texture's
+// storage; after that the same sized texture is only updated.  Returns the bytes sent.
+uint32 MipGen_Upload(const GLubyte * const *ppLevels, int32 NumLevels, int32 Width, int32 Height, GLenum Format,
+	geBoolean Allocate);
+
+// The same without mips, for textures that are never minified
+uint32 MipGen_UploadBase(const GLubyte *pData, int32 Width, int32 Height, GLenum Format, geBoolean Allocate);
+
+#endif
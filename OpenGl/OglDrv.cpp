@@ -29,13 +29,17 @@
 #include "Render.h"
 #include "Win32.h"
 #include "PCache.h"
+#include "Shader.h"
+#include "GLState.h"
+#include "FrameStats.h"
+#include "VtxConv.h"
 
 int32 LastError;
 char LastErrorStr[255];		
 
 GLfloat	CurrentGamma = 1.0f;
 DRV_Window	ClientWindow;
-static DRV_CacheInfo	CacheInfo;
+DRV_CacheInfo	CacheInfo;
 
 GLint maxTextureSize = 0;
 geBoolean FogEnabled = GE_TRUE;
@@ -52,6 +56,25 @@ unsigned int ZBUFFER_DEPTH;		// Depth of the ZBuffer to use in OpenGL.
 bool bUseFullSceneAntiAliasing = false;
 bool bUseAnisotropicFiltering = false;
 GLfloat fMaxAnisotropy = 8.0f;
+bool bUsePersistentBuffers = true;
+bool bUseShaders = true;
+int iWorldSortMode = PCACHE_SORT_MATERIAL;
+int iLightmapAtlasSize = 1024;
+int iDecalAtlasSize = 1024;
+bool bUseTextureArrays = true;
+bool bUseDepthPrepass = false;
+int iTextureArrayLayers = 16;
+int iUploadBudget = 2048;
+bool bUseSRGBMips = false;
+bool bHandleBenchmark = false;
+int iBlitKernel = CKBLIT_AVX2;
+bool bBenchBlit = false;
+int iVertexKernel = VTXCONV_AVX2;
+bool bBenchVertexConv = false;
+int iWorldCachePolys = WORLD_CACHE_POLYS;
+int iWorldCacheVerts = WORLD_CACHE_VERTS;
+int iMiscCachePolys = MISC_CACHE_POLYS;
+int iMiscCacheVerts = MISC_CACHE_VERTS;
 
 FILE *plog = NULL;
 
@@ -153,9 +176,11 @@ geBoolean DRIVERCC SetFogEnable(geBoolean Enable, float r, float g, float b, flo
 {
 	GLfloat fogColor[3];
 
+	Shader_SetFog(Enable, r, g, b, Start, End);
+
 	if(Enable==GE_TRUE)
 	{
-		glEnable(GL_FOG);
+		GLState_Enable(GL_FOG);
 		glFogi(GL_FOG_MODE, GL_LINEAR);
 		fogColor[0] = (GLfloat)r/255.0f;
 		fogColor[1] = (GLfloat)g/255.0f;
@@ -178,7 +203,7 @@ geBoolean DRIVERCC SetFogEnable(geBoolean Enable, float r, float g, float b, flo
 	}
 	else
 	{
-		glDisable(GL_FOG);
+		GLState_Disable(GL_FOG);
 		FogEnabled = GE_FALSE;
 		// changed QD Fog
 		glClearColor(ClearColor[0], ClearColor[1], ClearColor[2], 1.0);
@@ -211,6 +236,25 @@ geBoolean DRIVERCC DrvInit(DRV_DriverHook *Hook)
 	ZBUFFER_DEPTH = GetPrivateProfileInt("D3D24", "ZBufferD", 16, ".\\D3D24.INI");
 	bUseFullSceneAntiAliasing = (GetPrivateProfileInt("D3D24", "FSAntiAliasing", 0, ".\\D3D24.INI") == 1);
 	if (bUseFullSceneAntiAliasing) gllog("Requesting Full Scene AntiAliasing...");
+	bUsePersistentBuffers = (GetPrivateProfileInt("D3D24", "PersistentBuffers", 1, ".\\D3D24.INI") == 1);
+	bUseShaders = (GetPrivateProfileInt("D3D24", "Shaders", 1, ".\\D3D24.INI") == 1);
+	iWorldSortMode = GetPrivateProfileInt("D3D24", "SortWorld", PCACHE_SORT_MATERIAL, ".\\D3D24.INI");
+	iLightmapAtlasSize = GetPrivateProfileInt("D3D24", "LightmapAtlas", 1024, ".\\D3D24.INI");
+	iDecalAtlasSize = GetPrivateProfileInt("D3D24", "DecalAtlas", 1024, ".\\D3D24.INI");
+	bUseTextureArrays = (GetPrivateProfileInt("D3D24", "TextureArrays", 1, ".\\D3D24.INI") == 1);
+	bUseDepthPrepass = (GetPrivateProfileInt("D3D24", "DepthPrepass", 0, ".\\D3D24.INI") == 1);
+	iTextureArrayLayers = GetPrivateProfileInt("D3D24", "TextureArrayLayers", 16, ".\\D3D24.INI");
+	iUploadBudget = GetPrivateProfileInt("D3D24", "UploadBudget", 2048, ".\\D3D24.INI");
+	bUseSRGBMips = (GetPrivateProfileInt("D3D24", "SRGBMips", 0, ".\\D3D24.INI") == 1);
+	bHandleBenchmark = (GetPrivateProfileInt("D3D24", "HandleBenchmark", 0, ".\\D3D24.INI") == 1);
+	iBlitKernel = GetPrivateProfileInt("D3D24", "BlitKernel", CKBLIT_AVX2, ".\\D3D24.INI");
+	bBenchBlit = (GetPrivateProfileInt("D3D24", "BenchBlit", 0, ".\\D3D24.INI") == 1);
+	iVertexKernel = GetPrivateProfileInt("D3D24", "VertexKernel", VTXCONV_AVX2, ".\\D3D24.INI");
+	bBenchVertexConv = (GetPrivateProfileInt("D3D24", "BenchVertexConv", 0, ".\\D3D24.INI") == 1);
+	iWorldCachePolys = GetPrivateProfileInt("D3D24", "WorldCachePolys", WORLD_CACHE_POLYS, ".\\D3D24.INI");
+	iWorldCacheVerts = GetPrivateProfileInt("D3D24", "WorldCacheVerts", WORLD_CACHE_VERTS, ".\\D3D24.INI");
+	iMiscCachePolys = GetPrivateProfileInt("D3D24", "MiscCachePolys", MISC_CACHE_POLYS, ".\\D3D24.INI");
+	iMiscCacheVerts = GetPrivateProfileInt("D3D24", "MiscCacheVerts", MISC_CACHE_VERTS, ".\\D3D24.INI");
 	
 	WindowSetup(Hook);
 	
@@ -240,44 +284,57 @@ geBoolean DRIVERCC DrvInit(DRV_DriverHook *Hook)
 #endif
 		multitexture = GL_FALSE;
 
+	// Replace Bi-Linear filtering with Anisotropic filtering
+	if (glewIsExtensionSupported("GL_EXT_texture_filter_anisotropic"))
+	{
+		gllog("Replacing Bilinear filtering with Anisotropic filtering...\n");
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fMaxAnisotropy);
+	}
+
+	// New context, so nothing shadowed from a previous one holds.  The samplers want the
+	// anisotropy, hence after the query above.
+	GLState_Initialize();
 
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_DEPTH_TEST);
+	GLState_Enable(GL_TEXTURE_2D);
+	GLState_Enable(GL_DEPTH_TEST);
 
-	glEnable(GL_BLEND);    
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLState_Enable(GL_BLEND);    
+	GLState_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	// Opaque passes alpha test masked texels instead of blending them, with the same
+	// cutoff the shaders discard at
+	glAlphaFunc(GL_GEQUAL, 0.5f);
 
 	glShadeModel(GL_SMOOTH);
 	glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
 
 	if(multitexture)
 	{
-		glActiveTextureARB(GL_TEXTURE1_ARB);
+		GLState_ActiveTexture(GL_TEXTURE1);
 
-		glDisable(GL_TEXTURE_1D);
-		glDisable(GL_TEXTURE_2D);		
+		GLState_Disable(GL_TEXTURE_1D);
+		GLState_Disable(GL_TEXTURE_2D);		
 
-		glActiveTextureARB(GL_TEXTURE0_ARB);
+		GLState_ActiveTexture(GL_TEXTURE0);
 	} 
 
-	// Replace Bi-Linear filtering with Anisotropic filtering
-	if (glewIsExtensionSupported("GL_EXT_texture_filter_anisotropic"))
-	{
-		gllog("Replacing Bilinear filtering with Anisotropic filtering...\n");
-		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fMaxAnisotropy);
-	}
-
 	SetFogEnable(GE_FALSE, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
 
 	InitMatrices(ClientWindow.Width, ClientWindow.Height);
+	Shader_SetScreen(ClientWindow.Width, ClientWindow.Height);
 
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
 	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
 
+	FrameStats_Initialize();
+
+	// Before THandle_Startup, which needs to know whether the shader path is up
+	PCache_Initialize();
+
 	if (!THandle_Startup())
 	{
 		SetLastDrvError(DRV_ERROR_GENERIC, "OGL_DrvInit:  THandle_Startup failed...\n");
@@ -286,7 +343,6 @@ geBoolean DRIVERCC DrvInit(DRV_DriverHook *Hook)
 
 	RenderingIsOK = GE_TRUE;
 
-	PCache_Initialize();
 	gllog("Driver initialization complete...\n");
 	return GE_TRUE;
 }
@@ -297,6 +353,10 @@ geBoolean DRIVERCC DrvShutdown(void)
 	// Tell OpenGL to finish whatever is in the pipe, because we're closing up shop.
 	glFinish();
 
+	PCache_Shutdown();
+	THandle_Shutdown();
+	FrameStats_Shutdown();
+	GLState_Shutdown();
 	WindowCleanup();
 
 	RenderingIsOK = GE_FALSE;
@@ -33,6 +33,25 @@ extern unsigned int ZBUFFER_DEPTH;		// Depth of the ZBuffer to use in OpenGL.
 extern bool bUseFullSceneAntiAliasing;
 extern bool bUseAnisotropicFiltering;
 extern GLfloat fMaxAnisotropy;
+extern bool bUsePersistentBuffers;		// Stream PCache verts through GL_ARB_buffer_storage when available
+extern bool bUseShaders;				// Draw the poly caches with GLSL programs when GLSL 1.50 is available
+extern int iWorldSortMode;			// PCACHE_SORT_* mode used when flushing world polys
+extern int iLightmapAtlasSize;		// Lightmap atlas page size in texels, 0 gives every lightmap its own texture
+extern int iDecalAtlasSize;			// Decal atlas page size in texels, 0 gives every 2D texture its own texture
+extern bool bUseTextureArrays;			// Share texture arrays between same sized world textures on the shader path
+extern bool bUseDepthPrepass;			// Lay down opaque world depth before shading it with GL_EQUAL
+extern int iTextureArrayLayers;			// Layers per texture array, each allocated up front
+extern int iUploadBudget;				// KB of texture uploads a frame may make early, when the engine unlocks
+extern bool bUseSRGBMips;				// Box filter mips on the CPU in linear light; storage and GL filtering stay sRGB
+extern bool bHandleBenchmark;			// Time the texture handle allocator against a linear scan at startup
+extern int iBlitKernel;					// Best CKBLIT_* kernel colour keyed 24 bit blits may use
+extern bool bBenchBlit;					// Time and check the colour key blit kernels at startup
+extern int iVertexKernel;				// Best VTXCONV_* kernel the poly caches may convert vertices with
+extern bool bBenchVertexConv;			// Time and check the vertex conversion kernels at startup
+extern int iWorldCachePolys;			// Polys the world cache reserves up front, it grows past them
+extern int iWorldCacheVerts;			// Verts the world cache reserves up front
+extern int iMiscCachePolys;				// Polys the misc cache reserves up front
+extern int iMiscCacheVerts;				// Verts the misc cache reserves up front
 
 #define USE_LIGHTMAPS					// Render lightmaps
 #define USE_LINEAR_INTERPOLATION		// Comment out to use nearest neighbor interpolation
@@ -22,8 +22,24 @@
 #define GLEW_STATIC
 #include "./glew/include/GL/glew.h"
 
+#include <stdlib.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+
 #include "DCommon.h"
 #include "OglMisc.h"
+#include "CpuInfo.h"
+
+extern void gllog(const char *fmt, ...);
+
+// MSVC accepts SSSE3 and AVX2 intrinsics anywhere.  GCC and clang need the function marked.
+#ifdef _MSC_VER
+#define CKBLIT_SSSE3_FUNC
+#define CKBLIT_AVX2_FUNC
+#else
+#define CKBLIT_SSSE3_FUNC			__attribute__((target("ssse3")))
+#define CKBLIT_AVX2_FUNC			__attribute__((target("avx2")))
+#endif
 
 
 // Set up the OpenGL viewing frustum using an orthographic projection (as Genesis does all of
@@ -87,37 +103,305 @@ geBoolean ExtensionExists(const char *extension)
 }
 
 
+//============================================================================================
+//	Colour key blits.  The row kernels turn Width 24 bit texels into RGBA, the 0x000001
+//	colour key into transparent black and everything else into opaque.
+//============================================================================================
+typedef void CKBLIT_ROW(GLubyte *pDst, const GLubyte *pSrc, GLint Width);
+
+static CKBLIT_ROW	*CkBlit_Row = NULL;
+static int32		gCkBlitLevel = CKBLIT_SCALAR;
+
+static const char *gCkBlitNames[] = { "scalar", "SSSE3", "AVX2" };
+
+static void CkBlit_RowScalar(GLubyte *pDst, const GLubyte *pSrc, GLint Width)
+{
+	for(GLint x = 0; x < Width; x++, pSrc += 3, pDst += 4)
+	{
+		if(pSrc[0] == 0x00 && pSrc[1] == 0x00 && pSrc[2] == 0x01)
+		{
+			*(uint32*)pDst = 0;
+		}
+		else
+		{
+			pDst[0] = pSrc[0];
+			pDst[1] = pSrc[1];
+			pDst[2] = pSrc[2];
+			pDst[3] = 0xFF;
+		}
+	}
+}
+
+// Sixteen texels at a time.  Three loads cover their 48 bytes exactly, palignr lines each
+// group of four up at the bottom of a register and pshufb spreads it out to RGBA with a
+// zero alpha.  A texel that is then equal to the key as a dword gets masked to zero, the
+// rest get their alpha.
+#define CKBLIT_SHUFFLE		0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128
+#define CKBLIT_KEY			0x00010000
+#define CKBLIT_ALPHA		0xFF000000
+
+static CKBLIT_SSSE3_FUNC void CkBlit_RowSSSE3(GLubyte *pDst, const GLubyte *pSrc, GLint Width)
+{
+	const __m128i Shuffle = _mm_setr_epi8(CKBLIT_SHUFFLE);
+	const __m128i Key = _mm_set1_epi32(CKBLIT_KEY);
+	const __m128i Alpha = _mm_set1_epi32((int)CKBLIT_ALPHA);
+	__m128i a, b, c, p;
+	GLint x;
+
+	for(x = 0; x + 16 <= Width; x += 16, pSrc += 48, pDst += 64)
+	{
+		a = _mm_loadu_si128((const __m128i*)pSrc);
+		b = _mm_loadu_si128((const __m128i*)(pSrc + 16));
+		c = _mm_loadu_si128((const __m128i*)(pSrc + 32));
+
+		p = _mm_shuffle_epi8(a, Shuffle);
+		_mm_storeu_si128((__m128i*)pDst, _mm_andnot_si128(_mm_cmpeq_epi32(p, Key), _mm_or_si128(p, Alpha)));
+
+		p = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), Shuffle);
+		_mm_storeu_si128((__m128i*)(pDst + 16), _mm_andnot_si128(_mm_cmpeq_epi32(p, Key), _mm_or_si128(p, Alpha)));
+
+		p = _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), Shuffle);
+		_mm_storeu_si128((__m128i*)(pDst + 32), _mm_andnot_si128(_mm_cmpeq_epi32(p, Key), _mm_or_si128(p, Alpha)));
+
+		p = _mm_shuffle_epi8(_mm_srli_si128(c, 4), Shuffle);
+		_mm_storeu_si128((__m128i*)(pDst + 48), _mm_andnot_si128(_mm_cmpeq_epi32(p, Key), _mm_or_si128(p, Alpha)));
+	}
+
+	CkBlit_RowScalar(pDst, pSrc, Width - x);
+}
+
+// The same sixteen texels, two groups of four to a ymm register
+static CKBLIT_AVX2_FUNC void CkBlit_RowAVX2(GLubyte *pDst, const GLubyte *pSrc, GLint Width)
+{
+	const __m256i Shuffle = _mm256_setr_epi8(CKBLIT_SHUFFLE, CKBLIT_SHUFFLE);
+	const __m256i Key = _mm256_set1_epi32(CKBLIT_KEY);
+	const __m256i Alpha = _mm256_set1_epi32((int)CKBLIT_ALPHA);
+	__m128i a, b, c;
+	__m256i p;
+	GLint x;
+
+	for(x = 0; x + 16 <= Width; x += 16, pSrc += 48, pDst += 64)
+	{
+		a = _mm_loadu_si128((const __m128i*)pSrc);
+		b = _mm_loadu_si128((const __m128i*)(pSrc + 16));
+		c = _mm_loadu_si128((const __m128i*)(pSrc + 32));
+
+		p = _mm256_inserti128_si256(_mm256_castsi128_si256(a), _mm_alignr_epi8(b, a, 12), 1);
+		p = _mm256_shuffle_epi8(p, Shuffle);
+		_mm256_storeu_si256((__m256i*)pDst, _mm256_andnot_si256(_mm256_cmpeq_epi32(p, Key), _mm256_or_si256(p, Alpha)));
+
+		p = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_alignr_epi8(c, b, 8)), _mm_srli_si128(c, 4), 1);
+		p = _mm256_shuffle_epi8(p, Shuffle);
+		_mm256_storeu_si256((__m256i*)(pDst + 32), _mm256_andnot_si256(_mm256_cmpeq_epi32(p, Key), _mm256_or_si256(p, Alpha)));
+	}
+
+	// Avoid the AVX to SSE transition penalty in the callers
+	_mm256_zeroupper();
+
+	CkBlit_RowScalar(pDst, pSrc, Width - x);
+}
+
+// Best kernel level this CPU can run
+static int32 CkBlit_CpuLevel(void)
+{
+	uint32 Features = CpuInfo_Features();
+
+	if (Features & CPUINFO_AVX2)
+		return CKBLIT_AVX2;
+
+	if (Features & CPUINFO_SSSE3)
+		return CKBLIT_SSSE3;
+
+	return CKBLIT_SCALAR;
+}
+
+static void CkBlit_SetLevel(int32 Level)
+{
+	gCkBlitLevel = Level;
+
+	switch (Level)
+	{
+		case CKBLIT_AVX2:
+			CkBlit_Row = CkBlit_RowAVX2;
+			break;
+
+		case CKBLIT_SSSE3:
+			CkBlit_Row = CkBlit_RowSSSE3;
+			break;
+
+		default:
+			CkBlit_Row = CkBlit_RowScalar;
+			break;
+	}
+}
+
+void CkBlit_Initialize(int32 MaxLevel)
+{
+	int32 Level = CkBlit_CpuLevel();
+
+	if (MaxLevel >= CKBLIT_SCALAR && MaxLevel < Level)
+		Level = MaxLevel;
+
+	CkBlit_SetLevel(Level);
+	gllog("Colour keying 2D textures with %s kernels...", gCkBlitNames[Level]);
+}
+
+
 // Takes a GE_PIXELFORMAT_24BIT_RGB bitmap and converts it to a GE_PIXELFORMAT_32BIT_ABGR,
-// replacing colorkey pixels with alpha information.
+// replacing colorkey pixels with alpha information.  Only the padding right of and below
+// the bitmap is cleared, the kernels write every texel of it.
 void CkBlit24_32(GLubyte *dstPtr, GLint dstWidth, GLint dstHeight, GLubyte *srcPtr, GLint srcWidth, 
 				 GLint srcHeight)
 {
-	GLint width, height;
-	GLubyte *nextLine;
-
-	memset(dstPtr, 0x00, dstWidth * dstHeight * 4);
+	GLint height;
 
+	if(!CkBlit_Row)
+		CkBlit_SetLevel(CKBLIT_SCALAR);
 
 	for(height = 0; height < srcHeight; height++)
 	{
-		nextLine = (dstPtr + (dstWidth * 4));
+		CkBlit_Row(dstPtr, srcPtr, srcWidth);
+
+		if(dstWidth > srcWidth)
+			memset(dstPtr + srcWidth * 4, 0x00, (dstWidth - srcWidth) * 4);
+
+		srcPtr += srcWidth * 3;
+		dstPtr += dstWidth * 4;
+	}
+
+	if(dstHeight > srcHeight)
+		memset(dstPtr, 0x00, dstWidth * (dstHeight - srcHeight) * 4);
+}
+
+
+//============================================================================================
+//	Colour key blit benchmark and self test
+//============================================================================================
+#define CKBLIT_BENCH_WIDTH			640				// A menu screen, padded out as THandle_Update2D would
+#define CKBLIT_BENCH_HEIGHT			480
+#define CKBLIT_BENCH_PADDED_WIDTH	1024
+#define CKBLIT_BENCH_PADDED_HEIGHT	512
+#define CKBLIT_BENCH_PASSES			32
+#define CKBLIT_TEST_WIDTH			80				// Every row width up to this, at every alignment
+#define CKBLIT_TEST_ROW				4096			// Texels per row of the all colours test
+
+// Compare every supported kernel against the scalar one: each of the 2^24 colours, then
+// every short row width at every source and destination alignment, padding and all.
+// Returns the number of mismatched bytes for Level.
+static uint32 CkBlit_Test(int32 Level, GLubyte *pSrc, GLubyte *pDst, GLubyte *pRef)
+{
+	uint32 Errors = 0;
+	GLint Color, x, Width, Align;
+
+	for(Color = 0; Color < (1 << 24); Color += CKBLIT_TEST_ROW)
+	{
+		for(x = 0; x < CKBLIT_TEST_ROW; x++)
+		{
+			pSrc[x * 3 + 0] = (GLubyte)((Color + x) >> 16);
+			pSrc[x * 3 + 1] = (GLubyte)((Color + x) >> 8);
+			pSrc[x * 3 + 2] = (GLubyte)(Color + x);
+		}
+
+		CkBlit_SetLevel(CKBLIT_SCALAR);
+		CkBlit24_32(pRef, CKBLIT_TEST_ROW, 1, pSrc, CKBLIT_TEST_ROW, 1);
+		CkBlit_SetLevel(Level);
+		CkBlit24_32(pDst, CKBLIT_TEST_ROW, 1, pSrc, CKBLIT_TEST_ROW, 1);
 
-		for(width = 0; width < srcWidth; width++)
+		for(x = 0; x < CKBLIT_TEST_ROW * 4; x++)
+			Errors += (pDst[x] != pRef[x]);
+	}
+
+	for(Width = 1; Width <= CKBLIT_TEST_WIDTH; Width++)
+	{
+		for(Align = 0; Align < 16; Align++)
 		{
-			if(!(*srcPtr == 0x00 && *(srcPtr + 1) == 0x00 && *(srcPtr + 2) == 0x01))
+			// Keys scattered through random texels, three rows into a 2 texel wider, 1 row taller block
+			for(x = 0; x < Width * 3 * 3; x++)
+				pSrc[Align + x] = (GLubyte)rand();
+
+			for(x = 0; x < Width * 3; x += 1 + rand() % 4)
 			{
-				*dstPtr = *srcPtr;
-				*(dstPtr + 1) = *(srcPtr + 1);
-				*(dstPtr + 2) = *(srcPtr + 2);
-				*(dstPtr + 3) = 0xFF;
+				pSrc[Align + x * 3 + 0] = 0x00;
+				pSrc[Align + x * 3 + 1] = 0x00;
+				pSrc[Align + x * 3 + 2] = 0x01;
 			}
 
-			srcPtr += 3;
-			dstPtr += 4;
+			memset(pRef, 0xCD, (Width + 2) * 4 * 4 + 16);
+			memset(pDst, 0xCD, (Width + 2) * 4 * 4 + 16);
+
+			CkBlit_SetLevel(CKBLIT_SCALAR);
+			CkBlit24_32(pRef + Align, Width + 2, 4, pSrc + Align, Width, 3);
+			CkBlit_SetLevel(Level);
+			CkBlit24_32(pDst + Align, Width + 2, 4, pSrc + Align, Width, 3);
+
+			for(x = 0; x < (Width + 2) * 4 * 4 + 16; x++)
+				Errors += (pDst[x] != pRef[x]);
 		}
+	}
 
-		dstPtr = nextLine;
+	return Errors;
+}
+
+void CkBlit_Benchmark(void)
+{
+	GLubyte *pSrc, *pDst, *pRef;
+	LARGE_INTEGER Freq, Start, End;
+	int32 SavedLevel = gCkBlitLevel;
+	int32 Level, Pass;
+	uint32 Errors;
+	double Ns;
+
+	pSrc = (GLubyte*)malloc(CKBLIT_BENCH_WIDTH * CKBLIT_BENCH_HEIGHT * 3);
+	pDst = (GLubyte*)malloc(CKBLIT_BENCH_PADDED_WIDTH * CKBLIT_BENCH_PADDED_HEIGHT * 4);
+	pRef = (GLubyte*)malloc(CKBLIT_BENCH_PADDED_WIDTH * CKBLIT_BENCH_PADDED_HEIGHT * 4);
+
+	if (!pSrc || !pDst || !pRef)
+	{
+		gllog("WARNING:  Not enough memory for the colour key blit benchmark");
+		free(pSrc); free(pDst); free(pRef);
+		return;
 	}
+
+	QueryPerformanceFrequency(&Freq);
+
+	for (Level = CKBLIT_SCALAR; Level <= CkBlit_CpuLevel(); Level++)
+	{
+		srand(1);
+		Errors = (Level == CKBLIT_SCALAR) ? 0 : CkBlit_Test(Level, pSrc, pDst, pRef);
+
+		// Mostly opaque, with the odd run of key like the edges of a HUD bitmap
+		for (int32 i = 0; i < CKBLIT_BENCH_WIDTH * CKBLIT_BENCH_HEIGHT; i++)
+		{
+			geBoolean Keyed = ((i / 37) % 5) == 0;
+
+			pSrc[i * 3 + 0] = Keyed ? 0x00 : (GLubyte)rand();
+			pSrc[i * 3 + 1] = Keyed ? 0x00 : (GLubyte)rand();
+			pSrc[i * 3 + 2] = Keyed ? 0x01 : (GLubyte)rand();
+		}
+
+		CkBlit_SetLevel(Level);
+
+		QueryPerformanceCounter(&Start);
+		for (Pass = 0; Pass < CKBLIT_BENCH_PASSES; Pass++)
+			CkBlit24_32(pDst, CKBLIT_BENCH_PADDED_WIDTH, CKBLIT_BENCH_PADDED_HEIGHT, pSrc, CKBLIT_BENCH_WIDTH, CKBLIT_BENCH_HEIGHT);
+		QueryPerformanceCounter(&End);
+
+		Ns = (double)(End.QuadPart - Start.QuadPart) * 1.0e9 / (double)Freq.QuadPart /
+			(double)(CKBLIT_BENCH_PASSES * CKBLIT_BENCH_WIDTH * CKBLIT_BENCH_HEIGHT);
+
+		gllog("Colour key blit (%s):  %.3f ns/texel, %u bytes differ from scalar%s",
+			gCkBlitNames[Level], Ns, Errors, Errors ? "  WARNING: kernel is broken" : "");
+
+		// Never run with a kernel that disagrees with the scalar one
+		if (Errors && SavedLevel >= Level)
+			SavedLevel = Level - 1;
+	}
+
+	CkBlit_SetLevel(SavedLevel);
+
+	free(pSrc);
+	free(pDst);
+	free(pRef);
 }
 
 
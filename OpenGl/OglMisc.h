@@ -20,9 +20,21 @@
 #ifndef OGLMISC_H
 #define OGLMISC_H
 
+// Colour key blit kernel levels, best last
+#define CKBLIT_SCALAR				0
+#define CKBLIT_SSSE3				1
+#define CKBLIT_AVX2					2
+
 void InitMatrices(int width, int height);
 geBoolean ExtensionExists(const char *extension);
 void CkBlit24_32(GLubyte *dstPtr, GLint width, GLint dstHeight, GLubyte *srcPtr, GLint srcWidth, GLint srcHeight);
+
+// Pick the best CkBlit24_32 kernel the CPU supports, up to MaxLevel
+void CkBlit_Initialize(int32 MaxLevel);
+
+// Check every supported kernel against the scalar one, time them and write the results
+// to the log.  A kernel that fails the check is not used.
+void CkBlit_Benchmark(void);
 void Blit32(GLubyte *dstPtr, GLint dstPitch, GLubyte *srcPtr, GLint srcWidth, GLint srcHeight,
 			GLint srcPitch);
 
@@ -18,6 +18,7 @@
 */
 #include <Windows.h>
 #include <list>
+#include <stddef.h>
 #define GLEW_STATIC
 #include "./glew/include/GL/glew.h"
 #include "Basetype.h"
@@ -26,12 +27,26 @@
 #include "THandle.h"
 #include "Render.h"
 #include "OglDrv.h"
+#include "StreamBuf.h"
+#include "VtxConv.h"
+#include "Shader.h"
+#include "GLState.h"
+#include "FrameStats.h"
 
-#define MAX_WORLD_POLYS				2048
-#define MAX_WORLD_POLY_VERTS		8192
+// Frames of usage history considered before shrinking a cache
+#define PCACHE_SHRINK_FRAMES		600
 
-#define MAX_MISC_POLYS				2048
-#define MAX_MISC_POLY_VERTS			8192
+// Fans are stored as triangle lists, (n - 2) * 3 indices for an n vertex poly
+#define PCACHE_INDICES_PER_VERT		3
+
+// Render flags that change GL state or the shader variant.  Polys agreeing on these (and
+// on their textures) can be drawn together.
+#define PCACHE_STATE_FLAGS			(DRV_RENDER_ALPHA | DRV_RENDER_NO_ZMASK | DRV_RENDER_NO_ZWRITE | DRV_RENDER_CLAMP_UV | DRV_RENDER_POLY_NO_FOG)
+
+// How a batch of polys is submitted
+#define PCACHE_BATCH_ELEMENTS		0		// glDrawElements over an index buffer of triangle lists
+#define PCACHE_BATCH_MULTIDRAW		1		// glMultiDrawArrays over the original fans
+#define PCACHE_BATCH_ARRAYS			2		// One glDrawArrays per fan
 
 // changed QD Shadows
 #define MAX_STENCIL_POLYS			2048
@@ -39,12 +54,58 @@
 
 /*  01/28/2003 Wendell Buckner                                                          */
 /*   Cache decals so that they can be drawn after all the 3d stuff...                   */
-#define MAX_DECAL_RECTS             256
+#define DECAL_CACHE_RECTS           1024		// Initial reservation, the cache doubles from here
 
 extern void gllog(const char *fmt, ...);
 
 // Driver flags
 bool bCanDoVertexBuffers = false;
+bool bCanDoPersistentBuffers = false;
+bool bCanDoShaders = false;
+static int32 gBatchMode = PCACHE_BATCH_ARRAYS;
+
+// A run of polys, in draw order, sharing textures and state
+typedef struct _PCacheBatch
+{
+	uint32 firstPoly;				// Position in the draw order
+	uint32 numPolys;
+	uint32 firstIndex;
+	uint32 numIndices;
+} PCacheBatch;
+
+// Capacity and usage of one cache
+typedef struct PCacheUsage
+{
+	uint32 MaxPolys;				// Current capacity
+	uint32 MaxVerts;
+	uint32 InitPolys;				// Initial reservation, never shrunk below
+	uint32 InitVerts;
+	uint32 LimitPolys;				// Never grown past, the shader path's parameter table size
+	uint32 FramePolys;				// Submitted so far this frame
+	uint32 FrameVerts;
+	uint32 WindowPolys;				// Busiest frame in the current shrink window
+	uint32 WindowVerts;
+	uint32 WindowFrames;
+	uint32 PeakPolys;				// Busiest frame since startup
+	uint32 PeakVerts;
+	uint32 Grows;
+	uint32 Shrinks;
+	uint32 OverflowFlushes;			// Mid-frame flushes because a cache could not grow
+} PCacheUsage;
+
+typedef struct PCacheStats
+{
+	uint32 Flushes;
+	uint32 Polys;
+	uint32 DrawCalls;
+	uint32 Binds[2];				// TMU0 / TMU1 binds issued in draw order
+	uint32 SubmitOrderBinds[2];		// Binds the submission order would have needed
+	LONGLONG SortTime;
+	LONGLONG FlushTime;
+} PCacheStats;
+
+static PCacheStats			gWorldStats;
+static PCacheStats			gMiscStats;
 
 typedef struct DecalRect
 {
@@ -54,53 +115,90 @@ typedef struct DecalRect
 	int32 y;
 } DecalRect;
 
+// Screen space quad corner of an atlased decal
+typedef struct DecalVertex
+{
+	GLfloat x, y;
+	GLfloat u, v;
+} DecalVertex;
+
+// Grows and never flushes early, since decals must land on top of the whole scene
 typedef struct DecalCache
 {
-	DecalRect Decals[MAX_DECAL_RECTS];
+	DecalRect *Decals;
 	uint32 NumDecals;
+	uint32 MaxDecals;
+	DecalVertex *Verts;								// Four per decal
 } DecalCache;
 
 static DecalCache					gDecalCache;
 
-typedef struct _MiscVertex
+// Per-poly constants for the shader path, SHADER_PARAM_TEXELS texels of the parameter table
+typedef struct _PCacheParams
 {
-	float x, y, z;
-	float u, v, s, t;
-	uint8 r, g, b, a;
-} MiscVertex;
+	float ScaleU, ScaleV;							// Texture scale and shift, InvScale folded in
+	float ShiftU, ShiftV;
+	float LScale;									// Lightmap InvScale
+	float LShiftU, LShiftV;
+	float Alpha;
+	float Layer;									// Texture array layer
+	float Reserved[3];
+} PCacheParams;
 
 typedef struct _MiscPoly
 {
 	uint32 firstVert;
 	uint32 numVerts;
+	uint32 firstIndex;
+	uint32 numIndices;
 	uint32 flags;
 
 	geRDriver_THandle *THandle;
+
+	UINT64 SortKey;
 } MiscPoly;
 
 typedef struct MiscCache
 {
-	MiscPoly Poly[MAX_MISC_POLYS];
-	MiscPoly *SortedPolys[MAX_MISC_POLYS];
-
-	MiscVertex Verts[MAX_MISC_POLY_VERTS];
+	MiscPoly *Polys;
+	uint32 *SortedPolys;							// Per-flush draw order (indices into Polys)
+	uint32 *SortScratch;
+	uint32 *DrawOrder;								// SortedPolys or SortScratch, whichever the sort ended in
+
+	GLubyte *Verts;									// Where inserts write, SysVerts or the stream buffer
+	GLubyte *SysVerts;
+	uint32 VertSize;								// MiscVertex, or DRV_TLVertex on the shader path
+	PCacheParams *Params;							// Shader path parameter table, one per poly
+	GLuint *Indices;								// Triangle lists in submission order
+	GLuint *DrawIndices;							// Triangle lists gathered in draw order
+
+	PCacheBatch *Batches;
+	GLint *DrawFirst;
+	GLsizei *DrawCount;
 
 	uint32 NumPolys;
 	uint32 NumVerts;
+	uint32 NumIndices;
+	uint32 NumBatches;
+	uint32 NumOpaqueBatches;						// Opaque pass batches come first
+
+	PCacheUsage Usage;
 
 	GLuint BufferID;
+	GLuint IndexBufferID;
+	StreamBuf Stream;
+
+	GLuint vaoID;									// Shader path
+	GLuint VaoBufferID;								// Vertex buffer the VAO's pointers were set up for
+	GLuint ParamBufferID;
+	GLuint ParamTextureID;
+
+	GLuint DrawBufferID;							// Vertex buffer the passes draw from, if any
+	const GLubyte *DrawBase;						// Where the verts start in it (or in memory)
 } MiscCache;
 
 static MiscCache				gMiscCache;
 
-typedef struct _WorldVertex
-{
-	float pos[3];
-	float uv[4];
-	float luv[4];
-	unsigned char color[4];
-} WorldVertex;
-
 typedef struct _WorldPoly
 {
 	geRDriver_THandle *THandle;
@@ -116,566 +214,2209 @@ typedef struct _WorldPoly
 
 	uint32 firstVert;
 	uint32 numVerts;
+	uint32 firstIndex;
+	uint32 numIndices;
+
+	UINT64 SortKey;
 } WorldPoly;
 
 typedef struct _WorldCache
 {
-	WorldPoly Polys[MAX_WORLD_POLYS];
-	//WorldPoly *SortedPolys[MAX_WORLD_POLYS];
-
-	WorldVertex Verts[MAX_WORLD_POLY_VERTS];
+	WorldPoly *Polys;
+	uint32 *SortedPolys;							// Per-flush draw order (indices into Polys)
+	uint32 *SortScratch;
+	uint32 *DrawOrder;								// SortedPolys or SortScratch, whichever the sort ended in
+
+	GLubyte *Verts;									// Where inserts write, SysVerts or the stream buffer
+	GLubyte *SysVerts;
+	uint32 VertSize;								// WorldVertex, or DRV_TLVertex on the shader path
+	PCacheParams *Params;							// Shader path parameter table, one per poly
+	GLuint *Indices;								// Triangle lists in submission order
+	GLuint *DrawIndices;							// Triangle lists gathered in draw order
+
+	PCacheBatch *Batches;
+	GLint *DrawFirst;
+	GLsizei *DrawCount;
 
 	uint32 NumPolys;
 	uint32 NumVerts;
+	uint32 NumIndices;
+	uint32 NumBatches;
+	uint32 NumOpaqueBatches;						// Opaque pass batches come first
+
+	PCacheUsage Usage;
 
 	GLuint BufferID;
-	GLuint vaoID;
+	GLuint IndexBufferID;
+	StreamBuf Stream;
+
+	GLuint vaoID;									// Shader path
+	GLuint VaoBufferID;								// Vertex buffer the VAO's pointers were set up for
+	GLuint ParamBufferID;
+	GLuint ParamTextureID;
+
+	GLuint DrawBufferID;							// Vertex buffer the passes draw from, if any
+	const GLubyte *DrawBase;						// Where the verts start in it (or in memory)
 } WorldCache;
 
 static WorldCache			gWorldCache;
 
-__inline DWORD F2DW(float f)
+// Sort key layout (most significant first).  Opaque keys group polys by state and textures,
+// front to back within a material in PCACHE_SORT_DEPTH.  Translucent keys only hold the
+// depth, back to front, with overlays after them in the order the engine submitted them.
+#define PCACHE_KEY_STATE_SHIFT		56		// DRV_RENDER_* state bits
+#define PCACHE_KEY_TEXTURE_SHIFT	36		// Base TextureID (20 bits)
+#define PCACHE_KEY_LIGHTMAP_SHIFT	16		// Lightmap TextureID (20 bits)
+#define PCACHE_KEY_DEPTH_SHIFT		0		// Quantized 1/z (16 bits)
+#define PCACHE_KEY_ID_MASK			0xFFFFF
+#define PCACHE_KEY_TRANSLUCENT		((UINT64)1 << 63)		// Drawn in the translucent pass
+#define PCACHE_KEY_ALPHATEST		((UINT64)1 << 62)		// Opaque: picks the shader variant, like the state bits
+#define PCACHE_KEY_OVERLAY			((UINT64)1 << 62)		// Translucent: no depth test, keep submission order
+
+// Draw passes, in the order PCache_FlushScene draws them
+#define PCACHE_PASS_OPAQUE_WORLD	0
+#define PCACHE_PASS_OPAQUE_MISC		1
+#define PCACHE_PASS_ALPHA_WORLD		2
+#define PCACHE_PASS_ALPHA_MISC		3
+#define PCACHE_PASS_DECALS			4
+#define PCACHE_NUM_PASSES			5
+
+static uint32				gPassPolys[PCACHE_NUM_PASSES];		// Inserts per pass since startup
+
+// Samples shaded by the opaque world passes, counted with occlusion queries.  Results are
+// read back a few passes later, and only once the GPU has them, so the count never waits
+// on it.  A pass whose result is still out when its query comes round again is dropped.
+#define PCACHE_NUM_SAMPLE_QUERIES	4
+
+typedef struct SampleCounter
 {
-	DWORD            retval = 0;
+	GLuint		Queries[PCACHE_NUM_SAMPLE_QUERIES];
+	geBoolean	Pending[PCACHE_NUM_SAMPLE_QUERIES];
+	uint32		Next;
+	uint32		Passes;						// Passes whose samples are in Samples
+	uint32		Dropped;					// Passes whose results were not in in time
+	double		Samples;
+} SampleCounter;
+
+static SampleCounter		gWorldSamples;
+static geBoolean			gDepthPrepass = GE_FALSE;			// bUseDepthPrepass, if the context can do it
+
+// realloc that leaves the old block in place when it fails
+static geBoolean PCache_Realloc(void **ppBlock, uint32 Size)
+{
+	void *pNew = realloc(*ppBlock, Size);
 
-	_asm {
-		fld            f
-			lea            eax, [retval]
-			fistp         dword ptr[eax]
-	}
+	if (!pNew)
+		return GE_FALSE;
 
-	return retval;
+	*ppBlock = pNew;
+	return GE_TRUE;
 }
 
-void PCache_Initialize()
+// Reallocate a cache's arrays.  Pending polys are kept.  If anything fails the capacity
+// drops to what every array can still hold.  CACHE is MiscCache or WorldCache.
+template <typename CACHE>
+static geBoolean PCache_Resize(CACHE *pCache, uint32 MaxPolys, uint32 MaxVerts)
 {
-	gDecalCache.NumDecals = 0;
+	geBoolean Ok = GE_TRUE;
 
-	gMiscCache.NumPolys = 0;
-	gMiscCache.NumVerts = 0;
+	Ok &= PCache_Realloc((void**)&pCache->Polys, MaxPolys * sizeof(*pCache->Polys));
+	Ok &= PCache_Realloc((void**)&pCache->SortedPolys, MaxPolys * sizeof(uint32));
+	Ok &= PCache_Realloc((void**)&pCache->SortScratch, MaxPolys * sizeof(uint32));
+	Ok &= PCache_Realloc((void**)&pCache->Batches, MaxPolys * sizeof(PCacheBatch));
+	Ok &= PCache_Realloc((void**)&pCache->DrawFirst, MaxPolys * sizeof(GLint));
+	Ok &= PCache_Realloc((void**)&pCache->DrawCount, MaxPolys * sizeof(GLsizei));
+	Ok &= PCache_Realloc((void**)&pCache->Indices, MaxVerts * PCACHE_INDICES_PER_VERT * sizeof(GLuint));
+	Ok &= PCache_Realloc((void**)&pCache->DrawIndices, MaxVerts * PCACHE_INDICES_PER_VERT * sizeof(GLuint));
 
-	gWorldCache.NumPolys = 0;
-	gWorldCache.NumVerts = 0;
+	if (bCanDoShaders)
+		Ok &= PCache_Realloc((void**)&pCache->Params, MaxPolys * sizeof(PCacheParams));
 
-	if (glewIsSupported("GL_ARB_vertex_buffer_object"))
+	if (bCanDoPersistentBuffers)
 	{
-		bCanDoVertexBuffers = true;
-		gllog("Vertex Buffers supported...");
+		if (pCache->Stream.SegmentSize != MaxVerts * pCache->VertSize)
+		{
+			Ok &= StreamBuf_Resize(&pCache->Stream, MaxVerts * pCache->VertSize, pCache->NumVerts * pCache->VertSize);
+
+			// The new buffer can be handed an old, deleted one's name, so the VAO's pointers
+			// are set up again whatever the name turns out to be
+			pCache->VaoBufferID = 0;
+		}
+
+		pCache->Verts = (GLubyte*)StreamBuf_Pointer(&pCache->Stream);
+	}
+	else
+	{
+		Ok &= PCache_Realloc((void**)&pCache->SysVerts, MaxVerts * pCache->VertSize);
+		pCache->Verts = pCache->SysVerts;
 	}
 
-	if (bCanDoVertexBuffers)
+	if (!Ok)
 	{
-		glGenBuffers(1, &gMiscCache.BufferID);
-		glGenBuffers(1, &gWorldCache.BufferID);
+		MaxPolys = min(MaxPolys, pCache->Usage.MaxPolys);
+		MaxVerts = min(MaxVerts, pCache->Usage.MaxVerts);
 	}
+
+	pCache->Usage.MaxPolys = MaxPolys;
+	pCache->Usage.MaxVerts = MaxVerts;
+
+	return Ok;
 }
 
-void PCache_Shutdown()
+static geBoolean PCache_ResizeMisc(uint32 MaxPolys, uint32 MaxVerts)
 {
-	if (bCanDoVertexBuffers)
-	{
-		glDeleteBuffers(1, &gMiscCache.BufferID);
-		glDeleteBuffers(1, &gWorldCache.BufferID);
-	}
+	return PCache_Resize(&gMiscCache, MaxPolys, MaxVerts);
 }
 
-BOOL DRIVERCC PCache_InsertDecal(geRDriver_THandle *THandle, RECT *SrcRect, int32 x, int32 y)
+static geBoolean PCache_ResizeWorld(uint32 MaxPolys, uint32 MaxVerts)
 {
-	DecalRect *pDecal = NULL;
-	
-	if (gDecalCache.NumDecals >= MAX_DECAL_RECTS)
-	{
-		PCache_FlushDecals();
-	}
+	return PCache_Resize(&gWorldCache, MaxPolys, MaxVerts);
+}
 
-	pDecal = &gDecalCache.Decals[gDecalCache.NumDecals];
-	pDecal->THandle = THandle;
+// Reallocate the decal cache to hold MaxDecals.  Pending decals are kept.
+static geBoolean PCache_GrowDecals(uint32 MaxDecals)
+{
+	geBoolean Ok = GE_TRUE;
 
-	pDecal->SrcRect.bottom = -1;
-	pDecal->SrcRect.left = -1;
-	pDecal->SrcRect.right = -1;
-	pDecal->SrcRect.top = -1;
+	Ok &= PCache_Realloc((void**)&gDecalCache.Decals, MaxDecals * sizeof(DecalRect));
+	Ok &= PCache_Realloc((void**)&gDecalCache.Verts, MaxDecals * 4 * sizeof(DecalVertex));
 
-	if (SrcRect != NULL)
+	if (Ok)
+		gDecalCache.MaxDecals = MaxDecals;
+
+	return Ok;
+}
+
+// Double a cache until it holds NeedPolys / NeedVerts.  Returns GE_FALSE if it still can't,
+// or if that would take it past LimitPolys.
+static geBoolean PCache_Grow(PCacheUsage *pUsage, geBoolean (*Resize)(uint32, uint32), const char *Name,
+							 uint32 NeedPolys, uint32 NeedVerts)
+{
+	// A cache whose first allocation failed has no capacity to double
+	uint32 MaxPolys = max(pUsage->MaxPolys, pUsage->InitPolys);
+	uint32 MaxVerts = max(pUsage->MaxVerts, pUsage->InitVerts);
+
+	if (NeedPolys > pUsage->LimitPolys)
+		return GE_FALSE;
+
+	while (MaxPolys < NeedPolys)
+		MaxPolys *= 2;
+
+	MaxPolys = min(MaxPolys, pUsage->LimitPolys);
+
+	while (MaxVerts < NeedVerts)
+		MaxVerts *= 2;
+
+	Resize(MaxPolys, MaxVerts);
+
+	if (pUsage->MaxPolys < NeedPolys || pUsage->MaxVerts < NeedVerts)
 	{
-		pDecal->SrcRect.bottom = SrcRect->bottom;
-		pDecal->SrcRect.left = SrcRect->left;
-		pDecal->SrcRect.right = SrcRect->right;
-		pDecal->SrcRect.top = SrcRect->top;
+		gllog("WARNING:  %s cache could not grow to %u polys, %u verts", Name, MaxPolys, MaxVerts);
+		return GE_FALSE;
 	}
 
-	pDecal->x = x;
-	pDecal->y = y;
+	pUsage->Grows++;
+	gllog("%s cache grown to %u polys, %u verts", Name, pUsage->MaxPolys, pUsage->MaxVerts);
 
-	gDecalCache.NumDecals++;
-	return TRUE;
+	return GE_TRUE;
 }
 
-BOOL PCache_FlushDecals()
+// Track the frame's usage and shrink the cache once it has been at most a quarter
+// full for PCACHE_SHRINK_FRAMES frames.  Must be called with nothing pending.
+static void PCache_EndCacheFrame(PCacheUsage *pUsage, geBoolean (*Resize)(uint32, uint32))
 {
-	DecalRect *pRect = NULL;
+	uint32 MaxPolys, MaxVerts;
 
-	if (gDecalCache.NumDecals == 0)
-		return TRUE;
+	pUsage->WindowPolys = max(pUsage->WindowPolys, pUsage->FramePolys);
+	pUsage->WindowVerts = max(pUsage->WindowVerts, pUsage->FrameVerts);
+	pUsage->PeakPolys = max(pUsage->PeakPolys, pUsage->FramePolys);
+	pUsage->PeakVerts = max(pUsage->PeakVerts, pUsage->FrameVerts);
 
-	for (uint32 i = 0; i < gDecalCache.NumDecals; i++)
+	pUsage->FramePolys = 0;
+	pUsage->FrameVerts = 0;
+
+	if (++pUsage->WindowFrames < PCACHE_SHRINK_FRAMES)
+		return;
+
+	MaxPolys = pUsage->MaxPolys;
+	MaxVerts = pUsage->MaxVerts;
+
+	if (MaxPolys > pUsage->WindowPolys * 4)
+		MaxPolys = max(pUsage->InitPolys, pUsage->WindowPolys * 2);
+
+	if (MaxVerts > pUsage->WindowVerts * 4)
+		MaxVerts = max(pUsage->InitVerts, pUsage->WindowVerts * 2);
+
+	if (MaxPolys != pUsage->MaxPolys || MaxVerts != pUsage->MaxVerts)
 	{
-		pRect = &gDecalCache.Decals[i];
-		if (pRect->SrcRect.bottom == -1)
-			DrawDecal(pRect->THandle, NULL, pRect->x, pRect->y);
-		else
-			DrawDecal(pRect->THandle, &pRect->SrcRect, pRect->x, pRect->y);
+		Resize(MaxPolys, MaxVerts);
+		pUsage->Shrinks++;
 	}
 
-	gDecalCache.NumDecals = 0;
-	return TRUE;
+	pUsage->WindowPolys = 0;
+	pUsage->WindowVerts = 0;
+	pUsage->WindowFrames = 0;
 }
 
-BOOL PCache_InsertMiscPoly(DRV_TLVertex *Verts, int32 NumVerts, geRDriver_THandle *THandle, uint32 Flags)
+// Add a query's samples in if the GPU has them.  GE_FALSE if it is still pending.
+static geBoolean PCache_CollectSamples(SampleCounter *pCounter, uint32 Query)
 {
-	float zRecip = 0.0f;
-	uint8 alpha = 0;
-	MiscPoly *pPoly = NULL;
-	MiscVertex *pVert = NULL;
+	GLuint Available = GL_FALSE;
+	GLuint Samples = 0;
 
-	if ((gMiscCache.NumPolys + 1) >= MAX_MISC_POLYS || (gMiscCache.NumVerts + NumVerts) >= MAX_MISC_POLY_VERTS)
-	{
-		PCache_FlushMiscPolys();
-	}
+	if (!pCounter->Pending[Query])
+		return GE_TRUE;
 
-	pPoly = &gMiscCache.Poly[gMiscCache.NumPolys];
+	glGetQueryObjectuiv(pCounter->Queries[Query], GL_QUERY_RESULT_AVAILABLE, &Available);
 
-	pPoly->THandle = THandle;
-	pPoly->flags = Flags;
-	pPoly->firstVert = gMiscCache.NumVerts;
-	pPoly->numVerts = NumVerts;
+	if (!Available)
+		return GE_FALSE;
 
-	DRV_TLVertex *pPnts = Verts;
-	pVert = &gMiscCache.Verts[pPoly->firstVert];
+	glGetQueryObjectuiv(pCounter->Queries[Query], GL_QUERY_RESULT, &Samples);
 
-	if (Flags & DRV_RENDER_ALPHA)
-		alpha = (uint8)Verts->a;
-	else
-		alpha = 255;
+	pCounter->Samples += (double)Samples;
+	pCounter->Passes++;
+	pCounter->Pending[Query] = GE_FALSE;
 
-	for (int i = 0; i < NumVerts; i++)
+	return GE_TRUE;
+}
+
+// Give up on a query's result without waiting for it
+static void PCache_DropSamples(SampleCounter *pCounter, uint32 Query)
+{
+	if (!PCache_CollectSamples(pCounter, Query))
 	{
-		zRecip = 1.0f / pPnts->z;
+		pCounter->Pending[Query] = GE_FALSE;
+		pCounter->Dropped++;
+	}
+}
 
-		pVert->x = pPnts->x;
-		pVert->y = pPnts->y;
-		pVert->z = -1.0f + zRecip;
-		
-		pVert->u = pPnts->u * zRecip;
-		pVert->v = pPnts->v * zRecip;
-		pVert->s = 0.0f;
-		pVert->t = zRecip;
+static void PCache_BeginSamples(SampleCounter *pCounter)
+{
+	if (!pCounter->Queries[0])
+		return;
 
-		pVert->r = (uint8)pPnts->r;
-		pVert->g = (uint8)pPnts->g;
-		pVert->b = (uint8)pPnts->b;
-		pVert->a = alpha;
+	// Issued PCACHE_NUM_SAMPLE_QUERIES passes ago, so normally long done
+	PCache_DropSamples(pCounter, pCounter->Next);
+	glBeginQuery(GL_SAMPLES_PASSED, pCounter->Queries[pCounter->Next]);
+}
 
-		pVert++;
-		pPnts++;
-	}
+static void PCache_EndSamples(SampleCounter *pCounter)
+{
+	if (!pCounter->Queries[0])
+		return;
 
-	gMiscCache.NumPolys++;
-	gMiscCache.NumVerts += NumVerts;
-	return TRUE;
+	glEndQuery(GL_SAMPLES_PASSED);
+
+	pCounter->Pending[pCounter->Next] = GE_TRUE;
+	pCounter->Next = (pCounter->Next + 1) % PCACHE_NUM_SAMPLE_QUERIES;
 }
 
-BOOL PCache_FlushMiscPolys()
+static void PCache_LogUsage(const char *Name, const PCacheUsage *pUsage)
 {
-	MiscVertex *pVert = NULL;
-	MiscPoly *pPoly = NULL;
-	static GLuint boundTexture = 0;
+	gllog("%s cache: peak %u polys, %u verts per frame (initial %u / %u, now %u / %u, %u grows, %u shrinks, %u overflow flushes)",
+		Name, pUsage->PeakPolys, pUsage->PeakVerts, pUsage->InitPolys, pUsage->InitVerts,
+		pUsage->MaxPolys, pUsage->MaxVerts, pUsage->Grows, pUsage->Shrinks, pUsage->OverflowFlushes);
+}
 
-	if (bCanDoVertexBuffers)
-	{
-		glBindBuffer(GL_ARRAY_BUFFER, gMiscCache.BufferID);
-		glBufferData(GL_ARRAY_BUFFER, gMiscCache.NumVerts * sizeof(MiscVertex), gMiscCache.Verts, GL_STREAM_DRAW);
+// VAO and parameter table buffer texture for one cache on the shader path
+static void PCache_CreateShaderBuffers(GLuint *pVaoID, GLuint *pParamBufferID, GLuint *pParamTextureID)
+{
+	glGenVertexArrays(1, pVaoID);
+	glGenBuffers(1, pParamBufferID);
+	glGenTextures(1, pParamTextureID);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, *pParamBufferID);
+	glBufferData(GL_TEXTURE_BUFFER, WORLD_CACHE_POLYS * sizeof(PCacheParams), NULL, GL_STREAM_DRAW);
+	GLState_BindTexture(GL_TEXTURE_BUFFER, *pParamTextureID);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, *pParamBufferID);
+	GLState_BindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
 
-		size_t bufferLoc = 0;
+static void PCache_DestroyShaderBuffers(GLuint *pVaoID, GLuint *pParamBufferID, GLuint *pParamTextureID)
+{
+	glDeleteVertexArrays(1, pVaoID);
+	glDeleteBuffers(1, pParamBufferID);
+	glDeleteTextures(1, pParamTextureID);
 
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(3, GL_FLOAT, sizeof(MiscVertex), (const void*)bufferLoc);
+	*pVaoID = *pParamBufferID = *pParamTextureID = 0;
+}
 
-		bufferLoc += (sizeof(float) * 3);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(4, GL_FLOAT, sizeof(MiscVertex), (const void*)bufferLoc);
+void PCache_Initialize()
+{
+	GLint MaxTexels = 0;
 
-		bufferLoc += (sizeof(float) * 4);
-		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(MiscVertex), (const void*)bufferLoc);
-	}
-	else
-	{
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(3, GL_FLOAT, sizeof(MiscVertex), &gMiscCache.Verts[0].x);
+	gDecalCache.NumDecals = 0;
+	PCache_GrowDecals(DECAL_CACHE_RECTS);
 
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(4, GL_FLOAT, sizeof(MiscVertex), &gMiscCache.Verts[0].u);
+	gMiscCache.NumPolys = 0;
+	gMiscCache.NumVerts = 0;
+	gMiscCache.NumIndices = 0;
 
-		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(MiscVertex), &gMiscCache.Verts[0].r);
-	}
+	gWorldCache.NumPolys = 0;
+	gWorldCache.NumVerts = 0;
+	gWorldCache.NumIndices = 0;
 
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_MULTISAMPLE);
+	memset(&gWorldCache.Usage, 0, sizeof(PCacheUsage));
+	memset(&gMiscCache.Usage, 0, sizeof(PCacheUsage));
 
-	boundTexture = 0;
+	gWorldCache.Usage.InitPolys = max(16, iWorldCachePolys);
+	gWorldCache.Usage.InitVerts = max(64, iWorldCacheVerts);
+	gMiscCache.Usage.InitPolys = max(16, iMiscCachePolys);
+	gMiscCache.Usage.InitVerts = max(64, iMiscCacheVerts);
+	gWorldCache.Usage.LimitPolys = 0xFFFFFFFF;
+	gMiscCache.Usage.LimitPolys = 0xFFFFFFFF;
 
-	for (uint32 i = 0; i < gMiscCache.NumPolys; i++)
+	VtxConv_Initialize(iVertexKernel);
+
+	if (bBenchVertexConv)
+		VtxConv_Benchmark();
+
+	if (glewIsSupported("GL_ARB_vertex_buffer_object"))
 	{
-		pPoly = &gMiscCache.Poly[i];
+		bCanDoVertexBuffers = true;
+		gllog("Vertex Buffers supported...");
+	}
 
-		if (boundTexture != pPoly->THandle->TextureID)
-		{
-			glBindTexture(GL_TEXTURE_2D, pPoly->THandle->TextureID);
-			boundTexture = pPoly->THandle->TextureID;
-		}
+	gWorldCache.VertSize = sizeof(WorldVertex);
+	gMiscCache.VertSize = sizeof(MiscVertex);
 
-		if (pPoly->THandle->Flags & THANDLE_UPDATE)
-			THandle_Update(pPoly->THandle);
+	if (bCanDoVertexBuffers && bUseShaders && Shader_Supported() && Shader_Initialize())
+	{
+		// Verts go to the GPU as the engine hands them over
+		bCanDoShaders = true;
+		gWorldCache.VertSize = sizeof(DRV_TLVertex);
+		gMiscCache.VertSize = sizeof(DRV_TLVertex);
 
-		if (pPoly->flags & DRV_RENDER_NO_ZMASK)
-			glDisable(GL_DEPTH_TEST);
-		else
-			glEnable(GL_DEPTH_TEST);
+		PCache_CreateShaderBuffers(&gWorldCache.vaoID, &gWorldCache.ParamBufferID, &gWorldCache.ParamTextureID);
+		PCache_CreateShaderBuffers(&gMiscCache.vaoID, &gMiscCache.ParamBufferID, &gMiscCache.ParamTextureID);
 
-		if (pPoly->flags & DRV_RENDER_NO_ZWRITE)
-			glDisable(GL_DEPTH_WRITEMASK);
-		else
-			glEnable(GL_DEPTH_WRITEMASK);
+		// Each cache's parameter table is one buffer texture, so a flush can't take more polys
+		// than it has texels for.  Past that, the caches flush instead of growing.
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &MaxTexels);
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		if (bUseAnisotropicFiltering)
-		{
-			glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
-		}
+		gWorldCache.Usage.LimitPolys = max(16, MaxTexels / SHADER_PARAM_TEXELS);
+		gMiscCache.Usage.LimitPolys = gWorldCache.Usage.LimitPolys;
+		gWorldCache.Usage.InitPolys = min(gWorldCache.Usage.InitPolys, gWorldCache.Usage.LimitPolys);
+		gMiscCache.Usage.InitPolys = min(gMiscCache.Usage.InitPolys, gMiscCache.Usage.LimitPolys);
+
+		gllog("Drawing polys with GLSL programs, at most %u polys per flush...", gWorldCache.Usage.LimitPolys);
+	}
 
-		if (pPoly->flags & DRV_RENDER_CLAMP_UV)
+	if (bCanDoVertexBuffers && bUsePersistentBuffers && StreamBuf_Supported())
+	{
+		// Inserts write straight into GPU visible memory, so the flushes upload nothing
+		if (StreamBuf_Create(&gMiscCache.Stream, GL_ARRAY_BUFFER, gMiscCache.Usage.InitVerts * gMiscCache.VertSize) &&
+			StreamBuf_Create(&gWorldCache.Stream, GL_ARRAY_BUFFER, gWorldCache.Usage.InitVerts * gWorldCache.VertSize))
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			bCanDoPersistentBuffers = true;
+			gllog("Streaming vertices through persistently mapped buffers...");
 		}
 		else
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			StreamBuf_Destroy(&gMiscCache.Stream);
+			StreamBuf_Destroy(&gWorldCache.Stream);
 		}
-
-		glDrawArrays(GL_TRIANGLE_FAN, pPoly->firstVert, pPoly->numVerts);
-
-		if (pPoly->flags & DRV_RENDER_NO_ZMASK)
-			glEnable(GL_DEPTH_TEST);
-
-		if (pPoly->flags & DRV_RENDER_NO_ZWRITE)
-			glEnable(GL_DEPTH_WRITEMASK);
 	}
-	
-	glDisable(GL_MULTISAMPLE);
 
-	glDisableClientState(GL_COLOR_ARRAY);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glDisableClientState(GL_VERTEX_ARRAY);
+	PCache_ResizeMisc(gMiscCache.Usage.InitPolys, gMiscCache.Usage.InitVerts);
+	PCache_ResizeWorld(gWorldCache.Usage.InitPolys, gWorldCache.Usage.InitVerts);
 
 	if (bCanDoVertexBuffers)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glGenBuffers(1, &gMiscCache.BufferID);
+		glGenBuffers(1, &gWorldCache.BufferID);
+		glGenBuffers(1, &gMiscCache.IndexBufferID);
+		glGenBuffers(1, &gWorldCache.IndexBufferID);
+
+		gBatchMode = PCACHE_BATCH_ELEMENTS;
+		gllog("Batching polys with indexed triangle lists...");
+	}
+	else if (GLEW_VERSION_1_4)
+	{
+		gBatchMode = PCACHE_BATCH_MULTIDRAW;
+		gllog("Batching polys with glMultiDrawArrays...");
+	}
+	else
+	{
+		gBatchMode = PCACHE_BATCH_ARRAYS;
 	}
 
-	OGLDRV.NumRenderedPolys += gMiscCache.NumPolys;
+	memset(&gWorldSamples, 0, sizeof(gWorldSamples));
 
-	gMiscCache.NumPolys = 0;
-	gMiscCache.NumVerts = 0;
+	if (GLEW_VERSION_1_5)
+		glGenQueries(PCACHE_NUM_SAMPLE_QUERIES, gWorldSamples.Queries);
 
-	return TRUE;
+	// The shader path needs its position only program to lay the depth down
+	gDepthPrepass = (bUseDepthPrepass && (!bCanDoShaders || Shader_UseDepth())) ? GE_TRUE : GE_FALSE;
+	GLState_UseProgram(0);
+
+	if (gDepthPrepass)
+		gllog("Laying down opaque world depth before shading it...");
 }
 
-BOOL PCache_InsertWorldPoly(DRV_TLVertex *Verts, int32 NumVerts, geRDriver_THandle *THandle, DRV_TexInfo *TexInfo, DRV_LInfo *LInfo, uint32 Flags)
+void PCache_Shutdown()
 {
-	float zRecip, DrawScaleU, DrawScaleV;
-	WorldPoly *pPoly = NULL;
-	DRV_TLVertex *pVerts = NULL;
-	WorldVertex *pWVerts = NULL;
-	uint8 alpha = 0;
+	LARGE_INTEGER Freq;
 
-	if ((gWorldCache.NumVerts + NumVerts) >= MAX_WORLD_POLY_VERTS)
+	if (bCanDoVertexBuffers)
 	{
-		if (!PCache_FlushWorldPolys())
-			return GE_FALSE;
+		glDeleteBuffers(1, &gMiscCache.BufferID);
+		glDeleteBuffers(1, &gWorldCache.BufferID);
+		glDeleteBuffers(1, &gMiscCache.IndexBufferID);
+		glDeleteBuffers(1, &gWorldCache.IndexBufferID);
 	}
 
-	if (gWorldCache.NumPolys + 1 >= MAX_WORLD_POLYS)
+	if (bCanDoPersistentBuffers)
 	{
-		if (!PCache_FlushWorldPolys())
-			return GE_FALSE;
-	}
+		gllog("Stream buffer waits: world %u, misc %u", gWorldCache.Stream.Waits, gMiscCache.Stream.Waits);
 
-	DrawScaleU = 1.0f / TexInfo->DrawScaleU;
-	DrawScaleV = 1.0f / TexInfo->DrawScaleV;
+		StreamBuf_Destroy(&gMiscCache.Stream);
+		StreamBuf_Destroy(&gWorldCache.Stream);
+		bCanDoPersistentBuffers = false;
+	}
 
-	pVerts = Verts;
-	pPoly = &gWorldCache.Polys[gWorldCache.NumPolys];
+	if (gWorldSamples.Queries[0])
+	{
+		for (uint32 i = 0; i < PCACHE_NUM_SAMPLE_QUERIES; i++)
+			PCache_DropSamples(&gWorldSamples, i);
 
-	pPoly->THandle = THandle;
-	pPoly->LInfo = LInfo;
-	pPoly->Flags = Flags;
-	pPoly->firstVert = gWorldCache.NumVerts;
-	pPoly->numVerts = NumVerts;
-	pPoly->ShiftU = TexInfo->ShiftU;
-	pPoly->ShiftV = TexInfo->ShiftV;
-	pPoly->ScaleU = DrawScaleU;
-	pPoly->ScaleV = DrawScaleV;
+		glDeleteQueries(PCACHE_NUM_SAMPLE_QUERIES, gWorldSamples.Queries);
+	}
 
-	if (pPoly->LInfo)
+	if (bCanDoShaders)
 	{
-		pPoly->ShiftU2 = (float)LInfo->MinU - 8.0f;
-		pPoly->ShiftV2 = (float)LInfo->MinV - 8.0f;
+		PCache_DestroyShaderBuffers(&gWorldCache.vaoID, &gWorldCache.ParamBufferID, &gWorldCache.ParamTextureID);
+		PCache_DestroyShaderBuffers(&gMiscCache.vaoID, &gMiscCache.ParamBufferID, &gMiscCache.ParamTextureID);
+		Shader_Shutdown();
+		bCanDoShaders = false;
 	}
 
-	pWVerts = &gWorldCache.Verts[gWorldCache.NumVerts];
+	PCache_LogUsage("World", &gWorldCache.Usage);
+	PCache_LogUsage("Misc", &gMiscCache.Usage);
+
+	free(gWorldCache.Polys);
+	free(gWorldCache.SortedPolys);
+	free(gWorldCache.SortScratch);
+	free(gWorldCache.SysVerts);
+	free(gWorldCache.Indices);
+	free(gWorldCache.DrawIndices);
+	free(gWorldCache.Batches);
+	free(gWorldCache.DrawFirst);
+	free(gWorldCache.DrawCount);
+	free(gWorldCache.Params);
+	memset(&gWorldCache, 0, sizeof(gWorldCache));
+
+	free(gMiscCache.Polys);
+	free(gMiscCache.SortedPolys);
+	free(gMiscCache.SortScratch);
+	free(gMiscCache.SysVerts);
+	free(gMiscCache.Indices);
+	free(gMiscCache.DrawIndices);
+	free(gMiscCache.Batches);
+	free(gMiscCache.DrawFirst);
+	free(gMiscCache.DrawCount);
+	free(gMiscCache.Params);
+	memset(&gMiscCache, 0, sizeof(gMiscCache));
+
+	free(gDecalCache.Decals);
+	free(gDecalCache.Verts);
+	memset(&gDecalCache, 0, sizeof(gDecalCache));
+
+	QueryPerformanceFrequency(&Freq);
+
+	if (gWorldStats.Flushes)
+	{
+		gllog("World sort mode %d: %u flushes, %u polys, %u draw calls", iWorldSortMode, 
+			gWorldStats.Flushes, gWorldStats.Polys, gWorldStats.DrawCalls);
+		gllog("  TMU0 binds: %u (submission order: %u)", gWorldStats.Binds[0], gWorldStats.SubmitOrderBinds[0]);
+		gllog("  TMU1 binds: %u (submission order: %u)", gWorldStats.Binds[1], gWorldStats.SubmitOrderBinds[1]);
+		gllog("  Sort: %.3f ms, flush: %.3f ms", 
+			gWorldStats.SortTime * 1000.0 / (double)Freq.QuadPart,
+			gWorldStats.FlushTime * 1000.0 / (double)Freq.QuadPart);
+	}
 
-	if (Flags & DRV_RENDER_ALPHA)
-		alpha = (uint8)F2DW(pVerts->a);
-	else
-		alpha = 255;
+	if (gWorldSamples.Passes)
+	{
+		gllog("Opaque world samples shaded (depth pre-pass %s): %.0f in %u passes, %.0f per pass (%u passes dropped)",
+			gDepthPrepass ? "on" : "off", gWorldSamples.Samples, gWorldSamples.Passes,
+			gWorldSamples.Samples / (double)gWorldSamples.Passes, gWorldSamples.Dropped);
+	}
 
-	for (int i = 0; i < NumVerts; i++)
+	if (gMiscStats.Flushes)
 	{
-		zRecip = 1.0f / pVerts->z;
+		gllog("Misc polys: %u flushes, %u polys, %u draw calls, %u binds", gMiscStats.Flushes,
+			gMiscStats.Polys, gMiscStats.DrawCalls, gMiscStats.Binds[0]);
+	}
 
-		pWVerts->pos[0] = pVerts->x;
-		pWVerts->pos[1] = pVerts->y;
-		pWVerts->pos[2] = (-1.0f + zRecip);
+	gllog("Pass polys: opaque world %u, opaque misc %u, alpha world %u, alpha misc %u, decals %u",
+		gPassPolys[PCACHE_PASS_OPAQUE_WORLD], gPassPolys[PCACHE_PASS_OPAQUE_MISC], gPassPolys[PCACHE_PASS_ALPHA_WORLD],
+		gPassPolys[PCACHE_PASS_ALPHA_MISC], gPassPolys[PCACHE_PASS_DECALS]);
 
-		float tu = pVerts->u * pPoly->ScaleU + pPoly->ShiftU;
-		float tv = pVerts->v * pPoly->ScaleV + pPoly->ShiftV;
+	memset(&gWorldStats, 0, sizeof(gWorldStats));
+	memset(&gMiscStats, 0, sizeof(gMiscStats));
+	memset(gPassPolys, 0, sizeof(gPassPolys));
+	memset(&gWorldSamples, 0, sizeof(gWorldSamples));
+	gDepthPrepass = GE_FALSE;
+}
 
-		pWVerts->uv[0] = tu * THandle->InvScale * zRecip;
-		pWVerts->uv[1] = tv * THandle->InvScale * zRecip;
-		pWVerts->uv[2] = 0.0f;
-		pWVerts->uv[3] = zRecip;
+// Write the triangle list for a fan starting at FirstVert.  Returns the index count.
+static uint32 PCache_FanToTriangles(GLuint *pIndices, uint32 FirstVert, int32 NumVerts)
+{
+	for (int32 i = 1; i < NumVerts - 1; i++)
+	{
+		*pIndices++ = FirstVert;
+		*pIndices++ = FirstVert + i;
+		*pIndices++ = FirstVert + i + 1;
+	}
 
-		if (pPoly->LInfo)
-		{
-			float lu, lv;
+	return (NumVerts > 2) ? (NumVerts - 2) * 3 : 0;
+}
 
-			lu = pVerts->u - pPoly->ShiftU2;
-			lv = pVerts->v - pPoly->ShiftV2;
+// Issue one batch of polys with a single draw call where the context allows it.
+// BaseVertex is added to every index (shader path only, where the VAO points at the
+// start of the vertex buffer).
+static void PCache_DrawBatch(const PCacheBatch *pBatch, const GLint *pFirst, const GLsizei *pCount, GLint BaseVertex)
+{
+	FrameStats.DrawCalls += (gBatchMode == PCACHE_BATCH_ARRAYS) ? pBatch->numPolys : 1;
 
-			pWVerts->luv[0] = lu * THandle->InvScale * zRecip;
-			pWVerts->luv[1] = lv * THandle->InvScale * zRecip;
-			pWVerts->luv[2] = 0.0f;
-			pWVerts->luv[3] = zRecip;
-		}
+	switch (gBatchMode)
+	{
+		case PCACHE_BATCH_ELEMENTS:
+			if (BaseVertex)
+				glDrawElementsBaseVertex(GL_TRIANGLES, pBatch->numIndices, GL_UNSIGNED_INT, (const void*)(pBatch->firstIndex * sizeof(GLuint)), BaseVertex);
+			else
+				glDrawElements(GL_TRIANGLES, pBatch->numIndices, GL_UNSIGNED_INT, (const void*)(pBatch->firstIndex * sizeof(GLuint)));
+			break;
 
-		pWVerts->color[0] = (uint8)F2DW(pVerts->r);
-		pWVerts->color[1] = (uint8)F2DW(pVerts->g);
-		pWVerts->color[2] = (uint8)F2DW(pVerts->b);
-		pWVerts->color[3] = alpha;
+		case PCACHE_BATCH_MULTIDRAW:
+			glMultiDrawArrays(GL_TRIANGLE_FAN, &pFirst[pBatch->firstPoly], &pCount[pBatch->firstPoly], pBatch->numPolys);
+			break;
 
-		pWVerts++;
-		pVerts++;
+		default:
+			for (uint32 i = 0; i < pBatch->numPolys; i++)
+				glDrawArrays(GL_TRIANGLE_FAN, pFirst[pBatch->firstPoly + i], pCount[pBatch->firstPoly + i]);
+			break;
 	}
+}
 
-	gWorldCache.NumVerts += NumVerts;
-	gWorldCache.NumPolys++;
+// Make sure the stream buffer segment has room for NumVerts more verts after the ones
+// already pending in the cache.  Pending verts are flushed first if it does not, which
+// counts as an overflow flush like a full cache does.
+static void PCache_ReserveStream(StreamBuf *pStream, PCacheUsage *pUsage, uint32 PendingVerts, int32 NumVerts, uint32 Stride,
+								 BOOL (*Flush)(void))
+{
+	if ((PendingVerts + NumVerts) * Stride <= StreamBuf_Room(pStream))
+		return;
 
-	return TRUE;
+	if (PendingVerts)
+	{
+		pUsage->OverflowFlushes++;
+		FrameStats.OverflowFlushes++;
+		Flush();
+	}
+
+	if (NumVerts * Stride > StreamBuf_Room(pStream))
+		StreamBuf_NextSegment(pStream);
 }
 
-BOOL PCache_FlushWorldPolys(void)
+// Packed vertices keep a single 1/z (see VtxConv.h).  These matrices take the overlapping
+// attribute windows apart again, column major.
+static const GLfloat PCache_PositionMatrix[16] =
 {
-	static uint32 wBoundTexture = 0;
-	static uint32 wBoundTexture2 = 0;
-	WorldPoly *pPoly = NULL;
+	1.0f, 0.0f, 0.0f, 0.0f,			// x
+	0.0f, 0.0f, 1.0f, 0.0f,			// q -> z
+	0.0f, 1.0f, 0.0f, 0.0f,			// y
+	0.0f, 0.0f, -1.0f, 1.0f			// z = q - 1
+};
 
-	if (gWorldCache.NumPolys == 0)
-		return GE_TRUE;
+static const GLfloat PCache_TextureMatrix[16] =
+{
+	0.0f, 0.0f, 0.0f, 1.0f,			// q
+	0.0f, 0.0f, 0.0f, 0.0f,			// y
+	1.0f, 0.0f, 0.0f, 0.0f,			// u
+	0.0f, 1.0f, 0.0f, 0.0f			// v
+};
 
-	wBoundTexture = 0;
-	wBoundTexture2 = 0;
+static const GLfloat PCache_LightmapMatrix[16] =
+{
+	1.0f, 0.0f, 0.0f, 0.0f,			// lu
+	0.0f, 1.0f, 0.0f, 0.0f,			// lv
+	0.0f, 0.0f, 0.0f, 0.0f,			// x
+	0.0f, 0.0f, 0.0f, 1.0f			// q
+};
 
-	if (bCanDoVertexBuffers)
+static void PCache_BeginPackedVerts(geBoolean Lightmap)
+{
+	glMatrixMode(GL_TEXTURE);
+
+	if (Lightmap)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, gWorldCache.BufferID);
-		glBufferData(GL_ARRAY_BUFFER, gWorldCache.NumVerts * sizeof(WorldVertex), gWorldCache.Verts, GL_STREAM_DRAW);
+		GLState_ActiveTexture(GL_TEXTURE1);
+		glPushMatrix();
+		glLoadMatrixf(PCache_LightmapMatrix);
+	}
 
-		size_t bufferLoc = 0;
+	GLState_ActiveTexture(GL_TEXTURE0);
+	glPushMatrix();
+	glLoadMatrixf(PCache_TextureMatrix);
 
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(3, GL_FLOAT, sizeof(WorldVertex), (const void*)bufferLoc);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glMultMatrixf(PCache_PositionMatrix);
+}
 
-		bufferLoc += (sizeof(float) * 3);
-		glActiveTexture(GL_TEXTURE0);
-		glClientActiveTexture(GL_TEXTURE0);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(4, GL_FLOAT, sizeof(WorldVertex), (const void*)bufferLoc);
+static void PCache_EndPackedVerts(geBoolean Lightmap)
+{
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
 
-		bufferLoc += (sizeof(float) * 4);
-		glActiveTexture(GL_TEXTURE1);
-		glClientActiveTexture(GL_TEXTURE1);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(4, GL_FLOAT, sizeof(WorldVertex), (const void*)bufferLoc);
+	glMatrixMode(GL_TEXTURE);
 
-		bufferLoc += (sizeof(float) * 4);
-		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(WorldVertex), (const void*)bufferLoc);
-	}
-	else
+	if (Lightmap)
+	{
+		GLState_ActiveTexture(GL_TEXTURE1);
+		glPopMatrix();
+	}
+
+	GLState_ActiveTexture(GL_TEXTURE0);
+	glPopMatrix();
+
+	glMatrixMode(GL_MODELVIEW);
+}
+
+static geBoolean PCache_IsColorKeyed(const geRDriver_THandle *THandle)
+{
+	return (THandle->PixelFormat.Flags & RDRIVER_PF_CAN_DO_COLORKEY) ? GE_TRUE : GE_FALSE;
+}
+
+// Polys whose texels are thrown away rather than blended where the alpha channel masks
+// them.  Only colorkeys are all or nothing; any other alpha is blended, see below.
+static geBoolean PCache_IsAlphaTested(uint32 Flags, const geRDriver_THandle *THandle)
+{
+	if (!THandle)
+		return GE_FALSE;
+
+	return PCache_IsColorKeyed(THandle);
+}
+
+// Polys drawn in the translucent passes: alpha blended ones, ones whose texture has alpha
+// of its own (THANDLE_TRANS), and misc polys without a depth test.  A test at 0.5 would
+// cut the soft edges of such textures, so they are blended like alpha polys.  Misc polys
+// without a depth test are overlays (HUD, flares) that used to land on top of all the
+// world and have to keep the order the engine submitted them in.
+static geBoolean PCache_IsTranslucent(uint32 Flags, const geRDriver_THandle *THandle, geBoolean Misc)
+{
+	if (Flags & DRV_RENDER_ALPHA)
+		return GE_TRUE;
+
+	if (THandle && (THandle->Flags & THANDLE_TRANS) && !PCache_IsColorKeyed(THandle))
+		return GE_TRUE;
+
+	return (Misc && (Flags & DRV_RENDER_NO_ZMASK)) ? GE_TRUE : GE_FALSE;
+}
+
+// Program variant for a batch's render flags and textures
+static uint32 PCache_ShaderVariant(uint32 Flags, const geRDriver_THandle *THandle, const DRV_LInfo *LInfo)
+{
+	uint32 Variant = 0;
+
+	if (LInfo)
+		Variant |= SHADER_LIGHTMAP;
+
+	if (Flags & DRV_RENDER_ALPHA)
+		Variant |= SHADER_ALPHA;
+
+	if (Flags & DRV_RENDER_CLAMP_UV)
+		Variant |= SHADER_CLAMP;
+
+	if (Shader_FogEnabled() && !(Flags & DRV_RENDER_POLY_NO_FOG))
+		Variant |= SHADER_FOG;
+
+	if (PCache_IsAlphaTested(Flags, THandle))
+		Variant |= SHADER_COLORKEY;
+
+	if (THandle && (THandle->Flags & THANDLE_ARRAY))
+		Variant |= SHADER_ARRAY;
+
+	if (!THandle)
+		Variant |= SHADER_UNTEXTURED;
+
+	return Variant;
+}
+
+// Fill a cache's parameter table for the shader path
+static void PCache_UploadParams(GLuint ParamBufferID, const PCacheParams *pParams, uint32 NumPolys)
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, ParamBufferID);
+	glBufferData(GL_TEXTURE_BUFFER, NumPolys * sizeof(PCacheParams), pParams, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	FrameStats.VertexBytes += NumPolys * sizeof(PCacheParams);
+}
+
+// Blending only for the translucent passes.  The opaque ones draw without it and alpha
+// test whatever PCache_IsAlphaTested says instead, in the shader or per batch on the
+// fixed path.  Fixed function alpha tests the modulated alpha, so its translucent
+// passes leave colorkeys to the blend as before.
+static void PCache_BeginPass(geBoolean Translucent)
+{
+	if (Translucent)
+	{
+		GLState_Enable(GL_BLEND);
+		GLState_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+	else
+		GLState_Disable(GL_BLEND);
+}
+
+// Back to the state the rest of the driver draws with
+static void PCache_EndPasses(void)
+{
+	GLState_Enable(GL_BLEND);
+	GLState_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	GLState_Disable(GL_ALPHA_TEST);
+}
+
+// Bind a cache's VAO and parameter table for the shader path.  The array buffer must
+// already be bound.  The VAO keeps its attribute pointers at the start of the buffer
+// (draws add the stream offset as a base vertex), so they are only specified again
+// when the buffer itself changes.
+static void PCache_BeginShaderVerts(GLuint vaoID, GLuint *pVaoBufferID, GLuint BufferID, GLuint ParamTextureID)
+{
+	glBindVertexArray(vaoID);
+
+	if (*pVaoBufferID != BufferID)
+	{
+		glEnableVertexAttribArray(SHADER_ATTRIB_POS);
+		glVertexAttribPointer(SHADER_ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, sizeof(DRV_TLVertex), (const void*)offsetof(DRV_TLVertex, x));
+		glEnableVertexAttribArray(SHADER_ATTRIB_UV);
+		glVertexAttribPointer(SHADER_ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, sizeof(DRV_TLVertex), (const void*)offsetof(DRV_TLVertex, u));
+		glEnableVertexAttribArray(SHADER_ATTRIB_COLOR);
+		glVertexAttribPointer(SHADER_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(DRV_TLVertex), (const void*)offsetof(DRV_TLVertex, r));
+
+		*pVaoBufferID = BufferID;
+	}
+
+	GLState_ActiveTexture(GL_TEXTURE0 + SHADER_UNIT_PARAMS);
+	GLState_BindTexture(GL_TEXTURE_BUFFER, ParamTextureID);
+	GLState_ActiveTexture(GL_TEXTURE0);
+}
+
+static void PCache_EndShaderVerts(void)
+{
+	glBindVertexArray(0);
+	GLState_UseProgram(0);
+
+	GLState_ActiveTexture(GL_TEXTURE0 + SHADER_UNIT_PARAMS);
+	GLState_BindTexture(GL_TEXTURE_BUFFER, 0);
+	GLState_ActiveTexture(GL_TEXTURE0);
+}
+
+// Copy the engine's verts as they are, with a carrying the poly's parameter table index.
+// Copied in order, one vertex at a time, so write-combined stream memory sees whole lines.
+static void PCache_CopyRawVerts(DRV_TLVertex *pDst, const DRV_TLVertex *pSrc, int32 NumVerts, uint32 PolyIndex)
+{
+	float a = (float)PolyIndex;
+
+	for (int32 i = 0; i < NumVerts; i++, pDst++)
+	{
+		*pDst = pSrc[i];
+		pDst->a = a;
+	}
+}
+
+geBoolean PCache_CanDoShaders(void)
+{
+	return bCanDoShaders ? GE_TRUE : GE_FALSE;
+}
+
+void PCache_EndFrame(void)
+{
+	if (bCanDoPersistentBuffers)
+	{
+		StreamBuf_EndFrame(&gWorldCache.Stream);
+		StreamBuf_EndFrame(&gMiscCache.Stream);
+
+		gWorldCache.Verts = (GLubyte*)StreamBuf_Pointer(&gWorldCache.Stream);
+		gMiscCache.Verts = (GLubyte*)StreamBuf_Pointer(&gMiscCache.Stream);
+	}
+
+	PCache_EndCacheFrame(&gWorldCache.Usage, PCache_ResizeWorld);
+	PCache_EndCacheFrame(&gMiscCache.Usage, PCache_ResizeMisc);
+}
+
+BOOL DRIVERCC PCache_InsertDecal(geRDriver_THandle *THandle, RECT *SrcRect, int32 x, int32 y)
+{
+	DecalRect *pDecal = NULL;
+	
+	if (gDecalCache.NumDecals >= gDecalCache.MaxDecals)
+	{
+		if (!PCache_GrowDecals(max(DECAL_CACHE_RECTS, gDecalCache.MaxDecals * 2)))
+		{
+			gllog("WARNING:  Decal cache could not grow past %u decals, dropping one", gDecalCache.MaxDecals);
+			return FALSE;
+		}
+
+		gllog("Decal cache grown to %u decals", gDecalCache.MaxDecals);
+	}
+
+	pDecal = &gDecalCache.Decals[gDecalCache.NumDecals];
+	pDecal->THandle = THandle;
+
+	pDecal->SrcRect.bottom = -1;
+	pDecal->SrcRect.left = -1;
+	pDecal->SrcRect.right = -1;
+	pDecal->SrcRect.top = -1;
+
+	if (SrcRect != NULL)
+	{
+		pDecal->SrcRect.bottom = SrcRect->bottom;
+		pDecal->SrcRect.left = SrcRect->left;
+		pDecal->SrcRect.right = SrcRect->right;
+		pDecal->SrcRect.top = SrcRect->top;
+	}
+
+	pDecal->x = x;
+	pDecal->y = y;
+
+	gDecalCache.NumDecals++;
+	gPassPolys[PCACHE_PASS_DECALS]++;
+	return TRUE;
+}
+
+// Bind a texture the engine changed on Unit and upload it
+static void PCache_UpdateTexture(geRDriver_THandle *THandle, GLenum Unit)
+{
+	GLState_ActiveTexture(Unit);
+	GLState_BindTexture(THANDLE_TARGET(THandle), THandle->TextureID);
+	THandle_Update(THandle);
+}
+
+// Clip a decal's source rect and position against the window.  GE_FALSE if nothing is left.
+static geBoolean PCache_ClipDecal(const DecalRect *pRect, RECT *pSrc, int32 *px, int32 *py)
+{
+	int32 x = pRect->x, y = pRect->y;
+
+	if (pRect->SrcRect.bottom == -1)
+	{
+		pSrc->left = 0;
+		pSrc->top = 0;
+		pSrc->right = pRect->THandle->Width;
+		pSrc->bottom = pRect->THandle->Height;
+	}
+	else
+		*pSrc = pRect->SrcRect;
+
+	if (x < 0)
+	{
+		pSrc->left -= x;
+		x = 0;
+	}
+
+	if (y < 0)
+	{
+		pSrc->top -= y;
+		y = 0;
+	}
+
+	pSrc->right = min(pSrc->right, pSrc->left + ClientWindow.Width - x);
+	pSrc->bottom = min(pSrc->bottom, pSrc->top + ClientWindow.Height - y);
+
+	*px = x;
+	*py = y;
+	return (pSrc->right > pSrc->left && pSrc->bottom > pSrc->top) ? GE_TRUE : GE_FALSE;
+}
+
+// One draw for a run of quads on the same decal atlas page
+static void PCache_DrawDecalRun(GLuint PageID, const DecalVertex *pVerts, int32 NumVerts)
+{
+	if (!NumVerts)
+		return;
+
+	GLState_ActiveTexture(GL_TEXTURE0);
+	glClientActiveTexture(GL_TEXTURE0);
+	GLState_Enable(GL_TEXTURE_2D);
+	GLState_BindTexture(GL_TEXTURE_2D, PageID);
+	GLState_BindSampler(0, 0);
+	GLState_Disable(GL_DEPTH_TEST);
+
+	glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(DecalVertex), &pVerts->x);
+
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(DecalVertex), &pVerts->u);
+
+	glDrawArrays(GL_QUADS, 0, NumVerts);
+	FrameStats.DrawCalls++;
+	FrameStats.Batches++;
+
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
+	GLState_Enable(GL_DEPTH_TEST);
+}
+
+// Atlased decals become screen space quads, drawn a page at a time.  Runs break where the
+// page changes or a decal has its own texture, so decals still overlap in the order the
+// engine drew them.
+BOOL PCache_FlushDecals()
+{
+	DecalRect *pRect = NULL;
+	DecalVertex *pVert = gDecalCache.Verts;
+	DecalVertex *pRun = gDecalCache.Verts;
+	GLuint PageID = 0;
+	RECT Src;
+	int32 x, y, w, h;
+	GLfloat s;
+
+	if (gDecalCache.NumDecals == 0)
+		return TRUE;
+
+	FrameStats_BeginPhase(FRAMESTATS_PHASE_DECALS);
+
+	for (uint32 i = 0; i < gDecalCache.NumDecals; i++)
+	{
+		pRect = &gDecalCache.Decals[i];
+
+		if ((pRect->THandle->Flags & (THANDLE_DECAL | THANDLE_UPDATE)) == (THANDLE_DECAL | THANDLE_UPDATE))
+			PCache_UpdateTexture(pRect->THandle, GL_TEXTURE0);
+	}
+
+	for (uint32 i = 0; i < gDecalCache.NumDecals; i++)
+	{
+		pRect = &gDecalCache.Decals[i];
+
+		if (!(pRect->THandle->Flags & THANDLE_DECAL))
+		{
+			PCache_DrawDecalRun(PageID, pRun, (int32)(pVert - pRun));
+			pRun = pVert;
+
+			if (pRect->SrcRect.bottom == -1)
+				DrawDecal(pRect->THandle, NULL, pRect->x, pRect->y);
+			else
+				DrawDecal(pRect->THandle, &pRect->SrcRect, pRect->x, pRect->y);
+
+			continue;
+		}
+
+		if (!PCache_ClipDecal(pRect, &Src, &x, &y))
+			continue;
+
+		if (pRect->THandle->TextureID != PageID)
+		{
+			PCache_DrawDecalRun(PageID, pRun, (int32)(pVert - pRun));
+			pRun = pVert;
+			PageID = pRect->THandle->TextureID;
+		}
+
+		w = Src.right - Src.left;
+		h = Src.bottom - Src.top;
+		s = pRect->THandle->InvScale;
+		Src.left += pRect->THandle->AtlasX;
+		Src.top += pRect->THandle->AtlasY;
+
+		pVert[0].x = (GLfloat)x;		pVert[0].y = (GLfloat)y;
+		pVert[1].x = (GLfloat)(x + w);	pVert[1].y = (GLfloat)y;
+		pVert[2].x = (GLfloat)(x + w);	pVert[2].y = (GLfloat)(y + h);
+		pVert[3].x = (GLfloat)x;		pVert[3].y = (GLfloat)(y + h);
+
+		pVert[0].u = pVert[3].u = Src.left * s;
+		pVert[1].u = pVert[2].u = (Src.left + w) * s;
+		pVert[0].v = pVert[1].v = Src.top * s;
+		pVert[2].v = pVert[3].v = (Src.top + h) * s;
+
+		pVert += 4;
+	}
+
+	PCache_DrawDecalRun(PageID, pRun, (int32)(pVert - pRun));
+
+	gDecalCache.NumDecals = 0;
+
+	FrameStats_EndPhase(FRAMESTATS_PHASE_DECALS);
+	return TRUE;
+}
+
+static UINT64 PCache_QuantizeDepth(float zRecip)
+{
+	if (zRecip < 0.0f)
+		zRecip = 0.0f;
+	else if (zRecip > 1.0f)
+		zRecip = 1.0f;
+
+	return (UINT64)(zRecip * 65535.0f);
+}
+
+static UINT64 PCache_SortKey(uint32 Flags, const geRDriver_THandle *THandle, const DRV_LInfo *LInfo, float zRecipAvg, geBoolean Misc)
+{
+	UINT64 Key;
+
+	if (PCache_IsTranslucent(Flags, THandle, Misc))
+	{
+		if (Flags & DRV_RENDER_NO_ZMASK)
+			return PCACHE_KEY_TRANSLUCENT | PCACHE_KEY_OVERLAY;
+
+		// Smaller 1/z is further away, so ascending keys draw back to front
+		return PCACHE_KEY_TRANSLUCENT | (PCache_QuantizeDepth(zRecipAvg) << PCACHE_KEY_DEPTH_SHIFT);
+	}
+
+	// Opaque polys stay in submission order, but still ahead of the translucent ones
+	if (iWorldSortMode == PCACHE_SORT_NONE)
+		return 0;
+
+	Key = (UINT64)(Flags & PCACHE_STATE_FLAGS) << PCACHE_KEY_STATE_SHIFT;
+
+	if (THandle)
+	{
+		Key |= (UINT64)(THandle->TextureID & PCACHE_KEY_ID_MASK) << PCACHE_KEY_TEXTURE_SHIFT;
+
+		if (PCache_IsAlphaTested(Flags, THandle))
+			Key |= PCACHE_KEY_ALPHATEST;
+	}
+
+	if (LInfo)
+		Key |= (UINT64)(LInfo->THandle->TextureID & PCACHE_KEY_ID_MASK) << PCACHE_KEY_LIGHTMAP_SHIFT;
+
+	// Larger 1/z is nearer, so invert it to draw front to back
+	if (iWorldSortMode == PCACHE_SORT_DEPTH)
+		Key |= (65535 - PCache_QuantizeDepth(zRecipAvg)) << PCACHE_KEY_DEPTH_SHIFT;
+
+	return Key;
+}
+
+// Average 1/z of a poly, for the keys that need it
+static float PCache_AverageZRecip(const DRV_TLVertex *Verts, int32 NumVerts)
+{
+	float zRecipSum = 0.0f;
+
+	for (int32 i = 0; i < NumVerts; i++)
+	{
+		if (Verts[i].z > 0.0f)
+			zRecipSum += 1.0f / Verts[i].z;
+		else
+			zRecipSum += 1.0f;
+	}
+
+	return zRecipSum / (float)NumVerts;
+}
+
+static UINT64 PCache_KeyAt(const GLubyte *pKeys, uint32 Stride, uint32 Index)
+{
+	return *(const UINT64*)(pKeys + Index * Stride);
+}
+
+// Stable LSD radix sort of NumPolys 64 bit keys, Stride bytes apart, 8 bits per pass.
+// Passes where every key shares the same digit are skipped.  pSrc and pDst are
+// scratch; returns whichever holds the sorted indices.
+static uint32 *PCache_SortPolys(const GLubyte *pKeys, uint32 Stride, uint32 NumPolys, uint32 *pSrc, uint32 *pDst)
+{
+	uint32 Counts[8][256];
+	uint32 *pTemp;
+	uint32 i, Pass, Sum, Count;
+	UINT64 Key;
+
+	for (i = 0; i < NumPolys; i++)
+		pSrc[i] = i;
+
+	if (NumPolys < 2)
+		return pSrc;
+
+	memset(Counts, 0, sizeof(Counts));
+
+	for (i = 0; i < NumPolys; i++)
+	{
+		Key = PCache_KeyAt(pKeys, Stride, i);
+
+		for (Pass = 0; Pass < 8; Pass++)
+			Counts[Pass][(Key >> (Pass * 8)) & 0xFF]++;
+	}
+
+	for (Pass = 0; Pass < 8; Pass++)
+	{
+		uint32 *pCounts = Counts[Pass];
+
+		if (pCounts[(PCache_KeyAt(pKeys, Stride, 0) >> (Pass * 8)) & 0xFF] == NumPolys)
+			continue;
+
+		for (i = 0, Sum = 0; i < 256; i++)
+		{
+			Count = pCounts[i];
+			pCounts[i] = Sum;
+			Sum += Count;
+		}
+
+		for (i = 0; i < NumPolys; i++)
+		{
+			Key = PCache_KeyAt(pKeys, Stride, pSrc[i]);
+			pDst[pCounts[(Key >> (Pass * 8)) & 0xFF]++] = pSrc[i];
+		}
+
+		pTemp = pSrc;
+		pSrc = pDst;
+		pDst = pTemp;
+	}
+
+	return pSrc;
+}
+
+BOOL PCache_InsertMiscPoly(DRV_TLVertex *Verts, int32 NumVerts, geRDriver_THandle *THandle, uint32 Flags)
+{
+	uint8 alpha = 0;
+	float zRecipAvg = 0.0f;
+	GLubyte *pDst;
+	MiscPoly *pPoly = NULL;
+
+	if (gMiscCache.NumPolys + 1 > gMiscCache.Usage.MaxPolys || gMiscCache.NumVerts + NumVerts > gMiscCache.Usage.MaxVerts)
+	{
+		if (!PCache_Grow(&gMiscCache.Usage, PCache_ResizeMisc, "Misc", gMiscCache.NumPolys + 1, gMiscCache.NumVerts + NumVerts))
+		{
+			// Out of memory, draw what we have and start over
+			gMiscCache.Usage.OverflowFlushes++;
+			FrameStats.OverflowFlushes++;
+			PCache_FlushMiscPolys();
+
+			if ((uint32)NumVerts > gMiscCache.Usage.MaxVerts)
+				return FALSE;
+		}
+	}
+
+	if (bCanDoPersistentBuffers)
+	{
+		PCache_ReserveStream(&gMiscCache.Stream, &gMiscCache.Usage, gMiscCache.NumVerts, NumVerts, gMiscCache.VertSize, PCache_FlushMiscPolys);
+		gMiscCache.Verts = (GLubyte*)StreamBuf_Pointer(&gMiscCache.Stream);
+	}
+
+	pPoly = &gMiscCache.Polys[gMiscCache.NumPolys];
+
+	pPoly->THandle = THandle;
+	pPoly->flags = Flags;
+	pPoly->firstVert = gMiscCache.NumVerts;
+	pPoly->numVerts = NumVerts;
+	pPoly->firstIndex = gMiscCache.NumIndices;
+	pPoly->numIndices = PCache_FanToTriangles(&gMiscCache.Indices[pPoly->firstIndex], pPoly->firstVert, NumVerts);
+
+	if (Flags & DRV_RENDER_ALPHA)
+		alpha = VtxConv_ToByte(Verts->a);
+	else
+		alpha = 255;
+
+	pDst = gMiscCache.Verts + pPoly->firstVert * gMiscCache.VertSize;
+
+	if (bCanDoShaders)
+	{
+		PCacheParams *pParams = &gMiscCache.Params[gMiscCache.NumPolys];
+
+		// Misc polys carry texture coords already normalized
+		pParams->ScaleU = 1.0f;
+		pParams->ScaleV = 1.0f;
+		pParams->ShiftU = 0.0f;
+		pParams->ShiftV = 0.0f;
+		pParams->LScale = 0.0f;
+		pParams->LShiftU = 0.0f;
+		pParams->LShiftV = 0.0f;
+		pParams->Alpha = alpha * (1.0f / 255.0f);
+		pParams->Layer = THandle ? (float)THandle->Layer : 0.0f;
+
+		PCache_CopyRawVerts((DRV_TLVertex*)pDst, Verts, NumVerts, gMiscCache.NumPolys);
+	}
+	else
+		VtxConv_Misc(Verts, (MiscVertex*)pDst, NumVerts, alpha);
+
+	if (iWorldSortMode == PCACHE_SORT_DEPTH || PCache_IsTranslucent(Flags, THandle, GE_TRUE))
+		zRecipAvg = PCache_AverageZRecip(Verts, NumVerts);
+
+	pPoly->SortKey = PCache_SortKey(Flags, THandle, NULL, zRecipAvg, GE_TRUE);
+	gPassPolys[(pPoly->SortKey & PCACHE_KEY_TRANSLUCENT) ? PCACHE_PASS_ALPHA_MISC : PCACHE_PASS_OPAQUE_MISC]++;
+
+	gMiscCache.NumPolys++;
+	gMiscCache.NumVerts += NumVerts;
+	gMiscCache.NumIndices += pPoly->numIndices;
+	gMiscCache.Usage.FramePolys++;
+	gMiscCache.Usage.FrameVerts += NumVerts;
+	return TRUE;
+}
+
+// Wrap and filtering for the base texture on unit 0.  Mipmapped textures get one of the
+// prebuilt samplers where the context has them.  Without samplers the shader variants clamp
+// for themselves, and the fixed path sets the texture's wrap mode when it or the mode changes.
+static void PCache_SetBaseWrap(const geRDriver_THandle *THandle, geBoolean Clamp, GLuint *pLastTexture, geBoolean *pLastClamp)
+{
+	GLuint Sampler = 0;
+	GLint Wrap;
+
+	if (THandle->PixelFormat.Flags & RDRIVER_PF_3D)
+		Sampler = GLState_Sampler(Clamp ? GLSTATE_SAMPLER_CLAMP : GLSTATE_SAMPLER_REPEAT);
+
+	GLState_BindSampler(0, Sampler);
+
+	if (Sampler || bCanDoShaders)
+		return;
+
+	if (*pLastTexture == THandle->TextureID && *pLastClamp == Clamp)
+		return;
+
+	Wrap = Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, Wrap);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, Wrap);
+
+	*pLastTexture = THandle->TextureID;
+	*pLastClamp = Clamp;
+}
+
+static void PCache_UpdateMiscTextures(void)
+{
+	for (uint32 i = 0; i < gMiscCache.NumPolys; i++)
+	{
+		if (gMiscCache.Polys[i].THandle && (gMiscCache.Polys[i].THandle->Flags & THANDLE_UPDATE))
+			PCache_UpdateTexture(gMiscCache.Polys[i].THandle, GL_TEXTURE0);
+	}
+}
+
+// Untextured (Gouraud) polys share TextureID 0, so they sort and batch as one bucket
+static GLuint PCache_MiscTextureID(const MiscPoly *pPoly)
+{
+	return pPoly->THandle ? pPoly->THandle->TextureID : 0;
+}
+
+// Split the draw order into runs sharing texture and state, gathering each run's triangle
+// lists into one contiguous range of DrawIndices.  The state flags include the ones that
+// pick the pass, so runs never cross from the opaque batches into the translucent ones.
+static void PCache_BuildMiscBatches(const uint32 *pDrawOrder)
+{
+	PCacheBatch *pBatch = NULL;
+	MiscPoly *pPoly, *pHead = NULL;
+	uint32 NumIndices = 0;
+
+	gMiscCache.NumBatches = 0;
+	gMiscCache.NumOpaqueBatches = 0;
+
+	for (uint32 i = 0; i < gMiscCache.NumPolys; i++)
+	{
+		pPoly = &gMiscCache.Polys[pDrawOrder[i]];
+
+		gMiscCache.DrawFirst[i] = pPoly->firstVert;
+		gMiscCache.DrawCount[i] = pPoly->numVerts;
+
+		if (!pHead || PCache_MiscTextureID(pHead) != PCache_MiscTextureID(pPoly) ||
+			PCache_IsAlphaTested(pHead->flags, pHead->THandle) != PCache_IsAlphaTested(pPoly->flags, pPoly->THandle) ||
+			((pHead->flags ^ pPoly->flags) & PCACHE_STATE_FLAGS))
+		{
+			pHead = pPoly;
+			pBatch = &gMiscCache.Batches[gMiscCache.NumBatches++];
+			pBatch->firstPoly = i;
+			pBatch->numPolys = 0;
+			pBatch->firstIndex = NumIndices;
+			pBatch->numIndices = 0;
+
+			if (!(pPoly->SortKey & PCACHE_KEY_TRANSLUCENT))
+				gMiscCache.NumOpaqueBatches = gMiscCache.NumBatches;
+		}
+
+		if (gBatchMode == PCACHE_BATCH_ELEMENTS)
+		{
+			memcpy(&gMiscCache.DrawIndices[NumIndices], &gMiscCache.Indices[pPoly->firstIndex], pPoly->numIndices * sizeof(GLuint));
+			NumIndices += pPoly->numIndices;
+		}
+
+		pBatch->numPolys++;
+		pBatch->numIndices += pPoly->numIndices;
+	}
+
+	FrameStats.Batches += gMiscCache.NumBatches;
+}
+
+// Sort and batch the pending misc polys and upload everything their passes draw from
+static void PCache_PrepareMisc(void)
+{
+	// Uploads first, they decide which textures have alpha to test
+	PCache_UpdateMiscTextures();
+
+	gMiscCache.DrawOrder = PCache_SortPolys((const GLubyte*)&gMiscCache.Polys[0].SortKey, sizeof(MiscPoly),
+		gMiscCache.NumPolys, gMiscCache.SortedPolys, gMiscCache.SortScratch);
+	PCache_BuildMiscBatches(gMiscCache.DrawOrder);
+
+	gMiscCache.DrawBufferID = 0;
+	gMiscCache.DrawBase = gMiscCache.Verts;
+
+	if (bCanDoVertexBuffers)
+	{
+		if (bCanDoPersistentBuffers)
+		{
+			// The verts are already in the mapped segment, just point at them
+			gMiscCache.DrawBufferID = gMiscCache.Stream.BufferID;
+			gMiscCache.DrawBase = (const GLubyte*)(size_t)gMiscCache.Stream.Offset;
+		}
+		else
+		{
+			gMiscCache.DrawBufferID = gMiscCache.BufferID;
+			gMiscCache.DrawBase = NULL;
+
+			glBindBuffer(GL_ARRAY_BUFFER, gMiscCache.BufferID);
+			glBufferData(GL_ARRAY_BUFFER, gMiscCache.NumVerts * gMiscCache.VertSize, gMiscCache.Verts, GL_STREAM_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		if (gBatchMode == PCACHE_BATCH_ELEMENTS)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gMiscCache.IndexBufferID);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, gMiscCache.NumIndices * sizeof(GLuint), gMiscCache.DrawIndices, GL_STREAM_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+	}
+
+	// Streamed verts were written straight to the buffer, but they cross the bus all the same
+	FrameStats.VertexBytes += gMiscCache.NumVerts * gMiscCache.VertSize;
+
+	if (gBatchMode == PCACHE_BATCH_ELEMENTS)
+		FrameStats.VertexBytes += gMiscCache.NumIndices * sizeof(GLuint);
+
+	if (bCanDoShaders)
+		PCache_UploadParams(gMiscCache.ParamBufferID, gMiscCache.Params, gMiscCache.NumPolys);
+}
+
+// Draw the opaque or the translucent batches of the prepared misc polys
+static void PCache_DrawMiscPass(geBoolean Translucent)
+{
+	const GLubyte *pBase = gMiscCache.DrawBase;
+	MiscPoly *pPoly = NULL;
+	PCacheBatch *pBatch = NULL;
+	GLuint boundTexture = 0, WrapTexture = 0;
+	geBoolean WrapClamp = GE_FALSE, AlphaTest;
+	GLint BaseVertex = 0;
+	uint32 Variant, BoundVariant = SHADER_NUM_VARIANTS;
+	uint32 First, Last;
+
+	First = Translucent ? gMiscCache.NumOpaqueBatches : 0;
+	Last = Translucent ? gMiscCache.NumBatches : gMiscCache.NumOpaqueBatches;
+
+	if (First == Last)
+		return;
+
+	if (bCanDoVertexBuffers)
+		glBindBuffer(GL_ARRAY_BUFFER, gMiscCache.DrawBufferID);
+
+	if (bCanDoShaders)
+	{
+		// The element buffer binding lives in the VAO, so bind that first
+		PCache_BeginShaderVerts(gMiscCache.vaoID, &gMiscCache.VaoBufferID, gMiscCache.DrawBufferID, gMiscCache.ParamTextureID);
+		BaseVertex = (GLint)((size_t)pBase / gMiscCache.VertSize);
+	}
+
+	if (bCanDoVertexBuffers)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gMiscCache.IndexBufferID);
+
+	if (!bCanDoShaders)
+	{
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(MiscVertex), pBase + offsetof(MiscVertex, x));
+
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(4, GL_FLOAT, sizeof(MiscVertex), pBase + offsetof(MiscVertex, q));
+
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(MiscVertex), pBase + offsetof(MiscVertex, r));
+
+		PCache_BeginPackedVerts(GE_FALSE);
+	}
+
+	GLState_Enable(GL_TEXTURE_2D);
+	PCache_BeginPass(Translucent);
+	GLState_Enable(GL_MULTISAMPLE);
+
+	for (uint32 i = First; i < Last; i++)
+	{
+		pBatch = &gMiscCache.Batches[i];
+		pPoly = &gMiscCache.Polys[gMiscCache.DrawOrder[pBatch->firstPoly]];
+
+		if (!pPoly->THandle)
+		{
+			if (!bCanDoShaders)
+				GLState_Disable(GL_TEXTURE_2D);
+		}
+		else
+		{
+			if (!bCanDoShaders)
+				GLState_Enable(GL_TEXTURE_2D);
+
+			if (boundTexture != pPoly->THandle->TextureID)
+			{
+				GLState_BindTexture(THANDLE_TARGET(pPoly->THandle), pPoly->THandle->TextureID);
+				boundTexture = pPoly->THandle->TextureID;
+				gMiscStats.Binds[0]++;
+			}
+		}
+
+		AlphaTest = PCache_IsAlphaTested(pPoly->flags, pPoly->THandle);
+
+		if (bCanDoShaders)
+		{
+			Variant = PCache_ShaderVariant(pPoly->flags, pPoly->THandle, NULL);
+
+			if (Variant != BoundVariant)
+			{
+				Shader_Use(Variant);
+				BoundVariant = Variant;
+			}
+		}
+		else if (AlphaTest && !Translucent)
+			GLState_Enable(GL_ALPHA_TEST);
+		else
+			GLState_Disable(GL_ALPHA_TEST);
+
+		if (pPoly->flags & DRV_RENDER_NO_ZMASK)
+			GLState_Disable(GL_DEPTH_TEST);
+		else
+			GLState_Enable(GL_DEPTH_TEST);
+
+		GLState_DepthMask((pPoly->flags & DRV_RENDER_NO_ZWRITE) ? GL_FALSE : GL_TRUE);
+
+		if (pPoly->THandle)
+			PCache_SetBaseWrap(pPoly->THandle, (pPoly->flags & DRV_RENDER_CLAMP_UV) ? GE_TRUE : GE_FALSE, &WrapTexture, &WrapClamp);
+
+		PCache_DrawBatch(pBatch, gMiscCache.DrawFirst, gMiscCache.DrawCount, BaseVertex);
+		gMiscStats.DrawCalls += (gBatchMode == PCACHE_BATCH_ARRAYS) ? pBatch->numPolys : 1;
+	}
+
+	GLState_Enable(GL_TEXTURE_2D);
+	GLState_Enable(GL_DEPTH_TEST);
+	GLState_DepthMask(GL_TRUE);
+	GLState_BindSampler(0, 0);
+	GLState_Disable(GL_MULTISAMPLE);
+
+	if (bCanDoShaders)
+		PCache_EndShaderVerts();
+	else
+	{
+		PCache_EndPackedVerts(GE_FALSE);
+
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+
+	if (bCanDoVertexBuffers)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+static void PCache_FinishMisc(void)
+{
+	if (bCanDoPersistentBuffers)
+	{
+		StreamBuf_Commit(&gMiscCache.Stream, gMiscCache.NumVerts * gMiscCache.VertSize);
+		gMiscCache.Verts = (GLubyte*)StreamBuf_Pointer(&gMiscCache.Stream);
+	}
+
+	gMiscStats.Flushes++;
+	FrameStats.CacheFlushes++;
+	gMiscStats.Polys += gMiscCache.NumPolys;
+
+	OGLDRV.NumRenderedPolys += gMiscCache.NumPolys;
+
+	gMiscCache.NumPolys = 0;
+	gMiscCache.NumVerts = 0;
+	gMiscCache.NumIndices = 0;
+	gMiscCache.NumBatches = 0;
+	gMiscCache.NumOpaqueBatches = 0;
+}
+
+BOOL PCache_FlushMiscPolys()
+{
+	if (gMiscCache.NumPolys == 0)
+		return TRUE;
+
+	FrameStats_BeginPhase(FRAMESTATS_PHASE_MISC_FLUSH);
+
+	PCache_PrepareMisc();
+	PCache_DrawMiscPass(GE_FALSE);
+	PCache_DrawMiscPass(GE_TRUE);
+	PCache_EndPasses();
+	PCache_FinishMisc();
+
+	FrameStats_EndPhase(FRAMESTATS_PHASE_MISC_FLUSH);
+	return TRUE;
+}
+
+// Count the texture binds the flush loop would issue if it drew in submission order
+static void PCache_CountSubmitOrderBinds(void)
+{
+	GLuint Bound[2] = { 0, 0 };
+	WorldPoly *pPoly;
+
+	for (uint32 i = 0; i < gWorldCache.NumPolys; i++)
+	{
+		pPoly = &gWorldCache.Polys[i];
+
+		if (!pPoly->THandle)
+			continue;
+
+		if (Bound[0] != pPoly->THandle->TextureID)
+		{
+			Bound[0] = pPoly->THandle->TextureID;
+			gWorldStats.SubmitOrderBinds[0]++;
+		}
+
+		if (pPoly->LInfo && Bound[1] != pPoly->LInfo->THandle->TextureID)
+		{
+			Bound[1] = pPoly->LInfo->THandle->TextureID;
+			gWorldStats.SubmitOrderBinds[1]++;
+		}
+	}
+}
+
+// Have the engine build the poly's lightmap and copy it out while its buffer is still
+// valid.  The upload waits for the flush.
+static void PCache_SetupLightmap(DRV_LInfo *LInfo)
+{
+	geBoolean Dynamic;
+
+	FrameStats_SetupLightmap(LInfo, &Dynamic);
+
+	if (Dynamic || LInfo->THandle->Flags & THANDLE_UPDATE_LM)
+	{
+		THandle_DownloadLightmap(LInfo);
+
+		if (Dynamic)
+			LInfo->THandle->Flags |= THANDLE_UPDATE_LM;
+		else
+			LInfo->THandle->Flags &= ~THANDLE_UPDATE_LM;
+	}
+}
+
+// Upload every texture and lightmap the pending world polys changed.  Batches can hold
+// several textures (atlas lightmaps, texture array layers), so this cannot wait for the
+// batch loop to bind each one.
+static void PCache_UpdateWorldTextures(void)
+{
+	WorldPoly *pPoly;
+
+	for (uint32 i = 0; i < gWorldCache.NumPolys; i++)
+	{
+		pPoly = &gWorldCache.Polys[i];
+
+		if (pPoly->THandle && (pPoly->THandle->Flags & THANDLE_UPDATE))
+			PCache_UpdateTexture(pPoly->THandle, GL_TEXTURE0);
+
+		if (pPoly->LInfo && (pPoly->LInfo->THandle->Flags & THANDLE_UPDATE))
+			PCache_UpdateTexture(pPoly->LInfo->THandle, GL_TEXTURE1);
+	}
+
+	GLState_ActiveTexture(GL_TEXTURE0);
+}
+
+BOOL PCache_InsertWorldPoly(DRV_TLVertex *Verts, int32 NumVerts, geRDriver_THandle *THandle, DRV_TexInfo *TexInfo, DRV_LInfo *LInfo, uint32 Flags)
+{
+	float zRecipAvg, DrawScaleU, DrawScaleV;
+	VtxConv_WorldParams Params;
+	GLubyte *pDst;
+	WorldPoly *pPoly = NULL;
+
+	if (gWorldCache.NumPolys + 1 > gWorldCache.Usage.MaxPolys || gWorldCache.NumVerts + NumVerts > gWorldCache.Usage.MaxVerts)
+	{
+		if (!PCache_Grow(&gWorldCache.Usage, PCache_ResizeWorld, "World", gWorldCache.NumPolys + 1, gWorldCache.NumVerts + NumVerts))
+		{
+			// Out of memory, draw what we have and start over
+			gWorldCache.Usage.OverflowFlushes++;
+			FrameStats.OverflowFlushes++;
+
+			if (!PCache_FlushWorldPolys())
+				return GE_FALSE;
+
+			if ((uint32)NumVerts > gWorldCache.Usage.MaxVerts)
+				return GE_FALSE;
+		}
+	}
+
+	if (bCanDoPersistentBuffers)
+	{
+		PCache_ReserveStream(&gWorldCache.Stream, &gWorldCache.Usage, gWorldCache.NumVerts, NumVerts, gWorldCache.VertSize, PCache_FlushWorldPolys);
+		gWorldCache.Verts = (GLubyte*)StreamBuf_Pointer(&gWorldCache.Stream);
+	}
+
+	DrawScaleU = 1.0f / TexInfo->DrawScaleU;
+	DrawScaleV = 1.0f / TexInfo->DrawScaleV;
+
+	pPoly = &gWorldCache.Polys[gWorldCache.NumPolys];
+
+	pPoly->THandle = THandle;
+	pPoly->LInfo = LInfo;
+	pPoly->Flags = Flags;
+	pPoly->firstVert = gWorldCache.NumVerts;
+	pPoly->numVerts = NumVerts;
+	pPoly->firstIndex = gWorldCache.NumIndices;
+	pPoly->numIndices = PCache_FanToTriangles(&gWorldCache.Indices[pPoly->firstIndex], pPoly->firstVert, NumVerts);
+	pPoly->ShiftU = TexInfo->ShiftU;
+	pPoly->ShiftV = TexInfo->ShiftV;
+	pPoly->ScaleU = DrawScaleU;
+	pPoly->ScaleV = DrawScaleV;
+
+	if (pPoly->LInfo)
+	{
+		PCache_SetupLightmap(LInfo);
+
+		// Atlas lightmaps start AtlasX, AtlasY texels into their page (both 0 otherwise)
+		pPoly->ShiftU2 = (float)(LInfo->MinU - 8 - (LInfo->THandle->AtlasX << 4));
+		pPoly->ShiftV2 = (float)(LInfo->MinV - 8 - (LInfo->THandle->AtlasY << 4));
+		Params.LScale = LInfo->THandle->InvScale;
+	}
+	else
+	{
+		pPoly->ShiftU2 = 0.0f;
+		pPoly->ShiftV2 = 0.0f;
+		Params.LScale = 0.0f;
+	}
+
+	Params.ScaleU = DrawScaleU * THandle->InvScale;
+	Params.ScaleV = DrawScaleV * THandle->InvScale;
+	Params.ShiftU = TexInfo->ShiftU * THandle->InvScale;
+	Params.ShiftV = TexInfo->ShiftV * THandle->InvScale;
+	Params.LShiftU = pPoly->ShiftU2;
+	Params.LShiftV = pPoly->ShiftV2;
+
+	if (Flags & DRV_RENDER_ALPHA)
+		Params.Alpha = VtxConv_ToByte(Verts->a);
+	else
+		Params.Alpha = 255;
+
+	pDst = gWorldCache.Verts + gWorldCache.NumVerts * gWorldCache.VertSize;
+
+	if (bCanDoShaders)
+	{
+		PCacheParams *pParams = &gWorldCache.Params[gWorldCache.NumPolys];
+
+		pParams->ScaleU = Params.ScaleU;
+		pParams->ScaleV = Params.ScaleV;
+		pParams->ShiftU = Params.ShiftU;
+		pParams->ShiftV = Params.ShiftV;
+		pParams->LScale = Params.LScale;
+		pParams->LShiftU = Params.LShiftU;
+		pParams->LShiftV = Params.LShiftV;
+		pParams->Alpha = Params.Alpha * (1.0f / 255.0f);
+		pParams->Layer = (float)THandle->Layer;
+
+		PCache_CopyRawVerts((DRV_TLVertex*)pDst, Verts, NumVerts, gWorldCache.NumPolys);
+
+		// Only the depth sorts need 1/z on the CPU
+		if (iWorldSortMode == PCACHE_SORT_DEPTH || PCache_IsTranslucent(Flags, THandle, GE_FALSE))
+			zRecipAvg = PCache_AverageZRecip(Verts, NumVerts);
+		else
+			zRecipAvg = 0.0f;
+	}
+	else
+		zRecipAvg = VtxConv_World(Verts, (WorldVertex*)pDst, NumVerts, &Params) / (float)NumVerts;
+
+	pPoly->SortKey = PCache_SortKey(Flags, THandle, LInfo, zRecipAvg, GE_FALSE);
+	gPassPolys[(pPoly->SortKey & PCACHE_KEY_TRANSLUCENT) ? PCACHE_PASS_ALPHA_WORLD : PCACHE_PASS_OPAQUE_WORLD]++;
+
+	gWorldCache.NumVerts += NumVerts;
+	gWorldCache.NumIndices += pPoly->numIndices;
+	gWorldCache.NumPolys++;
+	gWorldCache.Usage.FramePolys++;
+	gWorldCache.Usage.FrameVerts += NumVerts;
+
+	return TRUE;
+}
+
+static GLuint PCache_WorldTextureID(const WorldPoly *pPoly)
+{
+	return pPoly->THandle ? pPoly->THandle->TextureID : 0;
+}
+
+static GLuint PCache_WorldLightmapID(const WorldPoly *pPoly)
+{
+	return pPoly->LInfo ? pPoly->LInfo->THandle->TextureID : 0;
+}
+
+// Split the draw order into runs sharing base texture, lightmap and state, gathering
+// each run's triangle lists into one contiguous range of DrawIndices.  As with the misc
+// polys, runs never cross from the opaque batches into the translucent ones.
+static void PCache_BuildWorldBatches(const uint32 *pDrawOrder)
+{
+	PCacheBatch *pBatch = NULL;
+	WorldPoly *pPoly, *pHead = NULL;
+	uint32 NumIndices = 0;
+
+	gWorldCache.NumBatches = 0;
+	gWorldCache.NumOpaqueBatches = 0;
+
+	for (uint32 i = 0; i < gWorldCache.NumPolys; i++)
+	{
+		pPoly = &gWorldCache.Polys[pDrawOrder[i]];
+
+		gWorldCache.DrawFirst[i] = pPoly->firstVert;
+		gWorldCache.DrawCount[i] = pPoly->numVerts;
+
+		if (!pHead || PCache_WorldTextureID(pHead) != PCache_WorldTextureID(pPoly) ||
+			PCache_WorldLightmapID(pHead) != PCache_WorldLightmapID(pPoly) ||
+			PCache_IsAlphaTested(pHead->Flags, pHead->THandle) != PCache_IsAlphaTested(pPoly->Flags, pPoly->THandle) ||
+			((pHead->Flags ^ pPoly->Flags) & PCACHE_STATE_FLAGS))
+		{
+			pHead = pPoly;
+			pBatch = &gWorldCache.Batches[gWorldCache.NumBatches++];
+			pBatch->firstPoly = i;
+			pBatch->numPolys = 0;
+			pBatch->firstIndex = NumIndices;
+			pBatch->numIndices = 0;
+
+			if (!(pPoly->SortKey & PCACHE_KEY_TRANSLUCENT))
+				gWorldCache.NumOpaqueBatches = gWorldCache.NumBatches;
+		}
+
+		if (gBatchMode == PCACHE_BATCH_ELEMENTS)
+		{
+			memcpy(&gWorldCache.DrawIndices[NumIndices], &gWorldCache.Indices[pPoly->firstIndex], pPoly->numIndices * sizeof(GLuint));
+			NumIndices += pPoly->numIndices;
+		}
+
+		pBatch->numPolys++;
+		pBatch->numIndices += pPoly->numIndices;
+	}
+
+	FrameStats.Batches += gWorldCache.NumBatches;
+}
+
+// Sort and batch the pending world polys and upload everything their passes draw from
+static void PCache_PrepareWorld(void)
+{
+	LARGE_INTEGER FlushStart, SortEnd, FlushEnd;
+
+	QueryPerformanceCounter(&FlushStart);
+
+	// Uploads first, they decide which textures have alpha to test
+	PCache_UpdateWorldTextures();
+	PCache_CountSubmitOrderBinds();
+
+	gWorldCache.DrawOrder = PCache_SortPolys((const GLubyte*)&gWorldCache.Polys[0].SortKey, sizeof(WorldPoly),
+		gWorldCache.NumPolys, gWorldCache.SortedPolys, gWorldCache.SortScratch);
+
+	QueryPerformanceCounter(&SortEnd);
+
+	PCache_BuildWorldBatches(gWorldCache.DrawOrder);
+
+	gWorldCache.DrawBufferID = 0;
+	gWorldCache.DrawBase = gWorldCache.Verts;
+
+	if (bCanDoVertexBuffers)
+	{
+		if (bCanDoPersistentBuffers)
+		{
+			// The verts are already in the mapped segment, just point at them
+			gWorldCache.DrawBufferID = gWorldCache.Stream.BufferID;
+			gWorldCache.DrawBase = (const GLubyte*)(size_t)gWorldCache.Stream.Offset;
+		}
+		else
+		{
+			gWorldCache.DrawBufferID = gWorldCache.BufferID;
+			gWorldCache.DrawBase = NULL;
+
+			glBindBuffer(GL_ARRAY_BUFFER, gWorldCache.BufferID);
+			glBufferData(GL_ARRAY_BUFFER, gWorldCache.NumVerts * gWorldCache.VertSize, gWorldCache.Verts, GL_STREAM_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		if (gBatchMode == PCACHE_BATCH_ELEMENTS)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gWorldCache.IndexBufferID);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, gWorldCache.NumIndices * sizeof(GLuint), gWorldCache.DrawIndices, GL_STREAM_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+	}
+
+	// Streamed verts were written straight to the buffer, but they cross the bus all the same
+	FrameStats.VertexBytes += gWorldCache.NumVerts * gWorldCache.VertSize;
+
+	if (gBatchMode == PCACHE_BATCH_ELEMENTS)
+		FrameStats.VertexBytes += gWorldCache.NumIndices * sizeof(GLuint);
+
+	if (bCanDoShaders)
+		PCache_UploadParams(gWorldCache.ParamBufferID, gWorldCache.Params, gWorldCache.NumPolys);
+
+	QueryPerformanceCounter(&FlushEnd);
+
+	gWorldStats.SortTime += SortEnd.QuadPart - FlushStart.QuadPart;
+	gWorldStats.FlushTime += FlushEnd.QuadPart - FlushStart.QuadPart;
+}
+
+// Opaque world polys whose depth the pre-pass lays down.  Alpha tested ones need their
+// texels to know where they have depth, so they are left to the shaded pass.
+static geBoolean PCache_InDepthPrepass(const WorldPoly *pPoly)
+{
+	if (pPoly->Flags & (DRV_RENDER_NO_ZMASK | DRV_RENDER_NO_ZWRITE))
+		return GE_FALSE;
+
+	return PCache_IsAlphaTested(pPoly->Flags, pPoly->THandle) ? GE_FALSE : GE_TRUE;
+}
+
+// Depth only draw of the opaque world batches PCache_InDepthPrepass picks, from the vertex
+// setup PCache_DrawWorldPass already made but with positions alone streamed.  Their
+// indices are contiguous in draw order, so neighbouring batches go down as one draw.
+static void PCache_DrawWorldDepth(GLint BaseVertex)
+{
+	PCacheBatch Run;
+	WorldPoly *pPoly;
+	uint32 i = 0;
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	GLState_Enable(GL_DEPTH_TEST);
+	GLState_DepthMask(GL_TRUE);
+	GLState_DepthFunc(GL_LESS);
+
+	if (bCanDoShaders)
+	{
+		Shader_UseDepth();
+		glDisableVertexAttribArray(SHADER_ATTRIB_UV);
+		glDisableVertexAttribArray(SHADER_ATTRIB_COLOR);
+	}
+	else
+	{
+		GLState_Disable(GL_ALPHA_TEST);
+		glDisableClientState(GL_COLOR_ARRAY);
+
+		GLState_ActiveTexture(GL_TEXTURE1);
+		glClientActiveTexture(GL_TEXTURE1);
+		GLState_Disable(GL_TEXTURE_2D);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+		GLState_ActiveTexture(GL_TEXTURE0);
+		glClientActiveTexture(GL_TEXTURE0);
+		GLState_Disable(GL_TEXTURE_2D);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+
+	while (i < gWorldCache.NumOpaqueBatches)
+	{
+		pPoly = &gWorldCache.Polys[gWorldCache.DrawOrder[gWorldCache.Batches[i].firstPoly]];
+
+		if (!PCache_InDepthPrepass(pPoly))
+		{
+			i++;
+			continue;
+		}
+
+		Run = gWorldCache.Batches[i++];
+
+		for (; i < gWorldCache.NumOpaqueBatches; i++)
+		{
+			pPoly = &gWorldCache.Polys[gWorldCache.DrawOrder[gWorldCache.Batches[i].firstPoly]];
+
+			if (!PCache_InDepthPrepass(pPoly))
+				break;
+
+			Run.numPolys += gWorldCache.Batches[i].numPolys;
+			Run.numIndices += gWorldCache.Batches[i].numIndices;
+		}
+
+		PCache_DrawBatch(&Run, gWorldCache.DrawFirst, gWorldCache.DrawCount, BaseVertex);
+		gWorldStats.DrawCalls += (gBatchMode == PCACHE_BATCH_ARRAYS) ? Run.numPolys : 1;
+	}
+
+	if (bCanDoShaders)
+	{
+		glEnableVertexAttribArray(SHADER_ATTRIB_UV);
+		glEnableVertexAttribArray(SHADER_ATTRIB_COLOR);
+	}
+	else
+	{
+		// Unit 1 is enabled per batch, as it always is
+		glEnableClientState(GL_COLOR_ARRAY);
+
+		GLState_ActiveTexture(GL_TEXTURE1);
+		glClientActiveTexture(GL_TEXTURE1);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+		GLState_ActiveTexture(GL_TEXTURE0);
+		glClientActiveTexture(GL_TEXTURE0);
+		GLState_Enable(GL_TEXTURE_2D);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// Draw the opaque or the translucent batches of the prepared world polys.  With the depth
+// pre-pass on, the opaque polys it covered are shaded only where their depth is EQUAL to
+// what it laid down, so each covered pixel is shaded once.
+static void PCache_DrawWorldPass(geBoolean Translucent)
+{
+	const GLubyte *pBase = gWorldCache.DrawBase;
+	GLuint wBoundTexture = 0, wBoundTexture2 = 0, WrapTexture = 0;
+	geBoolean WrapClamp = GE_FALSE;
+	WorldPoly *pPoly = NULL;
+	PCacheBatch *pBatch = NULL;
+	GLint BaseVertex = 0;
+	uint32 Variant, BoundVariant = SHADER_NUM_VARIANTS;
+	uint32 First, Last;
+	geBoolean Prepass;
+	LARGE_INTEGER PassStart, PassEnd;
+
+	First = Translucent ? gWorldCache.NumOpaqueBatches : 0;
+	Last = Translucent ? gWorldCache.NumBatches : gWorldCache.NumOpaqueBatches;
+
+	if (First == Last)
+		return;
+
+	QueryPerformanceCounter(&PassStart);
+
+	if (bCanDoVertexBuffers)
+		glBindBuffer(GL_ARRAY_BUFFER, gWorldCache.DrawBufferID);
+
+	if (bCanDoShaders)
+	{
+		// The element buffer binding lives in the VAO, so bind that first
+		PCache_BeginShaderVerts(gWorldCache.vaoID, &gWorldCache.VaoBufferID, gWorldCache.DrawBufferID, gWorldCache.ParamTextureID);
+		BaseVertex = (GLint)((size_t)pBase / gWorldCache.VertSize);
+	}
+
+	if (bCanDoVertexBuffers)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gWorldCache.IndexBufferID);
+
+	if (!bCanDoShaders)
 	{
 		glEnableClientState(GL_VERTEX_ARRAY);
-		glVertexPointer(3, GL_FLOAT, sizeof(_WorldVertex), &gWorldCache.Verts[0].pos[0]);
+		glVertexPointer(3, GL_FLOAT, sizeof(WorldVertex), pBase + offsetof(WorldVertex, x));
 
-		glActiveTexture(GL_TEXTURE0);
+		GLState_ActiveTexture(GL_TEXTURE0);
 		glClientActiveTexture(GL_TEXTURE0);
-		glEnable(GL_TEXTURE_2D);
+		GLState_Enable(GL_TEXTURE_2D);
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(4, GL_FLOAT, sizeof(_WorldVertex), &gWorldCache.Verts[0].uv[0]);
+		glTexCoordPointer(4, GL_FLOAT, sizeof(WorldVertex), pBase + offsetof(WorldVertex, q));
 
-		glActiveTexture(GL_TEXTURE1);
+		GLState_ActiveTexture(GL_TEXTURE1);
 		glClientActiveTexture(GL_TEXTURE1);
-		glEnable(GL_TEXTURE_2D);
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(4, GL_FLOAT, sizeof(_WorldVertex), &gWorldCache.Verts[0].luv[0]);
+		glTexCoordPointer(4, GL_FLOAT, sizeof(WorldVertex), pBase + offsetof(WorldVertex, lu));
 
 		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(_WorldVertex), &gWorldCache.Verts[0].color[0]);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(WorldVertex), pBase + offsetof(WorldVertex, r));
+
+		PCache_BeginPackedVerts(GE_TRUE);
 	}
 
-	glEnable(GL_MULTISAMPLE);
+	PCache_BeginPass(Translucent);
 
-	glActiveTexture(GL_TEXTURE0);
+	// Before the pre-pass, so both passes rasterize the same samples
+	GLState_Enable(GL_MULTISAMPLE);
+
+	Prepass = (!Translucent && gDepthPrepass) ? GE_TRUE : GE_FALSE;
+
+	if (Prepass)
+		PCache_DrawWorldDepth(BaseVertex);
+
+	GLState_ActiveTexture(GL_TEXTURE0);
 	glClientActiveTexture(GL_TEXTURE0);
-	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 
-	for (uint32 i = 0; i < gWorldCache.NumPolys; i++)
+	if (!bCanDoShaders)
+		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	if (!Translucent)
+		PCache_BeginSamples(&gWorldSamples);
+
+	for (uint32 i = First; i < Last; i++)
 	{
-		pPoly = &gWorldCache.Polys[i];
+		pBatch = &gWorldCache.Batches[i];
+		pPoly = &gWorldCache.Polys[gWorldCache.DrawOrder[pBatch->firstPoly]];
 
 		if (pPoly->Flags & DRV_RENDER_NO_ZMASK)
-			glDisable(GL_DEPTH_TEST);
+			GLState_Disable(GL_DEPTH_TEST);
+		else
+			GLState_Enable(GL_DEPTH_TEST);
 
-		if (pPoly->Flags & DRV_RENDER_NO_ZWRITE)
-			glDepthMask(GL_FALSE);
+		if (Prepass && PCache_InDepthPrepass(pPoly))
+		{
+			// The depth is already there
+			GLState_DepthFunc(GL_EQUAL);
+			GLState_DepthMask(GL_FALSE);
+		}
+		else
+		{
+			GLState_DepthFunc(GL_LESS);
+			GLState_DepthMask((pPoly->Flags & DRV_RENDER_NO_ZWRITE) ? GL_FALSE : GL_TRUE);
+		}
 
-		if (pPoly->THandle)
+		if (bCanDoShaders)
 		{
-			glActiveTexture(GL_TEXTURE0);
-			glClientActiveTexture(GL_TEXTURE0);
-			glEnable(GL_TEXTURE_2D);
+			Variant = PCache_ShaderVariant(pPoly->Flags, pPoly->THandle, pPoly->LInfo);
 
-			if (wBoundTexture != pPoly->THandle->TextureID)
+			if (Variant != BoundVariant)
 			{
-				glBindTexture(GL_TEXTURE_2D, pPoly->THandle->TextureID);
-				wBoundTexture = pPoly->THandle->TextureID;
+				Shader_Use(Variant);
+				BoundVariant = Variant;
 			}
+		}
+		else if (!Translucent && PCache_IsAlphaTested(pPoly->Flags, pPoly->THandle))
+			GLState_Enable(GL_ALPHA_TEST);
+		else
+			GLState_Disable(GL_ALPHA_TEST);
 
-			if (pPoly->Flags & DRV_RENDER_CLAMP_UV)
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-			}
-			else
+		if (pPoly->THandle)
+		{
+			// The state cache drops the redundant binds and enables; the counts here are
+			// for comparing against submission order.
+			if (wBoundTexture != pPoly->THandle->TextureID)
 			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				wBoundTexture = pPoly->THandle->TextureID;
+				gWorldStats.Binds[0]++;
 			}
 
-			if (pPoly->THandle->Flags & THANDLE_UPDATE)
-				THandle_Update(pPoly->THandle);
-			
-			if (bUseAnisotropicFiltering)
-			{
-				glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
-			}
+			if (!bCanDoShaders)
+				GLState_Enable(GL_TEXTURE_2D);
+
+			GLState_BindTexture(THANDLE_TARGET(pPoly->THandle), pPoly->THandle->TextureID);
+			PCache_SetBaseWrap(pPoly->THandle, (pPoly->Flags & DRV_RENDER_CLAMP_UV) ? GE_TRUE : GE_FALSE, &WrapTexture, &WrapClamp);
 
 			if (pPoly->LInfo)
 			{
 				if (wBoundTexture2 != pPoly->LInfo->THandle->TextureID)
 				{
-					geBoolean Dynamic;
-
 					wBoundTexture2 = pPoly->LInfo->THandle->TextureID;
-
-					glActiveTexture(GL_TEXTURE1);
-					glClientActiveTexture(GL_TEXTURE1);
-					glEnable(GL_TEXTURE_2D);
-					glBindTexture(GL_TEXTURE_2D, pPoly->LInfo->THandle->TextureID);
-					
-					OGLDRV.SetupLightmap(pPoly->LInfo, &Dynamic);
-					if (Dynamic || pPoly->LInfo->THandle->Flags & THANDLE_UPDATE_LM)
-					{
-						THandle_DownloadLightmap(pPoly->LInfo);
-						if (Dynamic)
-							pPoly->LInfo->THandle->Flags |= THANDLE_UPDATE_LM;
-						else
-							pPoly->LInfo->THandle->Flags &= ~THANDLE_UPDATE_LM;
-					}
+					gWorldStats.Binds[1]++;
 				}
 
-				if (pPoly->LInfo->THandle->Flags & THANDLE_UPDATE)
-					THandle_Update(pPoly->LInfo->THandle);
-				
-				if (bUseAnisotropicFiltering)
-				{
-					glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
-				}
+				GLState_ActiveTexture(GL_TEXTURE1);
 
-				glActiveTexture(GL_TEXTURE0);
-				glClientActiveTexture(GL_TEXTURE0);
+				if (!bCanDoShaders)
+					GLState_Enable(GL_TEXTURE_2D);
+
+				GLState_BindTexture(GL_TEXTURE_2D, pPoly->LInfo->THandle->TextureID);
+				GLState_ActiveTexture(GL_TEXTURE0);
 			}
-			else
+			else if (!bCanDoShaders)
 			{
-				glActiveTexture(GL_TEXTURE1);
-				glClientActiveTexture(GL_TEXTURE1);
-				glDisable(GL_TEXTURE_2D);
-
-				glActiveTexture(GL_TEXTURE0);
-				glClientActiveTexture(GL_TEXTURE0);
+				GLState_ActiveTexture(GL_TEXTURE1);
+				GLState_Disable(GL_TEXTURE_2D);
+				GLState_ActiveTexture(GL_TEXTURE0);
 			}
 		}
 
-		glDrawArrays(GL_TRIANGLE_FAN, pPoly->firstVert, pPoly->numVerts);
+		PCache_DrawBatch(pBatch, gWorldCache.DrawFirst, gWorldCache.DrawCount, BaseVertex);
+		gWorldStats.DrawCalls += (gBatchMode == PCACHE_BATCH_ARRAYS) ? pBatch->numPolys : 1;
+	}
+
+	if (!Translucent)
+		PCache_EndSamples(&gWorldSamples);
 
-		if (pPoly->Flags & DRV_RENDER_NO_ZMASK)
-			glEnable(GL_DEPTH_TEST);
+	GLState_Enable(GL_DEPTH_TEST);
+	GLState_DepthMask(GL_TRUE);
+	GLState_DepthFunc(GL_LESS);
+	GLState_BindSampler(0, 0);
 
-		if (pPoly->Flags & DRV_RENDER_NO_ZWRITE)
-			glDepthMask(GL_TRUE);
-	}
+	GLState_Disable(GL_MULTISAMPLE);
 
-	glDisable(GL_MULTISAMPLE);
+	if (bCanDoShaders)
+		PCache_EndShaderVerts();
+	else
+	{
+		PCache_EndPackedVerts(GE_TRUE);
 
-	glDisableClientState(GL_COLOR_ARRAY);
-	glActiveTexture(GL_TEXTURE1);
-	glClientActiveTexture(GL_TEXTURE1);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glActiveTexture(GL_TEXTURE0);
-	glClientActiveTexture(GL_TEXTURE0);
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	glDisableClientState(GL_VERTEX_ARRAY);
+		glDisableClientState(GL_COLOR_ARRAY);
+		GLState_ActiveTexture(GL_TEXTURE1);
+		glClientActiveTexture(GL_TEXTURE1);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		GLState_ActiveTexture(GL_TEXTURE0);
+		glClientActiveTexture(GL_TEXTURE0);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
 
-	glActiveTexture(GL_TEXTURE1);
-	glClientActiveTexture(GL_TEXTURE1);
-	glDisable(GL_TEXTURE_2D);
-	glActiveTexture(GL_TEXTURE0);
-	glClientActiveTexture(GL_TEXTURE0);
-	//glActiveTexture(GL_TEXTURE0);
+		GLState_ActiveTexture(GL_TEXTURE1);
+		glClientActiveTexture(GL_TEXTURE1);
+		GLState_Disable(GL_TEXTURE_2D);
+		GLState_ActiveTexture(GL_TEXTURE0);
+		glClientActiveTexture(GL_TEXTURE0);
+	}
 
 	if (bCanDoVertexBuffers)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	QueryPerformanceCounter(&PassEnd);
+	gWorldStats.FlushTime += PassEnd.QuadPart - PassStart.QuadPart;
+}
+
+static void PCache_FinishWorld(void)
+{
+	if (bCanDoPersistentBuffers)
+	{
+		StreamBuf_Commit(&gWorldCache.Stream, gWorldCache.NumVerts * gWorldCache.VertSize);
+		gWorldCache.Verts = (GLubyte*)StreamBuf_Pointer(&gWorldCache.Stream);
+	}
+
+	gWorldStats.Flushes++;
+	FrameStats.CacheFlushes++;
+	gWorldStats.Polys += gWorldCache.NumPolys;
 
 	OGLDRV.NumRenderedPolys += gWorldCache.NumPolys;
 	gWorldCache.NumPolys = 0;
 	gWorldCache.NumVerts = 0;
+	gWorldCache.NumIndices = 0;
+	gWorldCache.NumBatches = 0;
+	gWorldCache.NumOpaqueBatches = 0;
+}
+
+BOOL PCache_FlushWorldPolys(void)
+{
+	if (gWorldCache.NumPolys == 0)
+		return GE_TRUE;
+
+	FrameStats_BeginPhase(FRAMESTATS_PHASE_WORLD_FLUSH);
+
+	PCache_PrepareWorld();
+	PCache_DrawWorldPass(GE_FALSE);
+	PCache_DrawWorldPass(GE_TRUE);
+	PCache_EndPasses();
+	PCache_FinishWorld();
 
+	FrameStats_EndPhase(FRAMESTATS_PHASE_WORLD_FLUSH);
 	return TRUE;
 }
 
+// Everything pending for the frame, a pass at a time: opaque world, opaque misc, then
+// the translucent world and misc polys back to front, then decals on top
+BOOL PCache_FlushScene(void)
+{
+	geBoolean World = (gWorldCache.NumPolys > 0) ? GE_TRUE : GE_FALSE;
+	geBoolean Misc = (gMiscCache.NumPolys > 0) ? GE_TRUE : GE_FALSE;
+
+	// The passes interleave, so each cache's phase is timed a piece at a time
+	if (World)
+	{
+		FrameStats_BeginPhase(FRAMESTATS_PHASE_WORLD_FLUSH);
+		PCache_PrepareWorld();
+		PCache_DrawWorldPass(GE_FALSE);
+		FrameStats_EndPhase(FRAMESTATS_PHASE_WORLD_FLUSH);
+	}
+
+	if (Misc)
+	{
+		FrameStats_BeginPhase(FRAMESTATS_PHASE_MISC_FLUSH);
+		PCache_PrepareMisc();
+		PCache_DrawMiscPass(GE_FALSE);
+		FrameStats_EndPhase(FRAMESTATS_PHASE_MISC_FLUSH);
+	}
+
+	if (World)
+	{
+		FrameStats_BeginPhase(FRAMESTATS_PHASE_WORLD_FLUSH);
+		PCache_DrawWorldPass(GE_TRUE);
+		PCache_FinishWorld();
+		FrameStats_EndPhase(FRAMESTATS_PHASE_WORLD_FLUSH);
+	}
+
+	if (Misc)
+	{
+		FrameStats_BeginPhase(FRAMESTATS_PHASE_MISC_FLUSH);
+		PCache_DrawMiscPass(GE_TRUE);
+		PCache_FinishMisc();
+		FrameStats_EndPhase(FRAMESTATS_PHASE_MISC_FLUSH);
+	}
+
+	PCache_EndPasses();
+
+	return PCache_FlushDecals();
+}
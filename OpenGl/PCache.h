@@ -21,15 +21,39 @@
 
 #include "dcommon.h"
 
+// Opaque poly sort modes (D3D24.INI "SortWorld").  Translucent polys always draw after the
+// opaque ones, back to front.
+#define PCACHE_SORT_NONE			0		// Draw in submission (BSP) order
+#define PCACHE_SORT_MATERIAL		1		// Sort on flags, base texture and lightmap
+#define PCACHE_SORT_DEPTH			2		// Material sort, then front to back within a material
+
+// Initial cache reservations (D3D24.INI WorldCachePolys / WorldCacheVerts / MiscCachePolys /
+// MiscCacheVerts).  The caches grow geometrically past these so a whole frame is sorted
+// and drawn in one flush, and shrink back when usage stays low.
+#define WORLD_CACHE_POLYS			512
+#define WORLD_CACHE_VERTS			2048
+
+#define MISC_CACHE_POLYS			256
+#define MISC_CACHE_VERTS			1024
+
 void PCache_Initialize();
+void PCache_Shutdown();
+void PCache_EndFrame(void);
+
+// GE_TRUE once PCache_Initialize has picked the GLSL path
+geBoolean PCache_CanDoShaders(void);
 
 BOOL DRIVERCC PCache_InsertDecal(geRDriver_THandle *THandle, RECT *SrcRect, int32 x, int32 y);
 BOOL PCache_FlushDecals(void);
 
+// A NULL THandle draws the poly in vertex colour only (Render_GouraudPoly)
 BOOL PCache_InsertMiscPoly(DRV_TLVertex *Verts, int32 NumVerts, geRDriver_THandle *THandle, uint32 Flags);
 BOOL PCache_FlushMiscPolys(void);
 
 BOOL PCache_InsertWorldPoly(DRV_TLVertex *Verts, int32 NumVerts, geRDriver_THandle *THandle, DRV_TexInfo *TexInfo, DRV_LInfo *LInfo, uint32 Flags);
 BOOL PCache_FlushWorldPolys(void);
 
+// Draw the frame's world, misc and decal caches in pass order
+BOOL PCache_FlushScene(void);
+
 #endif
\ No newline at end of file
@@ -28,15 +28,13 @@
 #include "Win32.h"
 
 #include "Pcache.h"
+#include "GLState.h"
+#include "FrameStats.h"
+#include "TexUpload.h"
 
 DRV_RENDER_MODE		RenderMode = RENDER_NONE;
 uint32				Render_HardwareFlags = 0;
 
-GLint				boundTexture = -1;  // Currently bound OpenGL texture object
-GLint				boundTexture2 = -1; // Currently bound OpenGL tex object on second TMU
-
-GLint				decalTexObj = -1;
-
 #define USE_PCACHE
 
 // Render a world polygon without multitexture support.  This will do two-polygon draws,
@@ -56,12 +54,13 @@ void Render_WorldPolyRegular(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver_THan
 #ifdef USE_LIGHTMAPS
 	if(LInfo != NULL)
 	{
-		glDepthMask(GL_FALSE);
+		GLState_DepthMask(GL_FALSE);
 	}
 #endif
 
 	pPnt = Pnts;
 
+	FrameStats.DrawCalls++;
 	glBegin(GL_TRIANGLE_FAN);	
 
 	for(i = 0; i < NumPoints; i++)
@@ -86,17 +85,13 @@ void Render_WorldPolyRegular(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver_THan
 #ifdef USE_LIGHTMAPS
 	if(LInfo != NULL)
 	{
-		glDepthMask(GL_TRUE);
+		GLState_DepthMask(GL_TRUE);
 		
-		glBlendFunc(GL_DST_COLOR,GL_ZERO);
+		GLState_BlendFunc(GL_DST_COLOR,GL_ZERO);
 
 		pPnt = Pnts;
 
-		if(boundTexture != LInfo->THandle->TextureID)
-		{
-			glBindTexture(GL_TEXTURE_2D, LInfo->THandle->TextureID);
-			boundTexture = LInfo->THandle->TextureID;
-		}
+		GLState_BindTexture(GL_TEXTURE_2D, LInfo->THandle->TextureID);
 
 		if(LInfo->THandle->Flags & THANDLE_UPDATE)
 		{
@@ -108,6 +103,7 @@ void Render_WorldPolyRegular(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver_THan
 
 		glColor4ub(255, 255, 255, 255);
 
+		FrameStats.DrawCalls++;
 	    glBegin(GL_TRIANGLE_FAN);	
 		
 		for(i = 0; i < NumPoints; i++)
@@ -127,7 +123,7 @@ void Render_WorldPolyRegular(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver_THan
 		
 		glEnd(); 
 
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		GLState_BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	}
 #endif
 }
@@ -148,14 +144,10 @@ void Render_WorldPolyMultitexture(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver
 
 	if(LInfo != NULL)
 	{
-		glActiveTextureARB(GL_TEXTURE1_ARB);
-		glEnable(GL_TEXTURE_2D);
+		GLState_ActiveTexture(GL_TEXTURE1);
+		GLState_Enable(GL_TEXTURE_2D);
 
-		if(boundTexture2 != LInfo->THandle->TextureID)
-		{
-			glBindTexture(GL_TEXTURE_2D, LInfo->THandle->TextureID);
-			boundTexture2 = LInfo->THandle->TextureID;
-		}
+		GLState_BindTexture(GL_TEXTURE_2D, LInfo->THandle->TextureID);
 
 		if(LInfo->THandle->Flags & THANDLE_UPDATE)
 		{
@@ -168,6 +160,7 @@ void Render_WorldPolyMultitexture(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver
 
 	pPnt = Pnts;
 
+	FrameStats.DrawCalls++;
 	glBegin(GL_TRIANGLE_FAN);	
 
 	for(i = 0; i < NumPoints; i++)
@@ -200,8 +193,8 @@ void Render_WorldPolyMultitexture(DRV_TLVertex *Pnts, int32 NumPoints, geRDriver
 
 	if(LInfo != NULL)
 	{
-		glDisable(GL_TEXTURE_2D);
-		glActiveTextureARB(GL_TEXTURE0_ARB);
+		GLState_Disable(GL_TEXTURE_2D);
+		GLState_ActiveTexture(GL_TEXTURE0);
 	}
 } 
 
@@ -235,11 +228,7 @@ geBoolean DRIVERCC Render_WorldPoly(DRV_TLVertex *Pnts, int32 NumPoints, geRDriv
 	scaleU = 1.0f / TexInfo->DrawScaleU;
 	scaleV = 1.0f / TexInfo->DrawScaleV;
 
-	if(boundTexture != THandle->TextureID)
-	{
-		glBindTexture(GL_TEXTURE_2D, THandle->TextureID);
-		boundTexture = THandle->TextureID;
-	}
+	GLState_BindTexture(GL_TEXTURE_2D, THandle->TextureID);
 
 	if(THandle->Flags & THANDLE_UPDATE)
 	{
@@ -248,7 +237,7 @@ geBoolean DRIVERCC Render_WorldPoly(DRV_TLVertex *Pnts, int32 NumPoints, geRDriv
 
 	if(LInfo != NULL)
 	{
-		OGLDRV.SetupLightmap(LInfo, &Dynamic);
+		FrameStats_SetupLightmap(LInfo, &Dynamic);
 
 		if(Dynamic || LInfo->THandle->Flags & THANDLE_UPDATE_LM)
 		{
@@ -289,6 +278,7 @@ geBoolean DRIVERCC Render_WorldPoly(DRV_TLVertex *Pnts, int32 NumPoints, geRDriv
 // Render a generic plain ol' polygon using Gouraud smooth shading and no texture map.
 geBoolean DRIVERCC Render_GouraudPoly(DRV_TLVertex *Pnts, int32 NumPoints, uint32 Flags)
 {
+#ifndef USE_PCACHE
 	GLint i;
 	GLfloat zRecip;
 	DRV_TLVertex *pPnt = Pnts;
@@ -306,13 +296,14 @@ geBoolean DRIVERCC Render_GouraudPoly(DRV_TLVertex *Pnts, int32 NumPoints, uint3
 		alpha = 255;
 	}
 
-	glDisable(GL_TEXTURE_2D);
+	GLState_Disable(GL_TEXTURE_2D);
 
 	if(Flags & DRV_RENDER_NO_ZMASK)
 	{
-		glDisable(GL_DEPTH_TEST);
+		GLState_Disable(GL_DEPTH_TEST);
 	}
 
+	FrameStats.DrawCalls++;
  	glBegin(GL_TRIANGLE_FAN);
 
 	for(i = 0; i < NumPoints; i++)
@@ -328,16 +319,19 @@ geBoolean DRIVERCC Render_GouraudPoly(DRV_TLVertex *Pnts, int32 NumPoints, uint3
 
 	glEnd(); 
 
-	glEnable(GL_TEXTURE_2D); 
+	GLState_Enable(GL_TEXTURE_2D); 
 
 	if(Flags & DRV_RENDER_NO_ZMASK)
 	{
-		glEnable(GL_DEPTH_TEST);
+		GLState_Enable(GL_DEPTH_TEST);
 	}
 
 	OGLDRV.NumRenderedPolys++; 
 
 	return GE_TRUE;
+#else
+	return PCache_InsertMiscPoly(Pnts, NumPoints, NULL, Flags);
+#endif
 }
 
 
@@ -363,11 +357,7 @@ geBoolean DRIVERCC Render_MiscTexturePoly(DRV_TLVertex *Pnts, int32 NumPoints,
 		alpha = 255;
 	}
 
-	if(boundTexture != THandle->TextureID)
-	{
-		glBindTexture(GL_TEXTURE_2D, THandle->TextureID);
-		boundTexture = THandle->TextureID;
-	}
+	GLState_BindTexture(GL_TEXTURE_2D, THandle->TextureID);
 
 	if(THandle->Flags & THANDLE_UPDATE)
 	{
@@ -376,9 +366,10 @@ geBoolean DRIVERCC Render_MiscTexturePoly(DRV_TLVertex *Pnts, int32 NumPoints,
 
 	if(Flags & DRV_RENDER_NO_ZMASK)
 	{
-		glDisable(GL_DEPTH_TEST);
+		GLState_Disable(GL_DEPTH_TEST);
 	}
 
+	FrameStats.DrawCalls++;
 	glBegin(GL_TRIANGLE_FAN);
 
 	for(i = 0; i < NumPoints; i++)
@@ -398,7 +389,7 @@ geBoolean DRIVERCC Render_MiscTexturePoly(DRV_TLVertex *Pnts, int32 NumPoints,
 
 	if(Flags & DRV_RENDER_NO_ZMASK)
 	{
-		glEnable(GL_DEPTH_TEST);
+		GLState_Enable(GL_DEPTH_TEST);
 	}
 
 	return GE_TRUE;
@@ -432,6 +423,8 @@ geBoolean DRIVERCC DrawShadowPoly(geFloat r, geFloat g, geFloat b, geFloat a)
 //           be sampled down to 256x256 and then restreched when drawing.  I haven't tested this 
 //           against such cards, due to lack of any access to one, but my guess is the resulting 
 //           image wont look so hot.
+//        Decals bigger than the card allows are split into tiles (THANDLE_TILED) when
+//        they are uploaded, and drawn a quad per tile.
 //
 // In the future, may want to add platform-specific framebuffer access (GDI, X11, etc) as 
 // allowed.  But...for Windows, DirectDraw isn't supported, and to the best of my knowledge, 
@@ -442,6 +435,9 @@ geBoolean DRIVERCC DrawDecal(geRDriver_THandle *THandle, RECT *SRect, int32 x, i
 	GLint width, height;
 	GLfloat uClamp, vClamp;
 	GLfloat uDiff = 1.0f, vDiff = 1.0f;
+	GLfloat uScale, vScale;
+	GLint uOffset = 0, vOffset = 0;
+	GLint tx, ty, tileLeft, tileTop, left, top, right, bottom;
 	
 	if(!RenderingIsOK)
 		return GE_TRUE;
@@ -491,34 +487,44 @@ geBoolean DRIVERCC DrawDecal(geRDriver_THandle *THandle, RECT *SRect, int32 x, i
 		y = 0;
 	}
 
-	if(boundTexture != THandle->TextureID)
-	{
-		glBindTexture(GL_TEXTURE_2D, THandle->TextureID);
-		boundTexture = THandle->TextureID;
-	}
+	GLState_BindTexture(GL_TEXTURE_2D, THandle->TextureID);
 
 	if(THandle->Flags & THANDLE_UPDATE)
 	{
 		THandle_Update(THandle);
 	}
 	
-	glDisable(GL_DEPTH_TEST);
+	GLState_Disable(GL_DEPTH_TEST);
 	
 	glColor4f(1.0, 1.0, 1.0, 1.0);
 	
 	glShadeModel(GL_FLAT);
 	
-	if(THandle->Data[1] == NULL)
+	if(!(THandle->Flags & THANDLE_TILED))
 	{
-		uClamp = width / (GLfloat)THandle->PaddedWidth;
-		vClamp = height / (GLfloat)THandle->PaddedHeight;
+		if(THandle->Flags & THANDLE_DECAL)
+		{
+			// A rect of a shared atlas page
+			uScale = vScale = THandle->InvScale;
+			uOffset = THandle->AtlasX;
+			vOffset = THandle->AtlasY;
+		}
+		else
+		{
+			uScale = 1.0f / (GLfloat)THandle->PaddedWidth;
+			vScale = 1.0f / (GLfloat)THandle->PaddedHeight;
+		}
+
+		uClamp = width * uScale;
+		vClamp = height * vScale;
 		
 		glMatrixMode(GL_TEXTURE); 
 		glPushMatrix();
 		glLoadIdentity();
-		glTranslatef(srcRect->left / (GLfloat)THandle->PaddedWidth, 
-			srcRect->top / (GLfloat)THandle->PaddedHeight, 0.0f);
+		glTranslatef((uOffset + srcRect->left) * uScale, 
+			(vOffset + srcRect->top) * vScale, 0.0f);
 		
+		FrameStats.DrawCalls++;
 		glBegin(GL_QUADS);
 		
 		glTexCoord2f(0.0f, 0.0);
@@ -540,65 +546,57 @@ geBoolean DRIVERCC DrawDecal(geRDriver_THandle *THandle, RECT *SRect, int32 x, i
 	}
 	else
 	{
-	
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, THandle->Width);
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS, srcRect->left);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS, srcRect->top);
+		// A quad for each tile the source rect touches, a texel to the pixel
+		for(ty = max(srcRect->top, 0) / THandle->TileSize; ty < THandle->TilesY; ty++)
+		{
+			tileTop = ty * THandle->TileSize;
 
-		glPixelZoom(1.0, -1.0);
+			if(tileTop >= srcRect->bottom)
+				break;
 
-		if(width <= maxTextureSize && height <= maxTextureSize &&
-			width == SnapToPower2(width) && height == SnapToPower2(height))
-		{
-			// Last chance to avoid the dreaded glDrawPixels...Yes, this is faster
-			// than glDrawPixels on the ICD's I've tested.  Go figure.
-			// (Could add a more complex texture upload/clamp system for
-			//  width/heights other than powers of 2, but for now,
-			//  this is enough complexity...Sorry, 3DFX)
+			top = max(srcRect->top, tileTop);
+			bottom = min(srcRect->bottom, tileTop + THandle->TileSize);
+			vScale = 1.0f / (GLfloat)THandle_PadSize(min(THandle->TileSize, THandle->Height - tileTop));
 
-			if(decalTexObj == -1)
+			for(tx = max(srcRect->left, 0) / THandle->TileSize; tx < THandle->TilesX; tx++)
 			{
-				glGenTextures(1, (GLuint*)&decalTexObj);
-			}
+				tileLeft = tx * THandle->TileSize;
 
-			glBindTexture(GL_TEXTURE_2D, decalTexObj);
-			boundTexture = decalTexObj;
+				if(tileLeft >= srcRect->right)
+					break;
 
-			glTexImage2D(GL_TEXTURE_2D, 0, 4, width, height, 
-					0, GL_RGBA, GL_UNSIGNED_BYTE, THandle->Data[1]); 
+				left = max(srcRect->left, tileLeft);
+				right = min(srcRect->right, tileLeft + THandle->TileSize);
+				uScale = 1.0f / (GLfloat)THandle_PadSize(min(THandle->TileSize, THandle->Width - tileLeft));
 
-			glBegin(GL_QUADS);
-			
-			glTexCoord2f(0.0f, 0.0);
-			glVertex2i(x, y);
-			
-			glTexCoord2f(1.0f, 0.0f);
-			glVertex2i(x + width, y);
-			
-			glTexCoord2f(1.0f, 1.0f);
-			glVertex2i(x + width, y + height);
-			
-			glTexCoord2f(0.0f, 1.0f);
-			glVertex2i(x, y + height);
-			
-			glEnd();
-		}
-		else
-		{
-			glPixelZoom(1.0, -1.0);
+				if(right <= left || bottom <= top)
+					continue;
 
-			glRasterPos2i(x, y);
-			glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, THandle->Data[1]);
-		}
+				GLState_BindTexture(GL_TEXTURE_2D, THandle->Tiles[ty * THandle->TilesX + tx]);
+
+				FrameStats.DrawCalls++;
+				glBegin(GL_QUADS);
+
+				glTexCoord2f((left - tileLeft) * uScale, (top - tileTop) * vScale);
+				glVertex2i(x + left - srcRect->left, y + top - srcRect->top);
+
+				glTexCoord2f((right - tileLeft) * uScale, (top - tileTop) * vScale);
+				glVertex2i(x + right - srcRect->left, y + top - srcRect->top);
 
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-	} 
+				glTexCoord2f((right - tileLeft) * uScale, (bottom - tileTop) * vScale);
+				glVertex2i(x + right - srcRect->left, y + bottom - srcRect->top);
+
+				glTexCoord2f((left - tileLeft) * uScale, (bottom - tileTop) * vScale);
+				glVertex2i(x + left - srcRect->left, y + bottom - srcRect->top);
+
+				glEnd();
+			}
+		}
+	}
 	
 	glShadeModel(GL_SMOOTH);
 	
-	glEnable(GL_DEPTH_TEST); 
+	GLState_Enable(GL_DEPTH_TEST); 
 	
 	return GE_TRUE; 
 }
@@ -654,11 +652,7 @@ geBoolean DRIVERCC DrawDecalNew(geRDriver_THandle *THandle, RECT *SRect, int32 x
 		y = 0;
 	}
 
-	if (boundTexture != THandle->TextureID)
-	{
-		glBindTexture(GL_TEXTURE_2D, THandle->TextureID);
-		boundTexture = THandle->TextureID;
-	}
+	GLState_BindTexture(GL_TEXTURE_2D, THandle->TextureID);
 
 	if (THandle->Flags & THANDLE_UPDATE)
 	{
@@ -724,8 +718,10 @@ geBoolean DRIVERCC BeginScene(geBoolean Clear, geBoolean ClearZ, geBoolean Clear
 	}
 
 	OGLDRV.NumRenderedPolys = 0;
+	FrameStats_BeginFrame();
+
 	if (bUseFullSceneAntiAliasing)
-		glEnable(GL_MULTISAMPLE);
+		GLState_Enable(GL_MULTISAMPLE);
 
 	return GE_TRUE;
 }
@@ -734,17 +730,21 @@ geBoolean DRIVERCC BeginScene(geBoolean Clear, geBoolean ClearZ, geBoolean Clear
 geBoolean DRIVERCC EndScene(void)
 {	
 #ifdef USE_PCACHE
-	PCache_FlushWorldPolys();
-	PCache_FlushMiscPolys();
+	PCache_FlushScene();
+#else
+	PCache_FlushDecals();
 #endif
 
-	PCache_FlushDecals();
+	PCache_EndFrame();
+	TexUpload_EndFrame();
 
 	if (bUseFullSceneAntiAliasing)
-		glDisable(GL_MULTISAMPLE);
+		GLState_Disable(GL_MULTISAMPLE);
 
 	if(RenderingIsOK)
 		FlipGLBuffers();
+
+	FrameStats_EndFrame(&CacheInfo);
 	
 	return GE_TRUE;
 }
@@ -753,6 +753,7 @@ geBoolean DRIVERCC EndScene(void)
 geBoolean DRIVERCC BeginWorld(void)
 {
 	RenderMode = RENDER_WORLD;
+	FrameStats_BeginPhase(FRAMESTATS_PHASE_WORLD);
 
 	OGLDRV.NumWorldPixels = 0;
 	OGLDRV.NumWorldSpans = 0;
@@ -764,6 +765,7 @@ geBoolean DRIVERCC BeginWorld(void)
 geBoolean DRIVERCC EndWorld(void)
 {
 	RenderMode = RENDER_NONE;
+	FrameStats_EndPhase(FRAMESTATS_PHASE_WORLD);
 
 
 	return TRUE;
@@ -773,6 +775,7 @@ geBoolean DRIVERCC EndWorld(void)
 geBoolean DRIVERCC BeginMeshes(void)
 {
 	RenderMode = RENDER_MESHES;
+	FrameStats_BeginPhase(FRAMESTATS_PHASE_MESHES);
 
 	return TRUE;
 }
@@ -781,6 +784,7 @@ geBoolean DRIVERCC BeginMeshes(void)
 geBoolean DRIVERCC EndMeshes(void)
 {
 	RenderMode = RENDER_NONE;
+	FrameStats_EndPhase(FRAMESTATS_PHASE_MESHES);
 
 	return TRUE;
 }
@@ -789,6 +793,7 @@ geBoolean DRIVERCC EndMeshes(void)
 geBoolean DRIVERCC BeginModels(void)
 {
 	RenderMode = RENDER_MODELS;
+	FrameStats_BeginPhase(FRAMESTATS_PHASE_MODELS);
 
 	return TRUE;
 }
@@ -797,6 +802,7 @@ geBoolean DRIVERCC BeginModels(void)
 geBoolean DRIVERCC EndModels(void)
 {
 	RenderMode = RENDER_NONE;
+	FrameStats_EndPhase(FRAMESTATS_PHASE_MODELS);
 
 	return TRUE;
 }
@@ -41,7 +41,6 @@ enum
 
 extern uint32				PolyMode;
 extern DRV_CacheInfo		CacheInfo;
-extern GLint decalTexObj;
 
 void Render_SetHardwareMode(int32 NewMode, uint32 NewFlags);
 geBoolean DRIVERCC Render_GouraudPoly(DRV_TLVertex *Pnts, int32 NumPoints, uint32 Flags);
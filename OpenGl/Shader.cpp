@@ -0,0 +1,446 @@
+/*
+	@file Shader.cpp
+
+	@brief GLSL program helpers for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Shader.h"
+#include "GLState.h"
+
+extern void gllog(const char *fmt, ...);
+
+// Screen position and depth from the raw engine vertex, shared by every vertex stage.
+// Invariant, so the depth pre-pass and the shaded pass agree to the bit under GL_EQUAL.
+static const char *Shader_PolyPositionSource =
+	"invariant gl_Position;\n"
+	"uniform vec2 ScreenScale;\n"
+	"in vec3 aPos;\n"
+	"vec4 PolyPosition()\n"
+	"{\n"
+	"	float q = 1.0 / aPos.z;\n"
+	"	return vec4(aPos.x * ScreenScale.x - 1.0, 1.0 - aPos.y * ScreenScale.y, 1.0 - 2.0 * q, 1.0);\n"
+	"}\n";
+
+// Projective texture coordinates and colour on top of the position.
+// Written against the core profile: no fixed function state is read.
+static const char *Shader_PolyVertexSource =
+	"uniform samplerBuffer PolyParams;\n"
+	"in vec2 aUV;\n"
+	"in vec4 aColor;\n"
+	"out vec4 TexCoord;\n"
+	"out vec4 LightCoord;\n"
+	"out vec4 Color;\n"
+	"out float FogCoord;\n"
+	"void main()\n"
+	"{\n"
+	"	int Poly = int(aColor.a) * PARAM_TEXELS;\n"
+	"	vec4 Tex = texelFetch(PolyParams, Poly);\n"
+	"	vec4 Light = texelFetch(PolyParams, Poly + 1);\n"
+	"	float Layer = texelFetch(PolyParams, Poly + 2).x;\n"
+	"	float q = 1.0 / aPos.z;\n"
+	"	gl_Position = PolyPosition();\n"
+	"	TexCoord = vec4((aUV * Tex.xy + Tex.zw) * q, Layer, q);\n"
+	"	LightCoord = vec4((aUV - Light.yz) * (Light.x * q), 0.0, q);\n"
+	"	Color = clamp(vec4(aColor.rgb * (1.0 / 255.0), Light.w), 0.0, 1.0);\n"
+	"	FogCoord = 1.0 - q;\n"
+	"}\n";
+
+// TexCoord.z carries the array layer, constant over the poly
+static const char *Shader_PolyFragmentSource =
+	"#ifdef ARRAY\n"
+	"uniform sampler2DArray Texture;\n"
+	"#define TEXEL(uv) texture(Texture, vec3(uv, TexCoord.z))\n"
+	"#define TEXSIZE() textureSize(Texture, 0).xy\n"
+	"#else\n"
+	"uniform sampler2D Texture;\n"
+	"#define TEXEL(uv) texture(Texture, uv)\n"
+	"#define TEXSIZE() textureSize(Texture, 0)\n"
+	"#endif\n"
+	"uniform sampler2D Lightmap;\n"
+	"uniform vec3 FogColor;\n"
+	"uniform vec2 FogRange;\n"
+	"in vec4 TexCoord;\n"
+	"in vec4 LightCoord;\n"
+	"in vec4 Color;\n"
+	"in float FogCoord;\n"
+	"out vec4 FragColor;\n"
+	"void main()\n"
+	"{\n"
+	"#ifdef UNTEXTURED\n"
+	"	vec4 c = vec4(1.0);\n"
+	"#else\n"
+	"	vec2 uv = TexCoord.xy / TexCoord.w;\n"
+	"#ifdef CLAMP\n"
+	"	vec2 Edge = 0.5 / vec2(TEXSIZE());\n"
+	"	uv = clamp(uv, Edge, 1.0 - Edge);\n"
+	"#endif\n"
+	"	vec4 c = TEXEL(uv);\n"
+	"#endif\n"
+	"#ifdef COLORKEY\n"
+	"	if (c.a < 0.5)\n"
+	"		discard;\n"
+	"#endif\n"
+	"#ifdef LIGHTMAP\n"
+	"	c.rgb *= textureProj(Lightmap, LightCoord.xyw).rgb;\n"
+	"#endif\n"
+	"	c.rgb *= Color.rgb;\n"
+	"#ifdef ALPHA\n"
+	"	c.a *= Color.a;\n"
+	"#endif\n"
+	"#ifdef FOG\n"
+	"	c.rgb = mix(FogColor, c.rgb, clamp((FogRange.y - FogCoord) / (FogRange.y - FogRange.x), 0.0, 1.0));\n"
+	"#endif\n"
+	"	FragColor = c;\n"
+	"}\n";
+
+// Depth pre-pass: position only, and nothing to shade
+static const char *Shader_DepthVertexSource =
+	"void main()\n"
+	"{\n"
+	"	gl_Position = PolyPosition();\n"
+	"}\n";
+
+static const char *Shader_DepthFragmentSource =
+	"#version 150\n"
+	"void main()\n"
+	"{\n"
+	"}\n";
+
+typedef struct ShaderVariant
+{
+	GLuint		Program;
+	GLint		ScreenScale;					// Uniform locations
+	GLint		FogColor;
+	GLint		FogRange;
+	uint32		Serial;							// gShaderSerial the uniforms were last uploaded at
+	geBoolean	Failed;
+} ShaderVariant;
+
+static ShaderVariant	gVariants[SHADER_NUM_VARIANTS];
+static ShaderVariant	gDepthProgram;
+static GLuint			gPolyVertexShader = 0;
+
+// Bumped whenever a uniform shared by every variant changes
+static uint32			gShaderSerial = 1;
+static GLfloat			gScreenScale[2] = { 2.0f / 640.0f, 2.0f / 480.0f };
+static GLfloat			gFogColor[3] = { 0.0f, 0.0f, 0.0f };
+static GLfloat			gFogRange[2] = { 0.0f, 1.0f };
+static geBoolean		gFogEnabled = GE_FALSE;
+
+geBoolean Shader_Supported(void)
+{
+	return GLEW_VERSION_3_2 ? GE_TRUE : GE_FALSE;
+}
+
+GLuint Shader_Compile(GLenum Type, const char *pSource, const char *pName)
+{
+	GLuint Shader;
+	GLint Status = GL_FALSE, LogLength = 0;
+
+	Shader = glCreateShader(Type);
+	glShaderSource(Shader, 1, &pSource, NULL);
+	glCompileShader(Shader);
+
+	glGetShaderiv(Shader, GL_COMPILE_STATUS, &Status);
+
+	if (Status != GL_TRUE)
+	{
+		glGetShaderiv(Shader, GL_INFO_LOG_LENGTH, &LogLength);
+
+		if (LogLength > 0)
+		{
+			char *pLog = (char*)malloc(LogLength);
+
+			if (pLog)
+			{
+				glGetShaderInfoLog(Shader, LogLength, NULL, pLog);
+				gllog("ERROR:  Could not compile %s:  %s", pName, pLog);
+				free(pLog);
+			}
+		}
+		else
+			gllog("ERROR:  Could not compile %s", pName);
+
+		glDeleteShader(Shader);
+		return 0;
+	}
+
+	return Shader;
+}
+
+GLuint Shader_Link(GLuint VertShader, GLuint FragShader, const char **pAttribs, int32 NumAttribs, const char *pName)
+{
+	GLuint Program;
+	GLint Status = GL_FALSE, LogLength = 0;
+
+	Program = glCreateProgram();
+
+	if (VertShader)
+		glAttachShader(Program, VertShader);
+
+	if (FragShader)
+		glAttachShader(Program, FragShader);
+
+	for (int32 i = 0; i < NumAttribs; i++)
+		glBindAttribLocation(Program, i, pAttribs[i]);
+
+	glLinkProgram(Program);
+
+	// The program keeps what it needs, the stages can go once it is linked
+	if (VertShader)
+		glDetachShader(Program, VertShader);
+
+	if (FragShader)
+		glDetachShader(Program, FragShader);
+
+	glGetProgramiv(Program, GL_LINK_STATUS, &Status);
+
+	if (Status != GL_TRUE)
+	{
+		glGetProgramiv(Program, GL_INFO_LOG_LENGTH, &LogLength);
+
+		if (LogLength > 0)
+		{
+			char *pLog = (char*)malloc(LogLength);
+
+			if (pLog)
+			{
+				glGetProgramInfoLog(Program, LogLength, NULL, pLog);
+				gllog("ERROR:  Could not link %s:  %s", pName, pLog);
+				free(pLog);
+			}
+		}
+		else
+			gllog("ERROR:  Could not link %s", pName);
+
+		glDeleteProgram(Program);
+		return 0;
+	}
+
+	return Program;
+}
+
+geBoolean Shader_Initialize(void)
+{
+	char Source[4096];
+
+	memset(gVariants, 0, sizeof(gVariants));
+
+	memset(&gDepthProgram, 0, sizeof(gDepthProgram));
+
+	// Every variant shares the one vertex stage
+	sprintf(Source, "#version 150\n#define PARAM_TEXELS %d\n%s%s", SHADER_PARAM_TEXELS, Shader_PolyPositionSource, Shader_PolyVertexSource);
+	gPolyVertexShader = Shader_Compile(GL_VERTEX_SHADER, Source, "poly vertex shader");
+
+	if (!gPolyVertexShader)
+		return GE_FALSE;
+
+	// Build the plainest variant up front so a broken driver falls back right away
+	if (!Shader_Use(0))
+	{
+		Shader_Shutdown();
+		return GE_FALSE;
+	}
+
+	GLState_UseProgram(0);
+	return GE_TRUE;
+}
+
+void Shader_Shutdown(void)
+{
+	for (int32 i = 0; i < SHADER_NUM_VARIANTS; i++)
+	{
+		if (gVariants[i].Program)
+			glDeleteProgram(gVariants[i].Program);
+	}
+
+	memset(gVariants, 0, sizeof(gVariants));
+
+	if (gDepthProgram.Program)
+		glDeleteProgram(gDepthProgram.Program);
+
+	memset(&gDepthProgram, 0, sizeof(gDepthProgram));
+
+	if (gPolyVertexShader)
+	{
+		glDeleteShader(gPolyVertexShader);
+		gPolyVertexShader = 0;
+	}
+}
+
+static void Shader_UpdateUniforms(ShaderVariant *pVariant)
+{
+	if (pVariant->Serial == gShaderSerial)
+		return;
+
+	glUniform2fv(pVariant->ScreenScale, 1, gScreenScale);
+	glUniform3fv(pVariant->FogColor, 1, gFogColor);
+	glUniform2fv(pVariant->FogRange, 1, gFogRange);
+	pVariant->Serial = gShaderSerial;
+}
+
+static geBoolean Shader_BuildVariant(uint32 Variant)
+{
+	static const char *Attribs[] = { "aPos", "aUV", "aColor" };
+	ShaderVariant *pVariant = &gVariants[Variant];
+	char Source[4096], Name[64];
+	GLuint FragShader;
+
+	sprintf(Source, "#version 150\n%s%s%s%s%s%s%s%s",
+		(Variant & SHADER_LIGHTMAP) ? "#define LIGHTMAP\n" : "",
+		(Variant & SHADER_ALPHA) ? "#define ALPHA\n" : "",
+		(Variant & SHADER_FOG) ? "#define FOG\n" : "",
+		(Variant & SHADER_COLORKEY) ? "#define COLORKEY\n" : "",
+		(Variant & SHADER_CLAMP) ? "#define CLAMP\n" : "",
+		(Variant & SHADER_ARRAY) ? "#define ARRAY\n" : "",
+		(Variant & SHADER_UNTEXTURED) ? "#define UNTEXTURED\n" : "",
+		Shader_PolyFragmentSource);
+
+	sprintf(Name, "poly program %d", Variant);
+
+	FragShader = Shader_Compile(GL_FRAGMENT_SHADER, Source, Name);
+
+	if (FragShader)
+	{
+		pVariant->Program = Shader_Link(gPolyVertexShader, FragShader, Attribs, 3, Name);
+		glDeleteShader(FragShader);
+	}
+
+	if (!pVariant->Program)
+	{
+		pVariant->Failed = GE_TRUE;
+		return GE_FALSE;
+	}
+
+	// FragColor is the only output, so it lands on draw buffer 0 without binding it
+	GLState_UseProgram(pVariant->Program);
+	glUniform1i(glGetUniformLocation(pVariant->Program, "PolyParams"), SHADER_UNIT_PARAMS);
+	glUniform1i(glGetUniformLocation(pVariant->Program, "Texture"), SHADER_UNIT_TEXTURE);
+	glUniform1i(glGetUniformLocation(pVariant->Program, "Lightmap"), SHADER_UNIT_LIGHTMAP);
+
+	pVariant->ScreenScale = glGetUniformLocation(pVariant->Program, "ScreenScale");
+	pVariant->FogColor = glGetUniformLocation(pVariant->Program, "FogColor");
+	pVariant->FogRange = glGetUniformLocation(pVariant->Program, "FogRange");
+	pVariant->Serial = 0;
+
+	return GE_TRUE;
+}
+
+geBoolean Shader_Use(uint32 Variant)
+{
+	ShaderVariant *pVariant = &gVariants[Variant];
+
+	if (!pVariant->Program)
+	{
+		// A variant that would not build gets the plain one rather than nothing
+		if (pVariant->Failed || !Shader_BuildVariant(Variant))
+		{
+			if (Variant == 0)
+				return GE_FALSE;
+
+			return Shader_Use(0);
+		}
+	}
+	else
+		GLState_UseProgram(pVariant->Program);
+
+	Shader_UpdateUniforms(pVariant);
+	return GE_TRUE;
+}
+
+static geBoolean Shader_BuildDepthProgram(void)
+{
+	static const char *Attribs[] = { "aPos" };
+	char Source[4096];
+	GLuint VertShader, FragShader;
+
+	gDepthProgram.Failed = GE_TRUE;
+
+	sprintf(Source, "#version 150\n%s%s", Shader_PolyPositionSource, Shader_DepthVertexSource);
+	VertShader = Shader_Compile(GL_VERTEX_SHADER, Source, "depth vertex shader");
+
+	if (!VertShader)
+		return GE_FALSE;
+
+	FragShader = Shader_Compile(GL_FRAGMENT_SHADER, Shader_DepthFragmentSource, "depth fragment shader");
+
+	if (FragShader)
+	{
+		gDepthProgram.Program = Shader_Link(VertShader, FragShader, Attribs, 1, "depth program");
+		glDeleteShader(FragShader);
+	}
+
+	glDeleteShader(VertShader);
+
+	if (!gDepthProgram.Program)
+		return GE_FALSE;
+
+	// Fog uniforms are not in this one, their locations come back -1 and are ignored
+	gDepthProgram.ScreenScale = glGetUniformLocation(gDepthProgram.Program, "ScreenScale");
+	gDepthProgram.FogColor = -1;
+	gDepthProgram.FogRange = -1;
+	gDepthProgram.Serial = 0;
+	gDepthProgram.Failed = GE_FALSE;
+
+	return GE_TRUE;
+}
+
+geBoolean Shader_UseDepth(void)
+{
+	if (!gDepthProgram.Program && (gDepthProgram.Failed || !Shader_BuildDepthProgram()))
+		return GE_FALSE;
+
+	GLState_UseProgram(gDepthProgram.Program);
+	Shader_UpdateUniforms(&gDepthProgram);
+
+	return GE_TRUE;
+}
+
+void Shader_SetScreen(int32 Width, int32 Height)
+{
+	gScreenScale[0] = 2.0f / (GLfloat)Width;
+	gScreenScale[1] = 2.0f / (GLfloat)Height;
+	gShaderSerial++;
+}
+
+// Same ranges SetFogEnable gives the fixed function fog
+void Shader_SetFog(geBoolean Enable, float r, float g, float b, float Start, float End)
+{
+	gFogEnabled = Enable;
+
+	if (!Enable)
+		return;
+
+	if (Start < 1.0f)
+		Start = 1.0f;
+
+	if (End < 1.0f)
+		End = 1.0f;
+
+	gFogColor[0] = r / 255.0f;
+	gFogColor[1] = g / 255.0f;
+	gFogColor[2] = b / 255.0f;
+	gFogRange[0] = 1.0f - 1.0f / Start;
+	gFogRange[1] = 1.0f - 1.0f / End;
+	gShaderSerial++;
+}
+
+geBoolean Shader_FogEnabled(void)
+{
+	return gFogEnabled;
+}
@@ -0,0 +1,71 @@
+/*
+	@file Shader.h
+
+	@brief GLSL program helpers for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+// Poly program variants, one bit per feature compiled in
+#define SHADER_LIGHTMAP				(1<<0)		// Modulate by the lightmap on unit 1
+#define SHADER_ALPHA				(1<<1)		// Modulate alpha by the vertex alpha
+#define SHADER_FOG					(1<<2)		// Linear fog on 1 - 1/z
+#define SHADER_COLORKEY				(1<<3)		// Discard keyed (zero alpha) texels
+#define SHADER_CLAMP				(1<<4)		// Clamp UVs instead of wrapping
+#define SHADER_ARRAY				(1<<5)		// Texture is a layer of a 2D texture array
+#define SHADER_UNTEXTURED			(1<<6)		// Vertex colour only, no texture read
+#define SHADER_NUM_VARIANTS			(1<<7)
+
+// Texture units the poly programs read
+#define SHADER_UNIT_TEXTURE			0
+#define SHADER_UNIT_LIGHTMAP		1
+#define SHADER_UNIT_PARAMS			2			// Per-poly parameter table, a buffer texture
+#define SHADER_PARAM_TEXELS			3			// RGBA32F texels per poly in the table
+
+// Vertex attributes of the poly programs, all read straight from DRV_TLVertex
+#define SHADER_ATTRIB_POS			0			// x, y, z
+#define SHADER_ATTRIB_UV			1			// u, v
+#define SHADER_ATTRIB_COLOR			2			// r, g, b, and the parameter table index in a
+
+// GLSL 1.50
+geBoolean Shader_Supported(void);
+
+// Variants are compiled the first time they are used
+geBoolean Shader_Initialize(void);
+void Shader_Shutdown(void);
+
+// Bind the program for a SHADER_* mask, uploading any screen or fog changes it missed
+geBoolean Shader_Use(uint32 Variant);
+
+// Bind the position only program for depth pre-passes.  Its depth matches the poly
+// programs' exactly.  GE_FALSE if it would not build.
+geBoolean Shader_UseDepth(void);
+
+void Shader_SetScreen(int32 Width, int32 Height);
+void Shader_SetFog(geBoolean Enable, float r, float g, float b, float Start, float End);
+geBoolean Shader_FogEnabled(void);
+
+// Compile one stage.  Returns 0 and logs the info log on failure.
+GLuint Shader_Compile(GLenum Type, const char *pSource, const char *pName);
+
+// Link a program from a vertex shader and an optional fragment shader (0 keeps the
+// fixed function fragment stage).  Attribute i is bound to pAttribs[i] before linking.
+GLuint Shader_Link(GLuint VertShader, GLuint FragShader, const char **pAttribs, int32 NumAttribs, const char *pName);
+
+#endif
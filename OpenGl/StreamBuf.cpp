@@ -0,0 +1,145 @@
+/*
+	@file StreamBuf.cpp
+
+	@brief Persistently mapped streaming buffers for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include "StreamBuf.h"
+
+extern void gllog(const char *fmt, ...);
+
+#define STREAMBUF_MAP_FLAGS		(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+geBoolean StreamBuf_Supported(void)
+{
+	return (GLEW_ARB_buffer_storage && GLEW_ARB_sync && GLEW_ARB_map_buffer_range) ? GE_TRUE : GE_FALSE;
+}
+
+geBoolean StreamBuf_Create(StreamBuf *pBuf, GLenum Target, uint32 SegmentSize)
+{
+	memset(pBuf, 0, sizeof(StreamBuf));
+
+	pBuf->Target = Target;
+	pBuf->SegmentSize = SegmentSize;
+
+	glGenBuffers(1, &pBuf->BufferID);
+	glBindBuffer(Target, pBuf->BufferID);
+	glBufferStorage(Target, SegmentSize * STREAMBUF_SEGMENTS, NULL, STREAMBUF_MAP_FLAGS);
+	pBuf->pBase = (GLubyte*)glMapBufferRange(Target, 0, SegmentSize * STREAMBUF_SEGMENTS, STREAMBUF_MAP_FLAGS);
+	glBindBuffer(Target, 0);
+
+	if (!pBuf->pBase)
+	{
+		gllog("StreamBuf_Create:  Could not map %u bytes persistently", SegmentSize * STREAMBUF_SEGMENTS);
+		glDeleteBuffers(1, &pBuf->BufferID);
+		pBuf->BufferID = 0;
+		return GE_FALSE;
+	}
+
+	return GE_TRUE;
+}
+
+void StreamBuf_Destroy(StreamBuf *pBuf)
+{
+	if (!pBuf->BufferID)
+		return;
+
+	for (int i = 0; i < STREAMBUF_SEGMENTS; i++)
+	{
+		if (pBuf->Fences[i])
+			glDeleteSync(pBuf->Fences[i]);
+	}
+
+	glBindBuffer(pBuf->Target, pBuf->BufferID);
+	glUnmapBuffer(pBuf->Target);
+	glBindBuffer(pBuf->Target, 0);
+	glDeleteBuffers(1, &pBuf->BufferID);
+
+	memset(pBuf, 0, sizeof(StreamBuf));
+}
+
+geBoolean StreamBuf_Resize(StreamBuf *pBuf, uint32 SegmentSize, uint32 KeepBytes)
+{
+	StreamBuf Old = *pBuf;
+
+	if (!StreamBuf_Create(pBuf, Old.Target, SegmentSize))
+	{
+		*pBuf = Old;
+		return GE_FALSE;
+	}
+
+	// Slow read from write-combined memory, but only happens when a cache grows mid-frame
+	if (KeepBytes)
+		memcpy(pBuf->pBase, Old.pBase + Old.Offset, KeepBytes);
+
+	pBuf->Waits = Old.Waits;
+
+	// GL keeps the old store alive until the GPU has finished with it
+	StreamBuf_Destroy(&Old);
+
+	return GE_TRUE;
+}
+
+uint32 StreamBuf_Room(const StreamBuf *pBuf)
+{
+	return (pBuf->Segment + 1) * pBuf->SegmentSize - pBuf->Offset;
+}
+
+void *StreamBuf_Pointer(const StreamBuf *pBuf)
+{
+	return pBuf->pBase + pBuf->Offset;
+}
+
+void StreamBuf_Commit(StreamBuf *pBuf, uint32 Size)
+{
+	pBuf->Offset += Size;
+}
+
+void StreamBuf_NextSegment(StreamBuf *pBuf)
+{
+	GLsync Fence;
+	GLenum Result;
+
+	pBuf->Fences[pBuf->Segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	pBuf->Segment = (pBuf->Segment + 1) % STREAMBUF_SEGMENTS;
+	pBuf->Offset = pBuf->Segment * pBuf->SegmentSize;
+
+	Fence = pBuf->Fences[pBuf->Segment];
+
+	if (!Fence)
+		return;
+
+	Result = glClientWaitSync(Fence, 0, 0);
+
+	if (Result == GL_TIMEOUT_EXPIRED)
+	{
+		pBuf->Waits++;
+
+		do
+		{
+			Result = glClientWaitSync(Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while (Result == GL_TIMEOUT_EXPIRED);
+	}
+
+	glDeleteSync(Fence);
+	pBuf->Fences[pBuf->Segment] = NULL;
+}
+
+void StreamBuf_EndFrame(StreamBuf *pBuf)
+{
+	if (pBuf->Offset != pBuf->Segment * pBuf->SegmentSize)
+		StreamBuf_NextSegment(pBuf);
+}
@@ -0,0 +1,64 @@
+/*
+	@file StreamBuf.h
+
+	@brief Persistently mapped streaming buffers for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __STREAMBUF_H__
+#define __STREAMBUF_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+// One segment per frame in flight.  The CPU fills one while the GPU reads the other two.
+#define STREAMBUF_SEGMENTS			3
+
+typedef struct StreamBuf
+{
+	GLenum		Target;
+	GLuint		BufferID;
+	GLubyte		*pBase;							// Persistent, coherent mapping of the whole buffer
+	uint32		SegmentSize;					// Bytes per segment
+	uint32		Segment;						// Segment the CPU is writing
+	uint32		Offset;							// Write cursor, in bytes from the start of the buffer
+	GLsync		Fences[STREAMBUF_SEGMENTS];		// Signalled when the GPU is done with a segment
+	uint32		Waits;							// Times the CPU had to wait on a fence
+} StreamBuf;
+
+geBoolean StreamBuf_Supported(void);
+geBoolean StreamBuf_Create(StreamBuf *pBuf, GLenum Target, uint32 SegmentSize);
+void StreamBuf_Destroy(StreamBuf *pBuf);
+
+// Replace the buffer with one of SegmentSize bytes per segment, carrying KeepBytes of
+// uncommitted data from the write cursor over to the start of the new buffer.
+geBoolean StreamBuf_Resize(StreamBuf *pBuf, uint32 SegmentSize, uint32 KeepBytes);
+
+// Bytes left in the current segment after the write cursor
+uint32 StreamBuf_Room(const StreamBuf *pBuf);
+
+// CPU pointer at the write cursor
+void *StreamBuf_Pointer(const StreamBuf *pBuf);
+
+// Mark Size bytes at the write cursor as handed to the GPU
+void StreamBuf_Commit(StreamBuf *pBuf, uint32 Size);
+
+// Fence the current segment and move to the next one, waiting for the GPU if it
+// is still reading it.
+void StreamBuf_NextSegment(StreamBuf *pBuf);
+
+// Called once per frame.  Moves to the next segment if anything was written.
+void StreamBuf_EndFrame(StreamBuf *pBuf);
+
+#endif
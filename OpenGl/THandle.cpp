@@ -23,16 +23,60 @@
 #include "THandle.h"
 #include "OglDrv.h"
 #include "Render.h"
+#include "Atlas.h"
+#include "TexArray.h"
+#include "PCache.h"
+#include "GLState.h"
+#include "FrameStats.h"
+#include "TexUpload.h"
+#include "MipGen.h"
+
+typedef struct THandleTable
+{
+	geRDriver_THandle	*Chunks[THANDLE_MAX_CHUNKS];
+	int32				NumChunks;
+	geRDriver_THandle	*FreeList;
+	geRDriver_THandle	*ActiveList;
+	uint32				NumActive;
+	uint32				PeakActive;
+} THandleTable;
 
-extern GLint boundTexture;
-extern GLint boundTexture2;
+static THandleTable	gHandles;
 
-geRDriver_THandle	TextureHandles[MAX_TEXTURE_HANDLES];
+// Lightmaps are packed into these pages so world polys stop rebinding TMU1 per face
+static Atlas		LightmapAtlas;
 
+// 2D textures are packed into these so PCache_FlushDecals can draw a page's decals in one go
+static Atlas		DecalAtlas;
 
-// Init THandle system (do nothing, for now)
-geBoolean THandle_Startup(void)
+// World textures of the same size share texture arrays (shader path only)
+static geBoolean	bCanDoTextureArrays = GE_FALSE;
+
+// 2D textures are stored at their own size rather than padded to powers of two
+static geBoolean	bCanDoNPOT = GE_FALSE;
+
+
+// Add a chunk of handles to the free list
+static geBoolean THandle_GrowTable(void)
 {
+	geRDriver_THandle *pChunk;
+
+	if (gHandles.NumChunks >= THANDLE_MAX_CHUNKS)
+		return GE_FALSE;
+
+	pChunk = (geRDriver_THandle*)calloc(THANDLE_CHUNK_SIZE, sizeof(geRDriver_THandle));
+
+	if (!pChunk)
+		return GE_FALSE;
+
+	// Linked back to front so handles are given out in address order
+	for (int32 i = THANDLE_CHUNK_SIZE - 1; i >= 0; i--)
+	{
+		pChunk[i].Next = gHandles.FreeList;
+		gHandles.FreeList = &pChunk[i];
+	}
+
+	gHandles.Chunks[gHandles.NumChunks++] = pChunk;
 	return GE_TRUE;
 }
 
@@ -40,24 +84,455 @@ geBoolean THandle_Startup(void)
 // Find an empty texture handle
 geRDriver_THandle *FindTextureHandle()
 {
-	int32				i;
 	geRDriver_THandle	*THandle;
 
-	THandle = TextureHandles;
+	if (!gHandles.FreeList && !THandle_GrowTable())
+		return NULL;
+
+	THandle = gHandles.FreeList;
+	gHandles.FreeList = THandle->Next;
+
+	memset(THandle, 0, sizeof(geRDriver_THandle));
+
+	THandle->Active = GE_TRUE;
+	THandle->Next = gHandles.ActiveList;
+
+	if (gHandles.ActiveList)
+		gHandles.ActiveList->Prev = THandle;
+
+	gHandles.ActiveList = THandle;
+
+	if (++gHandles.NumActive > gHandles.PeakActive)
+		gHandles.PeakActive = gHandles.NumActive;
+
+	return THandle;
+}
+
+
+// Give a handle back to the free list
+static void ReleaseTextureHandle(geRDriver_THandle *THandle)
+{
+	if (THandle->Prev)
+		THandle->Prev->Next = THandle->Next;
+	else
+		gHandles.ActiveList = THandle->Next;
+
+	if (THandle->Next)
+		THandle->Next->Prev = THandle->Prev;
+
+	memset(THandle, 0, sizeof(geRDriver_THandle));
+
+	THandle->Next = gHandles.FreeList;
+	gHandles.FreeList = THandle;
+	gHandles.NumActive--;
+}
+
+
+// Create / destroy churn through the handle table, against the linear scan of a fixed
+// array it replaced.  Only the allocators are timed, no GL objects are made.
+static void THandle_Benchmark(void)
+{
+	geRDriver_THandle **pLive, *pArray;
+	int32 *pLiveIndex;
+	LARGE_INTEGER Freq, Start, End;
+	double TableMs, ScanMs;
+	uint32 Seed;
+	int32 i, j, n;
+
+	pLive = (geRDriver_THandle**)malloc(THANDLE_BENCH_HANDLES * sizeof(geRDriver_THandle*));
+	pLiveIndex = (int32*)malloc(THANDLE_BENCH_HANDLES * sizeof(int32));
+	pArray = (geRDriver_THandle*)calloc(THANDLE_BENCH_HANDLES, sizeof(geRDriver_THandle));
+
+	if (!pLive || !pLiveIndex || !pArray)
+	{
+		free(pLive);
+		free(pLiveIndex);
+		free(pArray);
+		return;
+	}
+
+	QueryPerformanceFrequency(&Freq);
+
+	// Fill up, replace random handles, then reset, as a level load and unload would
+	QueryPerformanceCounter(&Start);
+	Seed = 1;
+
+	for (i = 0; i < THANDLE_BENCH_HANDLES; i++)
+		pLive[i] = FindTextureHandle();
+
+	for (i = 0; i < THANDLE_BENCH_CHURN; i++)
+	{
+		Seed = Seed * 1664525 + 1013904223;
+		n = (Seed >> 8) % THANDLE_BENCH_HANDLES;
+
+		if (pLive[n])
+			ReleaseTextureHandle(pLive[n]);
+
+		pLive[n] = FindTextureHandle();
+	}
+
+	while (gHandles.ActiveList)
+		ReleaseTextureHandle(gHandles.ActiveList);
+
+	QueryPerformanceCounter(&End);
+	TableMs = (End.QuadPart - Start.QuadPart) * 1000.0 / (double)Freq.QuadPart;
+
+	// The same sequence through the old first-free scan
+	QueryPerformanceCounter(&Start);
+	Seed = 1;
 
-	for(i = 0; i < MAX_TEXTURE_HANDLES; i++, THandle++)
+	for (i = 0; i < THANDLE_BENCH_HANDLES; i++)
 	{
-		if(!THandle->Active)
+		for (j = 0; j < THANDLE_BENCH_HANDLES && pArray[j].Active; j++);
+
+		memset(&pArray[j], 0, sizeof(geRDriver_THandle));
+		pArray[j].Active = GE_TRUE;
+		pLiveIndex[i] = j;
+	}
+
+	for (i = 0; i < THANDLE_BENCH_CHURN; i++)
+	{
+		Seed = Seed * 1664525 + 1013904223;
+		n = (Seed >> 8) % THANDLE_BENCH_HANDLES;
+
+		memset(&pArray[pLiveIndex[n]], 0, sizeof(geRDriver_THandle));
+
+		for (j = 0; j < THANDLE_BENCH_HANDLES && pArray[j].Active; j++);
+
+		memset(&pArray[j], 0, sizeof(geRDriver_THandle));
+		pArray[j].Active = GE_TRUE;
+		pLiveIndex[n] = j;
+	}
+
+	for (j = 0; j < THANDLE_BENCH_HANDLES; j++)
+	{
+		if (pArray[j].Active)
+			memset(&pArray[j], 0, sizeof(geRDriver_THandle));
+	}
+
+	QueryPerformanceCounter(&End);
+	ScanMs = (End.QuadPart - Start.QuadPart) * 1000.0 / (double)Freq.QuadPart;
+
+	gllog("Handle benchmark: %d handles, %d replaced: table %.3f ms, linear scan %.3f ms",
+		THANDLE_BENCH_HANDLES, THANDLE_BENCH_CHURN, TableMs, ScanMs);
+
+	// The table keeps its chunks, so the peak is the benchmark's rather than the game's
+	gHandles.PeakActive = 0;
+
+	free(pLive);
+	free(pLiveIndex);
+	free(pArray);
+}
+
+
+// Init THandle system
+geBoolean THandle_Startup(void)
+{
+	int32 PageSize = min(iLightmapAtlasSize, maxTextureSize);
+
+	if (PageSize > 0 && Atlas_Create(&LightmapAtlas, PageSize, THANDLE_ATLAS_PAGES, GL_RGB8))
+		gllog("Packing lightmaps into %dx%d atlas pages...", PageSize, PageSize);
+
+	PageSize = min(iDecalAtlasSize, maxTextureSize);
+
+	if (PageSize > 0 && Atlas_Create(&DecalAtlas, PageSize, THANDLE_DECAL_PAGES, GL_RGBA8))
+		gllog("Packing decals into %dx%d atlas pages...", PageSize, PageSize);
+
+	TexUpload_Initialize();
+	MipGen_Initialize();
+	CkBlit_Initialize(iBlitKernel);
+
+	if (bBenchBlit)
+		CkBlit_Benchmark();
+
+	if (GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two)
+	{
+		bCanDoNPOT = GE_TRUE;
+		gllog("Storing 2D textures without power of two padding...");
+	}
+
+	if (bUseTextureArrays && PCache_CanDoShaders() && TexArray_Initialize())
+	{
+		bCanDoTextureArrays = GE_TRUE;
+		gllog("Sharing texture arrays between same sized world textures...");
+	}
+
+	if (bHandleBenchmark)
+		THandle_Benchmark();
+
+	return GE_TRUE;
+}
+
+
+void THandle_Shutdown(void)
+{
+	if (LightmapAtlas.PageSize)
+	{
+		gllog("Lightmap atlas: %d pages, %u lightmaps, %u did not fit", LightmapAtlas.NumPages,
+			LightmapAtlas.NumRects, LightmapAtlas.Failed);
+	}
+
+	if (DecalAtlas.PageSize)
+	{
+		gllog("Decal atlas: %d pages, %u decals, %u did not fit", DecalAtlas.NumPages,
+			DecalAtlas.NumRects, DecalAtlas.Failed);
+	}
+
+	// Atlas pages and tiles go with the context, so nothing may outlive it
+	FreeAllTextureHandles();
+
+	gllog("Texture handles: %d chunks of %d, peak %u live", gHandles.NumChunks, THANDLE_CHUNK_SIZE,
+		gHandles.PeakActive);
+
+	for (int32 i = 0; i < gHandles.NumChunks; i++)
+		free(gHandles.Chunks[i]);
+
+	memset(&gHandles, 0, sizeof(gHandles));
+
+	TexUpload_Shutdown();
+
+	Atlas_Destroy(&LightmapAtlas);
+	Atlas_Destroy(&DecalAtlas);
+
+	if (bCanDoTextureArrays)
+	{
+		TexArray_Shutdown();
+		bCanDoTextureArrays = GE_FALSE;
+	}
+}
+
+
+// Give a new lightmap a rect in the atlas, with a gutter so bilinear filtering does not
+// pick up its neighbours.  Its texels are kept in Data[0] with the gutter filled in.
+static geBoolean THandle_AtlasLightmap(geRDriver_THandle *THandle)
+{
+	int32 x, y, Width, Height;
+
+	if (!LightmapAtlas.PageSize)
+		return GE_FALSE;
+
+	Width = THandle->Width + THANDLE_ATLAS_GUTTER * 2;
+	Height = THandle->Height + THANDLE_ATLAS_GUTTER * 2;
+
+	if (!Atlas_Alloc(&LightmapAtlas, Width, Height, &THandle->TextureID, &x, &y))
+		return GE_FALSE;
+
+	THandle->Data[0] = (GLubyte*)malloc(Width * Height * 3);
+
+	if (!THandle->Data[0])
+	{
+		Atlas_Free(&LightmapAtlas, THandle->TextureID);
+		THandle->TextureID = 0;
+		return GE_FALSE;
+	}
+
+	THandle->AtlasX = x + THANDLE_ATLAS_GUTTER;
+	THandle->AtlasY = y + THANDLE_ATLAS_GUTTER;
+	THandle->Flags |= THANDLE_ATLAS;
+
+	// luv maps straight onto atlas texels, 16 units to the texel
+	THandle->InvScale = 1.0f / (GLfloat)(LightmapAtlas.PageSize << 4);
+	return GE_TRUE;
+}
+
+
+// Give a new 2D texture a rect in the decal atlas.  Decals are drawn a texel to the pixel,
+// so bilinear filtering samples texel centres and no gutter is needed.
+static geBoolean THandle_AtlasDecal(geRDriver_THandle *THandle)
+{
+	int32 x, y;
+
+	if (!DecalAtlas.PageSize || THandle->PixelFormat.PixelFormat != GE_PIXELFORMAT_24BIT_RGB)
+		return GE_FALSE;
+
+	if (!Atlas_Alloc(&DecalAtlas, THandle->Width, THandle->Height, &THandle->TextureID, &x, &y))
+		return GE_FALSE;
+
+	THandle->AtlasX = x;
+	THandle->AtlasY = y;
+	THandle->Flags |= THANDLE_DECAL;
+
+	// Texels to page uv
+	THandle->InvScale = 1.0f / (GLfloat)DecalAtlas.PageSize;
+	return GE_TRUE;
+}
+
+
+// Split a 2D texture bigger than GL allows over a grid of textures, all but the last row
+// and column TileSize square
+static geBoolean THandle_CreateTiles(geRDriver_THandle *THandle)
+{
+	THandle->TileSize = min(maxTextureSize, THANDLE_MAX_TILE_SIZE);
+	THandle->TilesX = (THandle->Width + THandle->TileSize - 1) / THandle->TileSize;
+	THandle->TilesY = (THandle->Height + THandle->TileSize - 1) / THandle->TileSize;
+
+	THandle->Tiles = (GLuint*)malloc(THandle->TilesX * THandle->TilesY * sizeof(GLuint));
+
+	if (!THandle->Tiles)
+		return GE_FALSE;
+
+	glGenTextures(THandle->TilesX * THandle->TilesY, THandle->Tiles);
+	THandle->Flags |= THANDLE_TILED;
+	return GE_TRUE;
+}
+
+
+// Find what changed in a 2D texture since it was last uploaded, by diffing against the
+// Shadow copy of what GL has.  Without a shadow it is the whole texture.  GE_FALSE if
+// nothing changed.
+static geBoolean THandle_DirtyRect(const geRDriver_THandle *THandle, RECT *pRect)
+{
+	int32 Pitch = THandle->Width * 3;
+	const GLubyte *pNew = THandle->Data[0];
+	const GLubyte *pOld = THandle->Shadow;
+	int32 x, y;
+
+	if (!pOld)
+	{
+		pRect->left = 0;
+		pRect->top = 0;
+		pRect->right = THandle->Width;
+		pRect->bottom = THandle->Height;
+		return GE_TRUE;
+	}
+
+	pRect->left = THandle->Width;
+	pRect->top = THandle->Height;
+	pRect->right = 0;
+	pRect->bottom = 0;
+
+	for (y = 0; y < THandle->Height; y++, pNew += Pitch, pOld += Pitch)
+	{
+		if (!memcmp(pNew, pOld, Pitch))
+			continue;
+
+		pRect->top = min(pRect->top, y);
+		pRect->bottom = y + 1;
+
+		// Only columns outside what is already dirty need looking at
+		for (x = 0; x < pRect->left && !memcmp(pNew + x * 3, pOld + x * 3, 3); x++);
+		pRect->left = x;
+
+		for (x = THandle->Width; x > pRect->right && !memcmp(pNew + (x - 1) * 3, pOld + (x - 1) * 3, 3); x--);
+		pRect->right = x;
+	}
+
+	return (pRect->bottom > pRect->top) ? GE_TRUE : GE_FALSE;
+}
+
+
+// Record the rows of pRect as uploaded, once GL has them.  The first time round this
+// makes the shadow; if that fails every update stays a full one.
+static void THandle_SaveShadow(geRDriver_THandle *THandle, const RECT *pRect)
+{
+	int32 Pitch = THandle->Width * 3;
+
+	if (!THandle->Shadow)
+	{
+		THandle->Shadow = (GLubyte*)malloc(Pitch * THandle->Height);
+
+		if (!THandle->Shadow)
+			return;
+
+		memcpy(THandle->Shadow, THandle->Data[0], Pitch * THandle->Height);
+		return;
+	}
+
+	memcpy(THandle->Shadow + pRect->top * Pitch, THandle->Data[0] + pRect->top * Pitch,
+		(pRect->bottom - pRect->top) * Pitch);
+}
+
+
+// Colour key convert a rect of a 2D texture into RGBA rows DestWidth texels apart
+static void THandle_Convert2D(GLubyte *pDest, int32 DestWidth, const geRDriver_THandle *THandle, const RECT *pRect)
+{
+	for (int32 y = pRect->top; y < pRect->bottom; y++, pDest += DestWidth * 4)
+	{
+		CkBlit24_32(pDest, DestWidth, 1, THandle->Data[0] + (y * THandle->Width + pRect->left) * 3,
+			pRect->right - pRect->left, 1);
+	}
+}
+
+
+// Upload the tiles of a THANDLE_TILED texture that pDirty touches.  A Full update creates
+// each tile, padded where the card needs it.  Returns the bytes sent, and clears *pSent if
+// any tile could not be.
+static uint32 THandle_UpdateTiles(geRDriver_THandle *THandle, const RECT *pDirty, geBoolean Full, geBoolean *pSent)
+{
+	int32 tx, ty, pw, ph;
+	RECT Tile, Rect;
+	uint32 Bytes = 0;
+	GLubyte *dest;
+	GLuint *pTile = THandle->Tiles;
+
+	for (ty = 0; ty < THandle->TilesY; ty++)
+	{
+		Tile.top = ty * THandle->TileSize;
+		Tile.bottom = min(Tile.top + THandle->TileSize, THandle->Height);
+		ph = THandle_PadSize(Tile.bottom - Tile.top);
+
+		for (tx = 0; tx < THandle->TilesX; tx++, pTile++)
 		{
-			memset(THandle, 0, sizeof(geRDriver_THandle));
+			Tile.left = tx * THandle->TileSize;
+			Tile.right = min(Tile.left + THandle->TileSize, THandle->Width);
+			pw = THandle_PadSize(Tile.right - Tile.left);
 
-			THandle->Active = GE_TRUE;
+			if (Full)
+			{
+				dest = TexUpload_Alloc(pw * ph * 4);
 
-			return THandle;
+				if (!dest)
+				{
+					*pSent = GE_FALSE;
+					continue;
+				}
+
+				memset(dest, 0, pw * ph * 4);
+				THandle_Convert2D(dest, pw, THandle, &Tile);
+
+				GLState_BindTexture(GL_TEXTURE_2D, *pTile);
+
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pw, ph, 0, GL_RGBA, GL_UNSIGNED_BYTE, TexUpload_Source(dest));
+				TexUpload_Free(dest);
+
+				Bytes += pw * ph * 4;
+				continue;
+			}
+
+			Rect.left = max(Tile.left, pDirty->left);
+			Rect.top = max(Tile.top, pDirty->top);
+			Rect.right = min(Tile.right, pDirty->right);
+			Rect.bottom = min(Tile.bottom, pDirty->bottom);
+
+			if (Rect.right <= Rect.left || Rect.bottom <= Rect.top)
+				continue;
+
+			dest = TexUpload_Alloc((Rect.right - Rect.left) * (Rect.bottom - Rect.top) * 4);
+
+			if (!dest)
+			{
+				*pSent = GE_FALSE;
+				continue;
+			}
+
+			THandle_Convert2D(dest, Rect.right - Rect.left, THandle, &Rect);
+
+			GLState_BindTexture(GL_TEXTURE_2D, *pTile);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, Rect.left - Tile.left, Rect.top - Tile.top, Rect.right - Rect.left,
+				Rect.bottom - Rect.top, GL_RGBA, GL_UNSIGNED_BYTE, TexUpload_Source(dest));
+			TexUpload_Free(dest);
+
+			Bytes += (Rect.right - Rect.left) * (Rect.bottom - Rect.top) * 4;
 		}
 	}
 
-	return NULL;
+	return Bytes;
 }
 
 
@@ -73,12 +548,29 @@ geBoolean DRIVERCC THandle_Destroy(geRDriver_THandle *THandle)
 		return	GE_FALSE;
 	}
 
-	if(boundTexture == THandle->TextureID)
-		boundTexture = -1;
-	else if(boundTexture2 == THandle->TextureID)
-		boundTexture2 = -1;
+	if(THandle->Flags & THANDLE_ATLAS)
+		Atlas_Free(&LightmapAtlas, THandle->TextureID);
+	else if(THandle->Flags & THANDLE_DECAL)
+		Atlas_Free(&DecalAtlas, THandle->TextureID);
+	else if(THandle->Flags & THANDLE_ARRAY)
+		TexArray_Free(THandle->TextureID, THandle->Layer);
+	else if(THandle->Flags & THANDLE_TILED)
+	{
+		glDeleteTextures(THandle->TilesX * THandle->TilesY, THandle->Tiles);
+
+		for(i = 0; i < THandle->TilesX * THandle->TilesY; i++)
+			GLState_TextureDeleted(THandle->Tiles[i]);
+
+		free(THandle->Tiles);
+	}
+	else
+	{
+		glDeleteTextures(1, &(THandle->TextureID));
+		GLState_TextureDeleted(THandle->TextureID);
+	}
 
-	glDeleteTextures(1, &(THandle->TextureID));
+	if(THandle->Shadow)
+		free(THandle->Shadow);
 
 	for(i = 0; i < THANDLE_MAX_MIP_LEVELS; i++)
 	{
@@ -89,7 +581,7 @@ geBoolean DRIVERCC THandle_Destroy(geRDriver_THandle *THandle)
 		}
 	}
 
-	memset(THandle, 0, sizeof(geRDriver_THandle));	
+	ReleaseTextureHandle(THandle);
 
 	return	GE_TRUE;
 }
@@ -98,26 +590,8 @@ geBoolean DRIVERCC THandle_Destroy(geRDriver_THandle *THandle)
 // Cleanup all currently in-use texture handles
 geBoolean FreeAllTextureHandles(void)
 {
-	int32				i;
-	geRDriver_THandle	*pTHandle;
-
-	pTHandle = TextureHandles;
-
-
-	for(i = 0; i < MAX_TEXTURE_HANDLES; i++, pTHandle++)
-	{
-		if(!pTHandle->Active)
-		{
-			continue;
-		}
-		
-		THandle_Destroy(pTHandle);
-	}
-
-	glDeleteTextures(1, (const GLuint*)&decalTexObj);
-	decalTexObj = -1;
-	boundTexture = -1;
-	boundTexture2 = -1;
+	while(gHandles.ActiveList)
+		THandle_Destroy(gHandles.ActiveList);
 
 	return GE_TRUE;
 }
@@ -171,18 +645,43 @@ geRDriver_THandle *DRIVERCC THandle_Create(int32 Width, int32 Height, int32 NumM
 	
 	if(THandle->PixelFormat.Flags & RDRIVER_PF_2D)
 	{
-		THandle->PaddedWidth = SnapToPower2(THandle->Width);
-		THandle->PaddedHeight = SnapToPower2(THandle->Height);
+		THandle->PaddedWidth = THandle_PadSize(THandle->Width);
+		THandle->PaddedHeight = THandle_PadSize(THandle->Height);
+
+		if(Width > maxTextureSize || Height > maxTextureSize)
+		{
+			if(!THandle_CreateTiles(THandle))
+			{
+				SetLastDrvError(DRV_ERROR_GENERIC, "OGL_THandleCreate: Out of memory for texture tiles.");
+				gllog("ERROR:  OGL_THandleCreate: Out of memory for texture tiles.\n");
+				goto ExitWithError;
+			}
+
+			return THandle;
+		}
+
+		if(THandle_AtlasDecal(THandle))
+			return THandle;
 	}
 	else if(THandle->PixelFormat.Flags & RDRIVER_PF_3D)
 	{
 		THandle->InvScale = 1.0f / (GLfloat)((1<<Log));
+
+		if(bCanDoTextureArrays && THandle->PixelFormat.PixelFormat == GE_PIXELFORMAT_32BIT_ABGR &&
+			TexArray_Alloc(Width, Height, &THandle->TextureID, &THandle->Layer))
+		{
+			THandle->Flags |= THANDLE_ARRAY;
+			return THandle;
+		}
 	}
 	else
 	{
 		// Must be a lightmap
 		THandle->Flags |= THANDLE_UPDATE_LM;
 		THandle->InvScale = 1.0f / (GLfloat)((1<<Log)<<4);	
+
+		if(THandle_AtlasLightmap(THandle))
+			return THandle;
 	}
 
 	// Init an OpenGL texture object to hold this texture
@@ -192,6 +691,9 @@ geRDriver_THandle *DRIVERCC THandle_Create(int32 Width, int32 Height, int32 NumM
 		
 	ExitWithError:
 	{
+		if (THandle)
+			ReleaseTextureHandle(THandle);
+
 		return NULL;
 	}
 }
@@ -233,7 +735,7 @@ geBoolean DRIVERCC THandle_Lock(geRDriver_THandle *THandle, int32 MipLevel, void
 	// If we've already got data in system mem, return it to the engine as-is
 	if(THandle->Data[MipLevel] != NULL)
 	{
-		THandle->Flags |= (THANDLE_LOCKED << MipLevel);
+		THandle->LockedMips |= (1 << MipLevel);
 		*Data = THandle->Data[MipLevel] ;
 		return GE_TRUE;
 	}
@@ -243,16 +745,8 @@ geBoolean DRIVERCC THandle_Lock(geRDriver_THandle *THandle, int32 MipLevel, void
 	{
 		GLint mipWidth, mipHeight;
 
-		if(MipLevel == 0)
-		{
-			mipWidth = THandle->Width;
-			mipHeight = THandle->Height;
-		}
-		else
-		{
-			mipWidth =  (THandle->Width / (int)pow(2.0, (double)MipLevel));
-			mipHeight = (THandle->Height / (int)pow(2.0, (double)MipLevel));
-		}
+		mipWidth = max(1, THandle->Width >> MipLevel);
+		mipHeight = max(1, THandle->Height >> MipLevel);
 
 		THandle->Data[MipLevel] = (GLubyte *)malloc(mipWidth * mipHeight * 4);
 	}
@@ -267,19 +761,76 @@ geBoolean DRIVERCC THandle_Lock(geRDriver_THandle *THandle, int32 MipLevel, void
 	}
 
 
-	THandle->Flags |= (THANDLE_LOCKED << MipLevel);
+	THandle->LockedMips |= (1 << MipLevel);
 	*Data = THandle->Data[MipLevel];
 
 	return GE_TRUE;
 }
 
 
+// Fill ppLevels with the levels of THandle the engine has written since its last upload,
+// NULL for the ones it has not, and return how many there are.  Level 0 is always the
+// texture itself.
+static int32 THandle_EngineLevels(geRDriver_THandle *THandle, const GLubyte **ppLevels)
+{
+	int32 i;
+
+	ppLevels[0] = THandle->Data[0];
+
+	for(i = 1; i < THandle->MipLevels && i < THANDLE_MAX_MIP_LEVELS; i++)
+	{
+		if((THandle->EngineMips & (1 << i)) && (THandle->Width >> i) && (THandle->Height >> i))
+			ppLevels[i] = THandle->Data[i];
+		else
+			ppLevels[i] = NULL;
+	}
+
+	THandle->EngineMips = 0;
+
+	return i;
+}
+
+
+// Whether an unlocked texture can be sent now, from the staging ring, instead of when the
+// first draw that needs it flushes.  Lightmaps are unlocked from inside the flushes and
+// always wait; the rest go early until the frame's UploadBudget is spent.
+static geBoolean THandle_CanUploadEarly(const geRDriver_THandle *THandle)
+{
+	if(!TexUpload_Staged() || !RenderingIsOK)
+		return GE_FALSE;
+
+	if(!(THandle->PixelFormat.Flags & RDRIVER_PF_2D) && !(THandle->Flags & THANDLE_ARRAY))
+		return GE_FALSE;
+
+	return (FrameStats.TextureBytes + FrameStats.LightmapBytes < (uint32)iUploadBudget << 10) ? GE_TRUE : GE_FALSE;
+}
+
+
+// Flag RGBA textures with any alpha in them (THANDLE_TRANS), so PCache blends them in
+// the translucent passes
+static void THandle_CheckAlpha(geRDriver_THandle *THandle)
+{
+	const GLubyte *pAlpha = THandle->Data[0] + 3;
+
+	THandle->Flags &= ~THANDLE_TRANS;
+
+	for(int32 i = THandle->Width * THandle->Height; i > 0; i--, pAlpha += 4)
+	{
+		if(*pAlpha != 255)
+		{
+			THandle->Flags |= THANDLE_TRANS;
+			return;
+		}
+	}
+}
+
+
 // Unlocks a texture locked for editing, and sets the texture to be uploaded next time
 // it needs to be visible.
 geBoolean DRIVERCC THandle_UnLock(geRDriver_THandle *THandle, int32 MipLevel)
 {
 
-	if(!(THandle->Flags & (THANDLE_LOCKED << MipLevel)))
+	if(!(THandle->LockedMips & (1 << MipLevel)))
 	{
 		return GE_FALSE;
 	}
@@ -289,114 +840,280 @@ geBoolean DRIVERCC THandle_UnLock(geRDriver_THandle *THandle, int32 MipLevel)
 		return GE_FALSE;
 	}
 
-	THandle->Flags	&=~(THANDLE_LOCKED << MipLevel);	
+	THandle->LockedMips &= ~(1 << MipLevel);
+
+	// Flagged here rather than at upload, so polys inserted before the texture goes up
+	// already land in the right pass
+	if(MipLevel == 0 && THandle->PixelFormat.PixelFormat == GE_PIXELFORMAT_32BIT_ABGR && THandle->Data[0])
+		THandle_CheckAlpha(THandle);
+
+	// Whatever levels the engine writes go up as they are, the rest are generated from
+	// the level above.  The engine unlocks a chain top down, so the upload waits for the
+	// last level before going early.
+	THandle->EngineMips |= (1 << MipLevel);
+	THandle->Flags	|= THANDLE_UPDATE;
 
-	// Don't update on mips other than level 0.  We ignore the engine-created mips.
-	// Somewhat inefficient (since mips will be generated twice), but good visual results.
-	// Would be nice if you could tell the engine not to bother with mipping
-	if(MipLevel == 0)
-	{	
-		THandle->Flags	|= THANDLE_UPDATE;					
+	if(MipLevel + 1 >= THandle->MipLevels)
+	{
+		if(THandle_CanUploadEarly(THandle))
+		{
+			GLState_BindTexture(THANDLE_TARGET(THandle), THandle->TextureID);
+			THandle_Update(THandle);
+		}
 	}
 	
 	return GE_TRUE;
 }
 
 
+// Upload what changed in a 2D texture to the (bound) texture, atlas page rect or tiles.
+// The first upload creates the texture.  The shadow only takes what GL was given, and a
+// texture that could not be sent stays THANDLE_UPDATE.  Returns the bytes sent.
+static uint32 THandle_Update2D(geRDriver_THandle *THandle)
+{
+	geBoolean Full = (THandle->Shadow == NULL);
+	geBoolean Sent = GE_TRUE;
+	RECT Dirty;
+	GLubyte *dest;
+	int32 w, h, x, y;
+	uint32 Bytes;
+
+	if(THandle->PixelFormat.PixelFormat != GE_PIXELFORMAT_24BIT_RGB || !THandle->Data[0])
+		return 0;
+
+	if(!THandle_DirtyRect(THandle, &Dirty))
+		return 0;
+
+	if(THandle->Flags & THANDLE_TILED)
+	{
+		Bytes = THandle_UpdateTiles(THandle, &Dirty, Full, &Sent);
+	}
+	else if(Full && !(THandle->Flags & THANDLE_DECAL))
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+	
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_PRIORITY, 0.5f);
+
+		Bytes = THandle->PaddedWidth * THandle->PaddedHeight * 4;
+		dest = TexUpload_Alloc(Bytes);
+
+		if(dest)
+		{
+			CkBlit24_32(dest, THandle->PaddedWidth, THandle->PaddedHeight, THandle->Data[0], 
+				THandle->Width, THandle->Height);
+
+			glTexImage2D(GL_TEXTURE_2D, 0, 4, THandle->PaddedWidth, THandle->PaddedHeight, 
+				0, GL_RGBA, GL_UNSIGNED_BYTE, TexUpload_Source(dest)); 
+
+			TexUpload_Free(dest);
+		}
+		else
+			Sent = GE_FALSE;
+	}
+	else
+	{
+		// Only the changed rect, colour key turned into alpha
+		w = Dirty.right - Dirty.left;
+		h = Dirty.bottom - Dirty.top;
+		x = Dirty.left;
+		y = Dirty.top;
+
+		if(THandle->Flags & THANDLE_DECAL)
+		{
+			x += THandle->AtlasX;
+			y += THandle->AtlasY;
+		}
+
+		Bytes = w * h * 4;
+		dest = TexUpload_Alloc(Bytes);
+
+		if(dest)
+		{
+			THandle_Convert2D(dest, w, THandle, &Dirty);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, TexUpload_Source(dest));
+
+			TexUpload_Free(dest);
+		}
+		else
+			Sent = GE_FALSE;
+	}
+
+	if(!Sent)
+	{
+		// Try the lot again next time it is needed
+		THandle->Flags |= THANDLE_UPDATE;
+		return 0;
+	}
+
+	THandle_SaveShadow(THandle, &Dirty);
+	return Bytes;
+}
+
+
 // Do an actual card upload (well, at least tell the OpenGL driver you'd like one when it 
 // gets a chance) of a texture.  Called from the Render_* functions when they require
 // use of a texture that is marked for updating (THANDLE_UPDATE)
 void THandle_Update(geRDriver_THandle *THandle)
 {		
-	if(THandle->PixelFormat.Flags & RDRIVER_PF_2D)
-	{
-		if(THandle->PixelFormat.PixelFormat == GE_PIXELFORMAT_24BIT_RGB)
-		{
-			if(THandle->Width <= maxTextureSize && THandle->Height <= maxTextureSize)
-			{
-				GLubyte *dest;
-
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-			
-				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_PRIORITY, 0.5f);
+	uint32 Bytes = 0;
 
-				dest = (GLubyte*)malloc(THandle->PaddedWidth * THandle->PaddedHeight * 4);
+	FrameStats.TextureUpdates++;
 
-				CkBlit24_32(dest, THandle->PaddedWidth, THandle->PaddedHeight, THandle->Data[0], 
-					THandle->Width, THandle->Height);
+	// Cleared first, so an upload that could not be made can ask to be retried
+	THandle->Flags &= ~THANDLE_UPDATE;
 
-				glTexImage2D(GL_TEXTURE_2D, 0, 4, THandle->PaddedWidth, THandle->PaddedHeight, 
-					0, GL_RGBA, GL_UNSIGNED_BYTE, dest); 
+	if(THandle->Flags & THANDLE_ATLAS)
+	{
+		// Only this lightmap's rect of the (bound) page, gutter included
+		glTexSubImage2D(GL_TEXTURE_2D, 0, THandle->AtlasX - THANDLE_ATLAS_GUTTER, THandle->AtlasY - THANDLE_ATLAS_GUTTER,
+			THandle->PaddedWidth, THandle->PaddedHeight, GL_RGB, GL_UNSIGNED_BYTE,
+			TexUpload_Copy(THandle->Data[0], THandle->PaddedWidth * THandle->PaddedHeight * 3));
+		TexUpload_Done();
 
-				free(dest);
-			}
-			else
-			{
-				if(THandle->Data[1] != NULL)
-				{
-					free(THandle->Data[1]);
-				}
+		Bytes = THandle->PaddedWidth * THandle->PaddedHeight * 3;
+	}
+	else if(THandle->Flags & THANDLE_ARRAY)
+	{
+		// Only this texture's layer of the (bound) array, with its own mips
+		const GLubyte *pLevels[THANDLE_MAX_MIP_LEVELS];
 
-				THandle->Data[1] = (GLubyte*)malloc(THandle->Width * THandle->Height * 4);
+		TexArray_Upload(THandle->Width, THandle->Height, THandle->Layer, pLevels,
+			THandle_EngineLevels(THandle, pLevels));
 
-				CkBlit24_32(THandle->Data[1], THandle->Width, THandle->Height, THandle->Data[0],
-					THandle->Width, THandle->Height);
-			}
-		}
+		Bytes = THandle->Width * THandle->Height * 4;
+		Bytes += Bytes / 3;
+	}
+	else if(THandle->PixelFormat.Flags & RDRIVER_PF_2D)
+	{
+		Bytes = THandle_Update2D(THandle);
 	}
 	else
 	{
+		GLenum Format = (THandle->PixelFormat.PixelFormat == GE_PIXELFORMAT_32BIT_ABGR) ? GL_RGBA : GL_RGB;
+		geBoolean Lightmap = (THandle->PixelFormat.Flags & RDRIVER_PF_3D) ? GE_FALSE : GE_TRUE;
+		geBoolean Allocate = (THandle->Flags & THANDLE_STORAGE) ? GE_FALSE : GE_TRUE;
+		geBoolean Rescale = (THandle_PadSize(THandle->Width) != THandle->Width ||
+			THandle_PadSize(THandle->Height) != THandle->Height) ? GE_TRUE : GE_FALSE;
+
+		// Parameters stay with the texture, so they only need setting when it is made
+		if(Allocate || Rescale)
+		{
+			if(Lightmap)
+			{
+				// Lightmaps are stretched over faces, never minified, so they get no mips
+#ifdef USE_LINEAR_INTERPOLATION 
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+#else
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+#endif
+			}
+			else
+			{
 #ifdef USE_LINEAR_INTERPOLATION 
  #ifdef TRILINEAR_INTERPOLATION
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
  #else 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
  #endif
 #else
  #ifdef TRILINEAR_INTERPOLATION
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
  #else
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
  #endif
 #endif 
+			}
+
+			if(Format == GL_RGBA)
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_PRIORITY, 1.0f);
+			}
+			else
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_PRIORITY, 0.0f);
+			}
 
-		if(THandle->PixelFormat.PixelFormat == GE_PIXELFORMAT_32BIT_ABGR)
+			if (bUseAnisotropicFiltering && !Lightmap)
+			{
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
+			}
+		}
+
+		if(Rescale)
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_PRIORITY, 1.0f);
-			
-			gluBuild2DMipmaps(GL_TEXTURE_2D, 4, THandle->Width, THandle->Height, GL_RGBA,
-				GL_UNSIGNED_BYTE, THandle->Data[0]);
+			// Only cards without NPOT textures get here.  GLU scales the image up to
+			// powers of two, which the UVs expect.
+			gluBuild2DMipmaps(GL_TEXTURE_2D, (Format == GL_RGBA) ? 4 : 3, THandle->Width, THandle->Height,
+				Format, GL_UNSIGNED_BYTE, THandle->Data[0]);
+
+			Bytes = THandle->Width * THandle->Height * ((Format == GL_RGBA) ? 4 : 3);
+			Bytes += Bytes / 3;
 		}
+		else if(Lightmap)
+			Bytes = MipGen_UploadBase(THandle->Data[0], THandle->Width, THandle->Height, Format, Allocate);
 		else
 		{
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-			
-			glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_PRIORITY, 0.0f);
-			
-			gluBuild2DMipmaps(GL_TEXTURE_2D, 3, THandle->Width, THandle->Height, 
-				GL_RGB, GL_UNSIGNED_BYTE, THandle->Data[0]);
+			const GLubyte *pLevels[THANDLE_MAX_MIP_LEVELS];
+
+			Bytes = MipGen_Upload(pLevels, THandle_EngineLevels(THandle, pLevels), THandle->Width, THandle->Height,
+				Format, Allocate);
 		}
 
-		if (bUseAnisotropicFiltering)
+		if(!Rescale)
+			THandle->Flags |= THANDLE_STORAGE;
+	}
+
+	if((THandle->Flags & THANDLE_ATLAS) || (THandle->PixelFormat.Flags & RDRIVER_PF_LIGHTMAP))
+		FrameStats.LightmapBytes += Bytes;
+	else
+		FrameStats.TextureBytes += Bytes;
+}
+
+
+// Copy the engine's lightmap into Data[0] with its edge texels repeated around it.  The
+// engine data is LInfo->Width texels to the row.
+static void THandle_DownloadAtlasLightmap(DRV_LInfo *LInfo)
+{
+	geRDriver_THandle *THandle = LInfo->THandle;
+	const GLubyte *pSrc = (const GLubyte*)LInfo->RGBLight[0];
+	GLubyte *pDst = THandle->Data[0];
+	int32 Width, Height, x, y, sx, sy;
+
+	Width = min((int32)LInfo->Width, (int32)THandle->Width);
+	Height = min((int32)LInfo->Height, (int32)THandle->Height);
+
+	THandle->PaddedWidth = Width + THANDLE_ATLAS_GUTTER * 2;
+	THandle->PaddedHeight = Height + THANDLE_ATLAS_GUTTER * 2;
+
+	for(y = 0; y < THandle->PaddedHeight; y++)
+	{
+		sy = min(max(y - THANDLE_ATLAS_GUTTER, 0), Height - 1);
+
+		for(x = 0; x < THandle->PaddedWidth; x++, pDst += 3)
 		{
-			glTexParameterf(GL_TEXTURE_2D, GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
-		}
+			sx = min(max(x - THANDLE_ATLAS_GUTTER, 0), Width - 1);
 
+			pDst[0] = pSrc[(sy * LInfo->Width + sx) * 3 + 0];
+			pDst[1] = pSrc[(sy * LInfo->Width + sx) * 3 + 1];
+			pDst[2] = pSrc[(sy * LInfo->Width + sx) * 3 + 2];
+		}
 	}
 
-	THandle->Flags &= ~THANDLE_UPDATE;
+	THandle->Flags |= THANDLE_UPDATE;
 }
 
 
@@ -405,6 +1122,14 @@ void THandle_DownloadLightmap(DRV_LInfo *LInfo)
 {
 	GLubyte *tempBits;
 
+	FrameStats.LightmapDownloads++;
+
+	if(LInfo->THandle->Flags & THANDLE_ATLAS)
+	{
+		THandle_DownloadAtlasLightmap(LInfo);
+		return;
+	}
+
 	THandle_Lock(LInfo->THandle, 0, (void**)&tempBits);
 
 	memcpy(tempBits, LInfo->RGBLight[0], LInfo->THandle->Width * LInfo->THandle->Height * 3);
@@ -483,6 +1208,14 @@ S32 SnapToPower2(S32 Width)
 }
 
 
+// Storage size of a 2D texture dimension: its own size where the card takes NPOT
+// textures, otherwise the next power of two
+S32 THandle_PadSize(S32 Size)
+{
+	return bCanDoNPOT ? Size : SnapToPower2(Size);
+}
+
+
 uint32 Log2(uint32 P2)
 {
 	uint32		p = 0;
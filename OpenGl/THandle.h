@@ -29,14 +29,33 @@
 #include "DCommon.h"
 #include "OglMisc.h"
 
-#define	MAX_TEXTURE_HANDLES			20000
+// Handles come from a table that grows a chunk at a time, so pointers stay put
+#define THANDLE_CHUNK_SIZE			1024
+#define THANDLE_MAX_CHUNKS			256
+
+// HandleBenchmark INI workload
+#define THANDLE_BENCH_HANDLES		16384
+#define THANDLE_BENCH_CHURN			16384
 #define THANDLE_MAX_MIP_LEVELS		16
 
 // THandle flags
 #define THANDLE_UPDATE		(1<<0)		// Force a thandle to be uploaded to the card
 #define	THANDLE_TRANS		(1<<2)		// Texture has transparency
-#define THANDLE_LOCKED		(1<<3)		// THandle is currently locked (invalid for rendering etc)
 #define THANDLE_UPDATE_LM	(1<<4)		// THandle is a lightmap that needs updating
+#define THANDLE_ATLAS		(1<<5)		// Lightmap lives in a rect of a shared atlas page (TextureID)
+#define THANDLE_ARRAY		(1<<6)		// Texture lives in a layer of a shared texture array (TextureID)
+#define THANDLE_DECAL		(1<<7)		// 2D texture lives in a rect of a shared decal atlas page (TextureID)
+#define THANDLE_TILED		(1<<8)		// 2D texture too big for GL, split over a grid of textures (Tiles)
+#define THANDLE_STORAGE		(1<<9)		// Storage for the texture and its mips has been made; updates only replace texels
+
+// Target TextureID binds to
+#define THANDLE_TARGET(t)	(((t)->Flags & THANDLE_ARRAY) ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D)
+
+// Lightmap atlas
+#define THANDLE_ATLAS_PAGES			16
+#define THANDLE_ATLAS_GUTTER		1			// Texels of edge copies around each lightmap
+#define THANDLE_DECAL_PAGES			8
+#define THANDLE_MAX_TILE_SIZE		1024		// Largest tile an oversized 2D texture is split into
 
 typedef struct geRDriver_THandle
 {
@@ -45,13 +64,19 @@ typedef struct geRDriver_THandle
 	GLint					PaddedWidth, PaddedHeight;
 	geRDriver_PixelFormat	PixelFormat;
 	GLuint					Flags;
+	GLuint					LockedMips;				// Levels the engine has locked, a bit each
+	GLuint					EngineMips;				// Levels the engine has written since the last upload
 	GLuint					TextureID;
 	GLubyte					*Data[THANDLE_MAX_MIP_LEVELS];
 	GLfloat					InvScale;
+	GLint					AtlasX, AtlasY;			// Top left texel of an atlas lightmap (inside the gutter) or decal
+	GLint					Layer;					// Texture array layer
+	GLuint					*Tiles;					// Row major TilesX x TilesY textures of a THANDLE_TILED texture
+	GLint					TilesX, TilesY, TileSize;
+	GLubyte					*Shadow;				// 2D texels as last uploaded, diffed to find what changed
+	struct geRDriver_THandle	*Next, *Prev;		// Active list, or the free list (Next only)
 } geRDriver_THandle;
 
-extern	geRDriver_THandle	TextureHandles[MAX_TEXTURE_HANDLES];
-
 geBoolean						FreeAllTextureHandles(void);
 geBoolean			DRIVERCC	DrvResetAll(void);
 geRDriver_THandle	*DRIVERCC	THandle_Create(int32 Width, int32 Height, int32 NumMipLevels, const geRDriver_PixelFormat *PixelFormat);
@@ -65,7 +90,9 @@ void							THandle_DownloadLightmap(DRV_LInfo *LInfo);
 int32 GetLog(int32 Width, int32 Height);
 uint32 Log2(uint32 P2);
 S32 SnapToPower2(S32 Width);
+S32 THandle_PadSize(S32 Size);
 
 geBoolean THandle_Startup(void);
+void THandle_Shutdown(void);
 
 #endif
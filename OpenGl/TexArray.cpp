@@ -0,0 +1,216 @@
+/*
+	@file TexArray.cpp
+
+	@brief Shared 2D texture arrays for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include <stdlib.h>
+#include "TexArray.h"
+#include "OglDrv.h"
+#include "THandle.h"
+#include "GLState.h"
+#include "TexUpload.h"
+#include "MipGen.h"
+
+static TexArray		gArrays[TEXARRAY_MAX_ARRAYS];
+static int32		gNumArrays = 0;
+static int32		gMaxLayers = 0;
+
+static geBoolean TexArray_IsPower2(int32 n)
+{
+	return (n > 0 && (n & (n - 1)) == 0) ? GE_TRUE : GE_FALSE;
+}
+
+geBoolean TexArray_Initialize(void)
+{
+	GLint MaxLayers = 0;
+
+	memset(gArrays, 0, sizeof(gArrays));
+	gNumArrays = 0;
+
+	if (!GLEW_VERSION_3_0)
+		return GE_FALSE;
+
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &MaxLayers);
+	gMaxLayers = min((int32)MaxLayers, min(iTextureArrayLayers, TEXARRAY_MAX_LAYERS));
+
+	return (gMaxLayers > 1) ? GE_TRUE : GE_FALSE;
+}
+
+void TexArray_Shutdown(void)
+{
+	int32 Layers = 0;
+
+	for (int32 i = 0; i < gNumArrays; i++)
+	{
+		Layers += gArrays[i].UsedLayers;
+		glDeleteTextures(1, &gArrays[i].TextureID);
+		GLState_TextureDeleted(gArrays[i].TextureID);
+	}
+
+	if (gNumArrays)
+		gllog("Texture arrays: %d arrays, %d textures still in them", gNumArrays, Layers);
+
+	memset(gArrays, 0, sizeof(gArrays));
+	gNumArrays = 0;
+	gMaxLayers = 0;
+}
+
+static TexArray *TexArray_Create(int32 Width, int32 Height)
+{
+	TexArray *pArray;
+	int32 Level, w, h;
+	GLint Min, Mag;
+
+	if (gNumArrays >= TEXARRAY_MAX_ARRAYS)
+		return NULL;
+
+	pArray = &gArrays[gNumArrays];
+	memset(pArray, 0, sizeof(TexArray));
+
+	pArray->Width = Width;
+	pArray->Height = Height;
+	pArray->MipLevels = GetLog(Width, Height) + 1;
+	pArray->NumLayers = max(1, min(gMaxLayers, TEXARRAY_BYTES / (Width * Height * 4)));
+
+	glGenTextures(1, &pArray->TextureID);
+	GLState_BindTexture(GL_TEXTURE_2D_ARRAY, pArray->TextureID);
+
+	for (Level = 0, w = Width, h = Height; Level < pArray->MipLevels; Level++)
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, Level, GL_RGBA8, w, h, pArray->NumLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		w = max(1, w >> 1);
+		h = max(1, h >> 1);
+	}
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, pArray->MipLevels - 1);
+	GLState_MipFilters(&Min, &Mag);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, Min);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, Mag);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	if (bUseAnisotropicFiltering)
+		glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, fMaxAnisotropy);
+
+	gNumArrays++;
+	return pArray;
+}
+
+geBoolean TexArray_Alloc(int32 Width, int32 Height, GLuint *pTextureID, GLint *pLayer)
+{
+	TexArray *pArray = NULL;
+	int32 i;
+
+	if (!gMaxLayers || !TexArray_IsPower2(Width) || !TexArray_IsPower2(Height) ||
+		Width > TEXARRAY_MAX_SIZE || Height > TEXARRAY_MAX_SIZE)
+		return GE_FALSE;
+
+	for (i = 0; i < gNumArrays; i++)
+	{
+		if (gArrays[i].Width == Width && gArrays[i].Height == Height && gArrays[i].UsedLayers < gArrays[i].NumLayers)
+		{
+			pArray = &gArrays[i];
+			break;
+		}
+	}
+
+	if (!pArray)
+		pArray = TexArray_Create(Width, Height);
+
+	if (!pArray)
+		return GE_FALSE;
+
+	for (i = 0; i < pArray->NumLayers; i++)
+	{
+		if (!pArray->Used[i])
+			break;
+	}
+
+	pArray->Used[i] = 1;
+	pArray->UsedLayers++;
+
+	*pTextureID = pArray->TextureID;
+	*pLayer = i;
+	return GE_TRUE;
+}
+
+void TexArray_Free(GLuint TextureID, GLint Layer)
+{
+	for (int32 i = 0; i < gNumArrays; i++)
+	{
+		if (gArrays[i].TextureID != TextureID)
+			continue;
+
+		if (gArrays[i].Used[Layer])
+		{
+			gArrays[i].Used[Layer] = 0;
+			gArrays[i].UsedLayers--;
+		}
+
+		return;
+	}
+}
+
+void TexArray_Upload(int32 Width, int32 Height, GLint Layer, const GLubyte * const *ppLevels, int32 NumLevels)
+{
+	GLubyte *pMips, *pDst, *pChain, *pStage;
+	const GLubyte *pSrc = ppLevels[0];
+	int32 Level = 0, w = Width, h = Height;
+
+	// Each level is at most half the one above, so the whole chain fits in twice the top's
+	// size.  The staging block is write only, so mips are made in system memory and copied in.
+	pChain = TexUpload_Alloc(Width * Height * 8);
+	pMips = (GLubyte*)malloc(Width * Height * 4);
+
+	if (!pChain || !pMips)
+	{
+		TexUpload_Free(pChain);
+		free(pMips);
+		return;
+	}
+
+	memcpy(pChain, pSrc, w * h * 4);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, Layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, TexUpload_Source(pChain));
+
+	for (pDst = pMips, pStage = pChain + w * h * 4; w > 1 || h > 1; )
+	{
+		Level++;
+
+		if (Level < NumLevels && ppLevels[Level])
+		{
+			w = max(1, w >> 1);
+			h = max(1, h >> 1);
+			pSrc = ppLevels[Level];
+		}
+		else
+		{
+			MipGen_Downsample(pSrc, w, h, 4, pDst);
+
+			w = max(1, w >> 1);
+			h = max(1, h >> 1);
+			pSrc = pDst;
+			pDst += w * h * 4;
+		}
+
+		memcpy(pStage, pSrc, w * h * 4);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, Level, 0, 0, Layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, TexUpload_Source(pStage));
+
+		pStage += w * h * 4;
+	}
+
+	free(pMips);
+	TexUpload_Free(pChain);
+}
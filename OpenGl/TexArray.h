@@ -0,0 +1,51 @@
+/*
+	@file TexArray.h
+
+	@brief Shared 2D texture arrays for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __TEXARRAY_H__
+#define __TEXARRAY_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+#define TEXARRAY_MAX_ARRAYS			64
+#define TEXARRAY_MAX_LAYERS			64				// TextureArrayLayers is clamped to this
+#define TEXARRAY_MAX_SIZE			512				// Larger textures keep their own texture object
+#define TEXARRAY_BYTES				(4 << 20)		// Most one array's top level may take up front
+
+typedef struct TexArray
+{
+	GLuint		TextureID;
+	int32		Width, Height, MipLevels;
+	int32		NumLayers;							// Capacity
+	int32		UsedLayers;
+	uint8		Used[TEXARRAY_MAX_LAYERS];
+} TexArray;
+
+// RGBA arrays with full mip chains, for square or oblong power of two textures
+geBoolean TexArray_Initialize(void);
+void TexArray_Shutdown(void);
+
+// Find a free layer in an array of Width x Height textures, creating the array if needed
+geBoolean TexArray_Alloc(int32 Width, int32 Height, GLuint *pTextureID, GLint *pLayer);
+void TexArray_Free(GLuint TextureID, GLint Layer);
+
+// Upload RGBA texels and their mips into one layer of the array bound to the active unit.
+// ppLevels[0] is the top level; later ones the engine built, or NULL to have them made here.
+void TexArray_Upload(int32 Width, int32 Height, GLint Layer, const GLubyte * const *ppLevels, int32 NumLevels);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+	@file TexUpload.cpp
+
+	@brief Pixel unpack buffer ring for texture uploads for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include <stdlib.h>
+#include "TexUpload.h"
+#include "StreamBuf.h"
+#include "OglDrv.h"
+
+static StreamBuf	gRing;
+static GLubyte		*gpBlock = NULL;			// Outstanding block in the ring
+static uint32		gBlockSize = 0;
+static geBoolean	gBound = GE_FALSE;
+static uint32		gStaged = 0;				// Blocks that went through the ring
+static uint32		gFallbacks = 0;				// Blocks too big for a segment
+
+#define TEXUPLOAD_ALIGN(n)	(((n) + 15) & ~15)
+
+geBoolean TexUpload_Initialize(void)
+{
+	memset(&gRing, 0, sizeof(gRing));
+	gpBlock = NULL;
+	gBound = GE_FALSE;
+	gStaged = 0;
+	gFallbacks = 0;
+
+	if (!bUsePersistentBuffers || !StreamBuf_Supported())
+		return GE_FALSE;
+
+	if (!StreamBuf_Create(&gRing, GL_PIXEL_UNPACK_BUFFER, TEXUPLOAD_SEGMENT_SIZE))
+		return GE_FALSE;
+
+	gllog("Staging texture uploads through a %u KB pixel buffer ring...", (TEXUPLOAD_SEGMENT_SIZE * STREAMBUF_SEGMENTS) >> 10);
+	return GE_TRUE;
+}
+
+void TexUpload_Shutdown(void)
+{
+	if (!gRing.BufferID)
+		return;
+
+	gllog("Texture uploads: %u staged, %u too big to stage, %u waits on the GPU", gStaged, gFallbacks, gRing.Waits);
+	StreamBuf_Destroy(&gRing);
+}
+
+geBoolean TexUpload_Staged(void)
+{
+	return gRing.BufferID ? GE_TRUE : GE_FALSE;
+}
+
+// Ring memory for Size bytes, or NULL if it never fits
+static GLubyte *TexUpload_RingAlloc(uint32 Size)
+{
+	if (!gRing.BufferID || gpBlock)
+		return NULL;
+
+	// Blocks start 16 byte aligned, whatever the texel size before them
+	Size = TEXUPLOAD_ALIGN(Size);
+
+	if (Size > gRing.SegmentSize)
+	{
+		gFallbacks++;
+		return NULL;
+	}
+
+	if (Size > StreamBuf_Room(&gRing))
+		StreamBuf_NextSegment(&gRing);
+
+	gpBlock = (GLubyte*)StreamBuf_Pointer(&gRing);
+	gBlockSize = Size;
+	gStaged++;
+	return gpBlock;
+}
+
+GLubyte *TexUpload_Alloc(uint32 Size)
+{
+	GLubyte *p = TexUpload_RingAlloc(Size);
+
+	return p ? p : (GLubyte*)malloc(Size);
+}
+
+const GLvoid *TexUpload_Source(const GLubyte *p)
+{
+	if (!gpBlock || p < gpBlock || p >= gpBlock + gBlockSize)
+		return p;
+
+	if (!gBound)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gRing.BufferID);
+		gBound = GE_TRUE;
+	}
+
+	return (const GLvoid*)(size_t)(p - gRing.pBase);
+}
+
+void TexUpload_Free(GLubyte *pBlock)
+{
+	if (!pBlock)
+		return;
+
+	if (pBlock != gpBlock)
+	{
+		free(pBlock);
+		return;
+	}
+
+	if (gBound)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		gBound = GE_FALSE;
+	}
+
+	StreamBuf_Commit(&gRing, gBlockSize);
+	gpBlock = NULL;
+}
+
+const GLvoid *TexUpload_Copy(const GLubyte *pData, uint32 Size)
+{
+	GLubyte *p = TexUpload_RingAlloc(Size);
+
+	if (!p)
+		return pData;
+
+	memcpy(p, pData, Size);
+	return TexUpload_Source(p);
+}
+
+void TexUpload_Done(void)
+{
+	TexUpload_Free(gpBlock);
+}
+
+void TexUpload_EndFrame(void)
+{
+	if (gRing.BufferID)
+		StreamBuf_EndFrame(&gRing);
+}
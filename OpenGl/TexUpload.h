@@ -0,0 +1,55 @@
+/*
+	@file TexUpload.h
+
+	@brief Pixel unpack buffer ring for texture uploads for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __TEXUPLOAD_H__
+#define __TEXUPLOAD_H__
+
+#define GLEW_STATIC
+#include "./glew/include/GL/glew.h"
+#include "dcommon.h"
+
+#define TEXUPLOAD_SEGMENT_SIZE		(4 << 20)		// Bytes of texels staged per frame in flight
+
+// Texel data is converted straight into a persistently mapped GL_PIXEL_UNPACK_BUFFER ring,
+// so glTex*Image returns without copying and the transfer overlaps the draws.  Without
+// buffer storage everything falls back to malloc'd client memory.
+geBoolean TexUpload_Initialize(void);
+void TexUpload_Shutdown(void);
+
+// GE_TRUE if uploads are staged through the ring
+geBoolean TexUpload_Staged(void);
+
+// Room for Size bytes of texels, in the ring if they fit and otherwise malloc'd.  Only one
+// block may be outstanding at a time.
+GLubyte *TexUpload_Alloc(uint32 Size);
+
+// What to pass glTex*Image for texels at p inside a block: an offset into the bound unpack
+// buffer, or p itself
+const GLvoid *TexUpload_Source(const GLubyte *p);
+
+// Done with a block once the GL calls reading it are made
+void TexUpload_Free(GLubyte *pBlock);
+
+// Stage a copy of Size bytes already in system memory.  Returns what to pass glTex*Image;
+// pData itself when it is not staged.  Follow the GL call with TexUpload_Done.
+const GLvoid *TexUpload_Copy(const GLubyte *pData, uint32 Size);
+void TexUpload_Done(void);
+
+// Once a frame, fences what the frame staged
+void TexUpload_EndFrame(void);
+
+#endif
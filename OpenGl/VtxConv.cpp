@@ -0,0 +1,587 @@
+/*
+	@file VtxConv.cpp
+
+	@brief Vertex conversion kernels for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#include <Windows.h>
+#include <stdlib.h>
+#include <math.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#include "VtxConv.h"
+#include "CpuInfo.h"
+
+extern void gllog(const char *fmt, ...);
+
+// MSVC accepts AVX2 intrinsics anywhere.  GCC and clang need the function marked.
+#ifdef _MSC_VER
+#define VTXCONV_AVX2_FUNC
+#else
+#define VTXCONV_AVX2_FUNC			__attribute__((target("avx2")))
+#endif
+
+#define VTXCONV_BENCH_VERTS			4096
+#define VTXCONV_BENCH_PASSES		64
+#define VTXCONV_BENCH_MAX_ERROR		1.0e-4f		// Relative, rcpps plus a Newton step is well inside this
+
+VTXCONV_WORLD		*VtxConv_World = NULL;
+VTXCONV_MISC		*VtxConv_Misc = NULL;
+
+static int32		gLevel = VTXCONV_SCALAR;
+
+uint8 VtxConv_ToByte(float f)
+{
+	if (f <= 0.0f)
+		return 0;
+
+	if (f >= 255.0f)
+		return 255;
+
+	// cvtss2si rounds halves to even, the same as cvtps2dq in the kernels
+	return (uint8)_mm_cvtss_si32(_mm_set_ss(f));
+}
+
+//============================================================================================
+//	Scalar kernels.  Used for the last few verts of a run by the SIMD kernels too.
+//============================================================================================
+static float VtxConv_WorldScalar(const DRV_TLVertex *pIn, WorldVertex *pOut, int32 NumVerts, const VtxConv_WorldParams *pParams)
+{
+	float zRecip, zRecipSum = 0.0f;
+
+	for (int32 i = 0; i < NumVerts; i++, pIn++, pOut++)
+	{
+		zRecip = 1.0f / pIn->z;
+		zRecipSum += zRecip;
+
+		pOut->lu = (pIn->u - pParams->LShiftU) * pParams->LScale * zRecip;
+		pOut->lv = (pIn->v - pParams->LShiftV) * pParams->LScale * zRecip;
+
+		pOut->x = pIn->x;
+		pOut->q = zRecip;
+		pOut->y = pIn->y;
+
+		pOut->u = (pIn->u * pParams->ScaleU + pParams->ShiftU) * zRecip;
+		pOut->v = (pIn->v * pParams->ScaleV + pParams->ShiftV) * zRecip;
+
+		pOut->r = VtxConv_ToByte(pIn->r);
+		pOut->g = VtxConv_ToByte(pIn->g);
+		pOut->b = VtxConv_ToByte(pIn->b);
+		pOut->a = pParams->Alpha;
+	}
+
+	return zRecipSum;
+}
+
+static float VtxConv_MiscScalar(const DRV_TLVertex *pIn, MiscVertex *pOut, int32 NumVerts, uint8 Alpha)
+{
+	float zRecip, zRecipSum = 0.0f;
+
+	for (int32 i = 0; i < NumVerts; i++, pIn++, pOut++)
+	{
+		zRecip = 1.0f / pIn->z;
+		zRecipSum += zRecip;
+
+		pOut->x = pIn->x;
+		pOut->q = zRecip;
+		pOut->y = pIn->y;
+
+		pOut->u = pIn->u * zRecip;
+		pOut->v = pIn->v * zRecip;
+
+		pOut->r = VtxConv_ToByte(pIn->r);
+		pOut->g = VtxConv_ToByte(pIn->g);
+		pOut->b = VtxConv_ToByte(pIn->b);
+		pOut->a = Alpha;
+	}
+
+	return zRecipSum;
+}
+
+//============================================================================================
+//	SSE2 kernels, four verts at a time.
+//
+//	Fields are gathered into one register per field, worked on side by side, then
+//	transposed back four dwords at a time so each row is part of one output vertex.
+//============================================================================================
+#define VTXCONV_LOAD4(p, f)			_mm_setr_ps((p)[0].f, (p)[1].f, (p)[2].f, (p)[3].f)
+
+// rcpps is good to 12 bits, one Newton step brings it to about 23
+static __inline __m128 VtxConv_Rcp4(__m128 z)
+{
+	__m128 r = _mm_rcp_ps(z);
+
+	return _mm_sub_ps(_mm_add_ps(r, r), _mm_mul_ps(z, _mm_mul_ps(r, r)));
+}
+
+// Round, saturate and interleave to one RGBA dword per vertex
+static __inline __m128 VtxConv_Color4(__m128 r, __m128 g, __m128 b, __m128i a)
+{
+	__m128i rg = _mm_packs_epi32(_mm_cvtps_epi32(r), _mm_cvtps_epi32(g));
+	__m128i ba = _mm_packs_epi32(_mm_cvtps_epi32(b), a);
+	__m128i planes = _mm_packus_epi16(rg, ba);					// rrrr gggg bbbb aaaa
+
+	__m128i lo = _mm_unpacklo_epi8(planes, _mm_srli_si128(planes, 4));					// rg rg rg rg
+	__m128i hi = _mm_unpacklo_epi8(_mm_srli_si128(planes, 8), _mm_srli_si128(planes, 12));	// ba ba ba ba
+
+	return _mm_castsi128_ps(_mm_unpacklo_epi16(lo, hi));
+}
+
+static __inline float VtxConv_Sum4(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+
+	return _mm_cvtss_f32(v);
+}
+
+static float VtxConv_WorldSSE2(const DRV_TLVertex *pIn, WorldVertex *pOut, int32 NumVerts, const VtxConv_WorldParams *pParams)
+{
+	__m128 ScaleU = _mm_set1_ps(pParams->ScaleU), ScaleV = _mm_set1_ps(pParams->ScaleV);
+	__m128 ShiftU = _mm_set1_ps(pParams->ShiftU), ShiftV = _mm_set1_ps(pParams->ShiftV);
+	__m128 LScale = _mm_set1_ps(pParams->LScale);
+	__m128 LShiftU = _mm_set1_ps(pParams->LShiftU), LShiftV = _mm_set1_ps(pParams->LShiftV);
+	__m128i Alpha = _mm_set1_epi32(pParams->Alpha);
+	__m128 zRecipSum = _mm_setzero_ps();
+	int32 i;
+
+	for (i = 0; i + 4 <= NumVerts; i += 4, pIn += 4, pOut += 4)
+	{
+		__m128 u = VTXCONV_LOAD4(pIn, u);
+		__m128 v = VTXCONV_LOAD4(pIn, v);
+		__m128 zr = VtxConv_Rcp4(VTXCONV_LOAD4(pIn, z));
+		float *pDst = &pOut->lu;
+
+		zRecipSum = _mm_add_ps(zRecipSum, zr);
+
+		__m128 q0 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(u, LShiftU), LScale), zr);
+		__m128 q1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(v, LShiftV), LScale), zr);
+		__m128 q2 = VTXCONV_LOAD4(pIn, x);
+		__m128 q3 = zr;
+
+		__m128 q4 = VTXCONV_LOAD4(pIn, y);
+		__m128 q5 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(u, ScaleU), ShiftU), zr);
+		__m128 q6 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(v, ScaleV), ShiftV), zr);
+		__m128 q7 = VtxConv_Color4(VTXCONV_LOAD4(pIn, r), VTXCONV_LOAD4(pIn, g), VTXCONV_LOAD4(pIn, b), Alpha);
+
+		_MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+		_MM_TRANSPOSE4_PS(q4, q5, q6, q7);
+
+		// WorldVertex is 8 dwords: lu lv x q, y u v color
+		_mm_storeu_ps(pDst + 0, q0);	_mm_storeu_ps(pDst + 4, q4);
+		_mm_storeu_ps(pDst + 8, q1);	_mm_storeu_ps(pDst + 12, q5);
+		_mm_storeu_ps(pDst + 16, q2);	_mm_storeu_ps(pDst + 20, q6);
+		_mm_storeu_ps(pDst + 24, q3);	_mm_storeu_ps(pDst + 28, q7);
+	}
+
+	return VtxConv_Sum4(zRecipSum) + VtxConv_WorldScalar(pIn, pOut, NumVerts - i, pParams);
+}
+
+static float VtxConv_MiscSSE2(const DRV_TLVertex *pIn, MiscVertex *pOut, int32 NumVerts, uint8 Alpha)
+{
+	__m128i A = _mm_set1_epi32(Alpha);
+	__m128 zRecipSum = _mm_setzero_ps();
+	int32 i;
+
+	for (i = 0; i + 4 <= NumVerts; i += 4, pIn += 4, pOut += 4)
+	{
+		__m128 zr = VtxConv_Rcp4(VTXCONV_LOAD4(pIn, z));
+		float *pDst = &pOut->x;
+
+		zRecipSum = _mm_add_ps(zRecipSum, zr);
+
+		__m128 q0 = VTXCONV_LOAD4(pIn, x);
+		__m128 q1 = zr;
+		__m128 q2 = VTXCONV_LOAD4(pIn, y);
+		__m128 q3 = _mm_mul_ps(VTXCONV_LOAD4(pIn, u), zr);
+
+		__m128 v = _mm_mul_ps(VTXCONV_LOAD4(pIn, v), zr);
+		__m128 c = VtxConv_Color4(VTXCONV_LOAD4(pIn, r), VTXCONV_LOAD4(pIn, g), VTXCONV_LOAD4(pIn, b), A);
+		__m128 vc01 = _mm_unpacklo_ps(v, c);
+		__m128 vc23 = _mm_unpackhi_ps(v, c);
+
+		_MM_TRANSPOSE4_PS(q0, q1, q2, q3);
+
+		// MiscVertex is 6 dwords: x q y u, v color
+		_mm_storeu_ps(pDst + 0, q0);	_mm_storel_pi((__m64*)(pDst + 4), vc01);
+		_mm_storeu_ps(pDst + 6, q1);	_mm_storeh_pi((__m64*)(pDst + 10), vc01);
+		_mm_storeu_ps(pDst + 12, q2);	_mm_storel_pi((__m64*)(pDst + 16), vc23);
+		_mm_storeu_ps(pDst + 18, q3);	_mm_storeh_pi((__m64*)(pDst + 22), vc23);
+	}
+
+	return VtxConv_Sum4(zRecipSum) + VtxConv_MiscScalar(pIn, pOut, NumVerts - i, Alpha);
+}
+
+//============================================================================================
+//	AVX2 kernels, eight verts at a time.
+//
+//	Same as the SSE2 kernels with verts 0-3 in the low lane and 4-7 in the high lane.
+//	Every shuffle used here stays within its lane, so each lane is its own 4x4 transpose.
+//============================================================================================
+#define VTXCONV_GATHER8(p, f, Index)	_mm256_i32gather_ps(&(p)->f, Index, 4)
+
+#define VTXCONV_TRANSPOSE4_256(r0, r1, r2, r3)						\
+{																	\
+	__m256 t0 = _mm256_shuffle_ps((r0), (r1), 0x44);				\
+	__m256 t2 = _mm256_shuffle_ps((r0), (r1), 0xEE);				\
+	__m256 t1 = _mm256_shuffle_ps((r2), (r3), 0x44);				\
+	__m256 t3 = _mm256_shuffle_ps((r2), (r3), 0xEE);				\
+	(r0) = _mm256_shuffle_ps(t0, t1, 0x88);							\
+	(r1) = _mm256_shuffle_ps(t0, t1, 0xDD);							\
+	(r2) = _mm256_shuffle_ps(t2, t3, 0x88);							\
+	(r3) = _mm256_shuffle_ps(t2, t3, 0xDD);							\
+}
+
+// Store lane 0 of a row as vertex n and lane 1 as vertex n + 4
+#define VTXCONV_STORE_ROW(pDst, Stride, n, Offset, Row)											\
+{																								\
+	_mm_storeu_ps((pDst) + (n) * (Stride) + (Offset), _mm256_castps256_ps128(Row));				\
+	_mm_storeu_ps((pDst) + ((n) + 4) * (Stride) + (Offset), _mm256_extractf128_ps(Row, 1));		\
+}
+
+// Store the (v, color) pairs of verts n, n + 1 from lane 0 and n + 4, n + 5 from lane 1
+#define VTXCONV_STORE_PAIRS(pDst, Stride, n, Pairs)													\
+{																									\
+	__m128 Lo = _mm256_castps256_ps128(Pairs), Hi = _mm256_extractf128_ps(Pairs, 1);				\
+	_mm_storel_pi((__m64*)((pDst) + (n) * (Stride) + 4), Lo);										\
+	_mm_storeh_pi((__m64*)((pDst) + ((n) + 1) * (Stride) + 4), Lo);									\
+	_mm_storel_pi((__m64*)((pDst) + ((n) + 4) * (Stride) + 4), Hi);									\
+	_mm_storeh_pi((__m64*)((pDst) + ((n) + 5) * (Stride) + 4), Hi);									\
+}
+
+static VTXCONV_AVX2_FUNC __inline __m256 VtxConv_Rcp8(__m256 z)
+{
+	__m256 r = _mm256_rcp_ps(z);
+
+	return _mm256_sub_ps(_mm256_add_ps(r, r), _mm256_mul_ps(z, _mm256_mul_ps(r, r)));
+}
+
+static VTXCONV_AVX2_FUNC __inline __m256 VtxConv_Color8(__m256 r, __m256 g, __m256 b, __m256i a)
+{
+	__m256i rg = _mm256_packs_epi32(_mm256_cvtps_epi32(r), _mm256_cvtps_epi32(g));
+	__m256i ba = _mm256_packs_epi32(_mm256_cvtps_epi32(b), a);
+	__m256i planes = _mm256_packus_epi16(rg, ba);
+
+	__m256i lo = _mm256_unpacklo_epi8(planes, _mm256_srli_si256(planes, 4));
+	__m256i hi = _mm256_unpacklo_epi8(_mm256_srli_si256(planes, 8), _mm256_srli_si256(planes, 12));
+
+	return _mm256_castsi256_ps(_mm256_unpacklo_epi16(lo, hi));
+}
+
+static VTXCONV_AVX2_FUNC __inline float VtxConv_Sum8(__m256 v)
+{
+	return VtxConv_Sum4(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+static VTXCONV_AVX2_FUNC float VtxConv_WorldAVX2(const DRV_TLVertex *pIn, WorldVertex *pOut, int32 NumVerts, const VtxConv_WorldParams *pParams)
+{
+	__m256i Index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(DRV_TLVertex) / sizeof(float)));
+	__m256 ScaleU = _mm256_set1_ps(pParams->ScaleU), ScaleV = _mm256_set1_ps(pParams->ScaleV);
+	__m256 ShiftU = _mm256_set1_ps(pParams->ShiftU), ShiftV = _mm256_set1_ps(pParams->ShiftV);
+	__m256 LScale = _mm256_set1_ps(pParams->LScale);
+	__m256 LShiftU = _mm256_set1_ps(pParams->LShiftU), LShiftV = _mm256_set1_ps(pParams->LShiftV);
+	__m256i Alpha = _mm256_set1_epi32(pParams->Alpha);
+	__m256 zRecipSum = _mm256_setzero_ps();
+	float Sum;
+	int32 i;
+
+	for (i = 0; i + 8 <= NumVerts; i += 8, pIn += 8, pOut += 8)
+	{
+		__m256 u = VTXCONV_GATHER8(pIn, u, Index);
+		__m256 v = VTXCONV_GATHER8(pIn, v, Index);
+		__m256 zr = VtxConv_Rcp8(VTXCONV_GATHER8(pIn, z, Index));
+		float *pDst = &pOut->lu;
+
+		zRecipSum = _mm256_add_ps(zRecipSum, zr);
+
+		__m256 q0 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(u, LShiftU), LScale), zr);
+		__m256 q1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(v, LShiftV), LScale), zr);
+		__m256 q2 = VTXCONV_GATHER8(pIn, x, Index);
+		__m256 q3 = zr;
+
+		__m256 q4 = VTXCONV_GATHER8(pIn, y, Index);
+		__m256 q5 = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(u, ScaleU), ShiftU), zr);
+		__m256 q6 = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(v, ScaleV), ShiftV), zr);
+		__m256 q7 = VtxConv_Color8(VTXCONV_GATHER8(pIn, r, Index), VTXCONV_GATHER8(pIn, g, Index), VTXCONV_GATHER8(pIn, b, Index), Alpha);
+
+		VTXCONV_TRANSPOSE4_256(q0, q1, q2, q3);
+		VTXCONV_TRANSPOSE4_256(q4, q5, q6, q7);
+
+		VTXCONV_STORE_ROW(pDst, 8, 0, 0, q0);	VTXCONV_STORE_ROW(pDst, 8, 0, 4, q4);
+		VTXCONV_STORE_ROW(pDst, 8, 1, 0, q1);	VTXCONV_STORE_ROW(pDst, 8, 1, 4, q5);
+		VTXCONV_STORE_ROW(pDst, 8, 2, 0, q2);	VTXCONV_STORE_ROW(pDst, 8, 2, 4, q6);
+		VTXCONV_STORE_ROW(pDst, 8, 3, 0, q3);	VTXCONV_STORE_ROW(pDst, 8, 3, 4, q7);
+	}
+
+	Sum = VtxConv_Sum8(zRecipSum);
+
+	// Avoid the AVX to SSE transition penalty in the callers
+	_mm256_zeroupper();
+
+	return Sum + VtxConv_WorldSSE2(pIn, pOut, NumVerts - i, pParams);
+}
+
+static VTXCONV_AVX2_FUNC float VtxConv_MiscAVX2(const DRV_TLVertex *pIn, MiscVertex *pOut, int32 NumVerts, uint8 Alpha)
+{
+	__m256i Index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(DRV_TLVertex) / sizeof(float)));
+	__m256i A = _mm256_set1_epi32(Alpha);
+	__m256 zRecipSum = _mm256_setzero_ps();
+	float Sum;
+	int32 i;
+
+	for (i = 0; i + 8 <= NumVerts; i += 8, pIn += 8, pOut += 8)
+	{
+		__m256 zr = VtxConv_Rcp8(VTXCONV_GATHER8(pIn, z, Index));
+		float *pDst = &pOut->x;
+
+		zRecipSum = _mm256_add_ps(zRecipSum, zr);
+
+		__m256 q0 = VTXCONV_GATHER8(pIn, x, Index);
+		__m256 q1 = zr;
+		__m256 q2 = VTXCONV_GATHER8(pIn, y, Index);
+		__m256 q3 = _mm256_mul_ps(VTXCONV_GATHER8(pIn, u, Index), zr);
+
+		__m256 v = _mm256_mul_ps(VTXCONV_GATHER8(pIn, v, Index), zr);
+		__m256 c = VtxConv_Color8(VTXCONV_GATHER8(pIn, r, Index), VTXCONV_GATHER8(pIn, g, Index), VTXCONV_GATHER8(pIn, b, Index), A);
+		__m256 vc01 = _mm256_unpacklo_ps(v, c);			// v0 c0 v1 c1 | v4 c4 v5 c5
+		__m256 vc23 = _mm256_unpackhi_ps(v, c);			// v2 c2 v3 c3 | v6 c6 v7 c7
+
+		VTXCONV_TRANSPOSE4_256(q0, q1, q2, q3);
+
+		VTXCONV_STORE_ROW(pDst, 6, 0, 0, q0);
+		VTXCONV_STORE_ROW(pDst, 6, 1, 0, q1);
+		VTXCONV_STORE_ROW(pDst, 6, 2, 0, q2);
+		VTXCONV_STORE_ROW(pDst, 6, 3, 0, q3);
+
+		VTXCONV_STORE_PAIRS(pDst, 6, 0, vc01);
+		VTXCONV_STORE_PAIRS(pDst, 6, 2, vc23);
+	}
+
+	Sum = VtxConv_Sum8(zRecipSum);
+
+	_mm256_zeroupper();
+
+	return Sum + VtxConv_MiscSSE2(pIn, pOut, NumVerts - i, Alpha);
+}
+
+//============================================================================================
+//	Dispatch
+//============================================================================================
+// Best kernel level this CPU can run
+static int32 VtxConv_CpuLevel(void)
+{
+	uint32 Features = CpuInfo_Features();
+
+	if (Features & CPUINFO_AVX2)
+		return VTXCONV_AVX2;
+
+	if (Features & CPUINFO_SSE2)
+		return VTXCONV_SSE2;
+
+	return VTXCONV_SCALAR;
+}
+
+static void VtxConv_SetLevel(int32 Level)
+{
+	gLevel = Level;
+
+	switch (Level)
+	{
+		case VTXCONV_AVX2:
+			VtxConv_World = VtxConv_WorldAVX2;
+			VtxConv_Misc = VtxConv_MiscAVX2;
+			break;
+
+		case VTXCONV_SSE2:
+			VtxConv_World = VtxConv_WorldSSE2;
+			VtxConv_Misc = VtxConv_MiscSSE2;
+			break;
+
+		default:
+			VtxConv_World = VtxConv_WorldScalar;
+			VtxConv_Misc = VtxConv_MiscScalar;
+			break;
+	}
+}
+
+void VtxConv_Initialize(int32 MaxLevel)
+{
+	static const char *Names[] = { "scalar", "SSE2", "AVX2" };
+	int32 Level = VtxConv_CpuLevel();
+
+	if (MaxLevel >= VTXCONV_SCALAR && MaxLevel < Level)
+		Level = MaxLevel;
+
+	VtxConv_SetLevel(Level);
+	gllog("Converting vertices with %s kernels...", Names[Level]);
+}
+
+int32 VtxConv_Level(void)
+{
+	return gLevel;
+}
+
+//============================================================================================
+//	Benchmark
+//============================================================================================
+static float VtxConv_Random(float Min, float Max)
+{
+	return Min + (Max - Min) * ((float)rand() / (float)RAND_MAX);
+}
+
+// Largest relative difference of the float fields from the scalar kernels' output, and the
+// number of verts whose packed colour differs.  rcpps makes the floats differ slightly.
+static float VtxConv_Compare(const float *pA, const float *pB, int32 Stride, int32 NumFloats, int32 Count, uint32 *pColors)
+{
+	float Err = 0.0f;
+
+	for (int32 i = 0; i < Count; i++, pA += Stride, pB += Stride)
+	{
+		for (int32 f = 0; f < NumFloats; f++)
+			Err = max(Err, (float)fabs(pA[f] - pB[f]) / max(1.0f, (float)fabs(pB[f])));
+
+		// The colour dword follows the floats
+		if (memcmp(&pA[NumFloats], &pB[NumFloats], 4))
+			(*pColors)++;
+	}
+
+	return Err;
+}
+
+void VtxConv_Benchmark(void)
+{
+	static const char *Names[] = { "scalar", "SSE2", "AVX2" };
+	// Calls of a triangle, an average world poly, one and two AVX2 blocks, and one long run
+	static const int32 RunLengths[] = { 3, 6, 8, 16, VTXCONV_BENCH_VERTS };
+	DRV_TLVertex *pIn;
+	WorldVertex *pWorld, *pWorldRef;
+	MiscVertex *pMisc, *pMiscRef;
+	VtxConv_WorldParams Params;
+	LARGE_INTEGER Freq, Start, End;
+	int32 SavedLevel = gLevel;
+	int32 Level, Run, Count, RunVerts, i, Pass;
+	double WorldNs, MiscNs;
+	float WorldErr, MiscErr;
+	uint32 Colors;
+	geBoolean Broken;
+
+	pIn = (DRV_TLVertex*)malloc(VTXCONV_BENCH_VERTS * sizeof(DRV_TLVertex));
+	pWorld = (WorldVertex*)malloc(VTXCONV_BENCH_VERTS * sizeof(WorldVertex));
+	pWorldRef = (WorldVertex*)malloc(VTXCONV_BENCH_VERTS * sizeof(WorldVertex));
+	pMisc = (MiscVertex*)malloc(VTXCONV_BENCH_VERTS * sizeof(MiscVertex));
+	pMiscRef = (MiscVertex*)malloc(VTXCONV_BENCH_VERTS * sizeof(MiscVertex));
+
+	if (!pIn || !pWorld || !pWorldRef || !pMisc || !pMiscRef)
+	{
+		gllog("WARNING:  Not enough memory for the vertex conversion benchmark");
+		free(pIn); free(pWorld); free(pWorldRef); free(pMisc); free(pMiscRef);
+		return;
+	}
+
+	srand(1);
+
+	// Colours run past both ends of 0..255 so the clamping is checked too
+	for (i = 0; i < VTXCONV_BENCH_VERTS; i++)
+	{
+		pIn[i].x = VtxConv_Random(0.0f, 1024.0f);
+		pIn[i].y = VtxConv_Random(0.0f, 768.0f);
+		pIn[i].z = VtxConv_Random(1.0f, 4096.0f);
+		pIn[i].u = VtxConv_Random(-512.0f, 512.0f);
+		pIn[i].v = VtxConv_Random(-512.0f, 512.0f);
+		pIn[i].r = VtxConv_Random(-16.0f, 272.0f);
+		pIn[i].g = VtxConv_Random(-16.0f, 272.0f);
+		pIn[i].b = VtxConv_Random(-16.0f, 272.0f);
+		pIn[i].a = 255.0f;
+
+		// Exact halves, which random colours almost never hit, check the rounding
+		if (i % 4 == 0)
+		{
+			pIn[i].r = (float)(i / 4 % 256) + 0.5f;
+			pIn[i].g = 2.5f;
+			pIn[i].b = 254.5f;
+		}
+	}
+
+	Params.ScaleU = 0.5f;
+	Params.ScaleV = 0.5f;
+	Params.ShiftU = 16.0f;
+	Params.ShiftV = -16.0f;
+	Params.LScale = 1.0f / 16.0f;
+	Params.LShiftU = -8.0f;
+	Params.LShiftV = -8.0f;
+	Params.Alpha = 0xC0;
+
+	VtxConv_WorldScalar(pIn, pWorldRef, VTXCONV_BENCH_VERTS, &Params);
+	VtxConv_MiscScalar(pIn, pMiscRef, VTXCONV_BENCH_VERTS, 0xC0);
+
+	QueryPerformanceFrequency(&Freq);
+
+	for (Level = VTXCONV_SCALAR; Level <= VtxConv_CpuLevel(); Level++)
+	{
+		VtxConv_SetLevel(Level);
+		Broken = GE_FALSE;
+
+		for (Run = 0; Run < sizeof(RunLengths) / sizeof(RunLengths[0]); Run++)
+		{
+			RunVerts = RunLengths[Run];
+			Count = VTXCONV_BENCH_VERTS - VTXCONV_BENCH_VERTS % RunVerts;
+
+			memset(pWorld, 0, VTXCONV_BENCH_VERTS * sizeof(WorldVertex));
+			memset(pMisc, 0, VTXCONV_BENCH_VERTS * sizeof(MiscVertex));
+
+			QueryPerformanceCounter(&Start);
+			for (Pass = 0; Pass < VTXCONV_BENCH_PASSES; Pass++)
+				for (i = 0; i < Count; i += RunVerts)
+					VtxConv_World(&pIn[i], &pWorld[i], RunVerts, &Params);
+			QueryPerformanceCounter(&End);
+
+			WorldNs = (double)(End.QuadPart - Start.QuadPart) * 1.0e9 / (double)Freq.QuadPart / (double)(VTXCONV_BENCH_PASSES * Count);
+
+			QueryPerformanceCounter(&Start);
+			for (Pass = 0; Pass < VTXCONV_BENCH_PASSES; Pass++)
+				for (i = 0; i < Count; i += RunVerts)
+					VtxConv_Misc(&pIn[i], &pMisc[i], RunVerts, 0xC0);
+			QueryPerformanceCounter(&End);
+
+			MiscNs = (double)(End.QuadPart - Start.QuadPart) * 1.0e9 / (double)Freq.QuadPart / (double)(VTXCONV_BENCH_PASSES * Count);
+
+			Colors = 0;
+			WorldErr = VtxConv_Compare(&pWorld[0].lu, &pWorldRef[0].lu, sizeof(WorldVertex) / sizeof(float), 7, Count, &Colors);
+			MiscErr = VtxConv_Compare(&pMisc[0].x, &pMiscRef[0].x, sizeof(MiscVertex) / sizeof(float), 5, Count, &Colors);
+
+			if (WorldErr > VTXCONV_BENCH_MAX_ERROR || MiscErr > VTXCONV_BENCH_MAX_ERROR || Colors)
+				Broken = GE_TRUE;
+
+			gllog("Vertex conversion (%s, %d vertex runs):  world %.2f ns/vertex, misc %.2f ns/vertex (max error %g / %g, %u colours differ)",
+				Names[Level], RunVerts, WorldNs, MiscNs, WorldErr, MiscErr, Colors);
+		}
+
+		// Never run with kernels that disagree with the scalar ones
+		if (Broken)
+		{
+			gllog("WARNING:  %s vertex conversion kernels are broken", Names[Level]);
+
+			if (SavedLevel >= Level)
+				SavedLevel = Level - 1;
+		}
+	}
+
+	VtxConv_SetLevel(SavedLevel);
+
+	free(pIn);
+	free(pWorld);
+	free(pWorldRef);
+	free(pMisc);
+	free(pMiscRef);
+}
@@ -0,0 +1,76 @@
+/*
+	@file VtxConv.h
+
+	@brief Vertex conversion kernels for OpenGL driver
+
+	@par
+	The contents of this file are subject to the Genesis3D Public License
+	Version 1.01 (the "License"); you may not use this file except in
+	compliance with the License. You may obtain a copy of the License at
+	http://www.genesis3d.com
+
+	@par
+	Software distributed under the License is distributed on an "AS IS"
+	basis, WITHOUT WARRANTY OF ANY KIND, either express or implied.  See
+	the License for the specific language governing rights and limitations
+	under the License.
+*/
+#ifndef __VTXCONV_H__
+#define __VTXCONV_H__
+
+#include "dcommon.h"
+
+// Kernel levels, best last
+#define VTXCONV_SCALAR				0
+#define VTXCONV_SSE2				1
+#define VTXCONV_AVX2				2
+
+// Packed vertex layouts the poly caches hand to GL.  1/z is stored once, as q, and the
+// flushes read it through overlapping attribute pointers:
+//		position	(x, q, y)			z = q - 1
+//		texture		(q, y, u, v)		s = u, t = v, q = q
+//		lightmap	(lu, lv, x, q)		s = lu, t = lv, q = q
+typedef struct _MiscVertex
+{
+	float x, q, y;
+	float u, v;						// u/z, v/z
+	uint8 r, g, b, a;
+} MiscVertex;						// 24 bytes
+
+typedef struct _WorldVertex
+{
+	float lu, lv;					// Lightmap u/z, v/z
+	float x, q, y;
+	float u, v;
+	uint8 r, g, b, a;
+} WorldVertex;						// 32 bytes
+
+// Per-poly constants for the world kernel
+typedef struct VtxConv_WorldParams
+{
+	float ScaleU, ScaleV;			// Texture scale and shift, with the texture InvScale folded in
+	float ShiftU, ShiftV;
+	float LScale;					// Lightmap InvScale
+	float LShiftU, LShiftV;
+	uint8 Alpha;
+} VtxConv_WorldParams;
+
+// Convert NumVerts engine vertices.  Both return the sum of 1/z over the run.
+typedef float VTXCONV_WORLD(const DRV_TLVertex *pIn, WorldVertex *pOut, int32 NumVerts, const VtxConv_WorldParams *pParams);
+typedef float VTXCONV_MISC(const DRV_TLVertex *pIn, MiscVertex *pOut, int32 NumVerts, uint8 Alpha);
+
+extern VTXCONV_WORLD		*VtxConv_World;
+extern VTXCONV_MISC			*VtxConv_Misc;
+
+// Pick the best kernels the CPU supports, up to MaxLevel
+void VtxConv_Initialize(int32 MaxLevel);
+int32 VtxConv_Level(void);
+
+// Rounded (halves to even) and clamped to 0..255, exactly as the kernels convert colours
+uint8 VtxConv_ToByte(float f);
+
+// Check every supported kernel against the scalar ones over several run lengths, time them
+// and write ns per vertex to the log.  Kernels that fail the check are not used.
+void VtxConv_Benchmark(void);
+
+#endif